@@ -35,27 +35,27 @@ void BTreeNode::save() {
     this->file.put(this->block);
 }
 
-// Get the record and turn it into a block ID.
+// Get the record (in place) and turn it into a block ID.
 BlockID BTreeNode::get_block_id(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID block_id = *(BlockID *) dbt->get_data();
-    delete dbt;
-    return block_id;
+    Dbt dbt;
+    this->block->view(record_id, dbt);
+    return *(BlockID *) dbt.get_data();
 }
 
-// Get the record and turn it into a Handle.
+// Get the record (in place) and turn it into a Handle.
 Handle BTreeNode::get_handle(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID handle_block_id = *(BlockID *) dbt->get_data();
-    RecordID handle_record_id = *(RecordID *) ((char *) dbt->get_data() + sizeof(BlockID));
-    delete dbt;
+    Dbt dbt;
+    this->block->view(record_id, dbt);
+    BlockID handle_block_id = *(BlockID *) dbt.get_data();
+    RecordID handle_record_id = *(RecordID *) ((char *) dbt.get_data() + sizeof(BlockID));
     return Handle(handle_block_id, handle_record_id);
 }
 
-// Get the record and turn it into a KeyValue.
+// Get the record (in place) and turn it into a KeyValue.
 KeyValue *BTreeNode::get_key(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char *) dbt->get_data();
+    Dbt dbt;
+    this->block->view(record_id, dbt);
+    char *bytes = (char *) dbt.get_data();
     KeyValue *key_value = new KeyValue();
     Value value;
     uint offset = 0;
@@ -67,10 +67,7 @@ KeyValue *BTreeNode::get_key(RecordID record_id) const {
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
             uint16_t size = *(uint16_t *) (bytes + offset);
             offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
+            value.s.assign(bytes + offset, size);  // assume ascii for now
             offset += size;
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
             value.n = *(uint8_t *) (bytes + offset);
@@ -80,7 +77,6 @@ KeyValue *BTreeNode::get_key(RecordID record_id) const {
         }
         key_value->push_back(value);
     }
-    delete dbt;
     return key_value;
 }
 
@@ -103,14 +99,15 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
 
 // Convert KeyValue into bytes.
 Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
+    uint block_size = this->file.get_block_size();
+    char *bytes = new char[block_size]; // more than we need
     uint offset = 0;
     uint col_num = 0;
     for (auto const &data_type: this->key_profile) {
         Value value = (*key)[col_num];
 
         if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
+            if (offset + 4 > block_size - 4)
                 throw DbRelationError("index key too big to marshal");
 
             *(int32_t *) (bytes + offset) = value.n;
@@ -120,7 +117,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
             u_long size = (uint16_t) value.s.length();
             if (size > UINT16_MAX)
                 throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
+            if (offset + 2 + size > block_size)
                 throw DbRelationError("index key too big to marshal");
 
             *(uint16_t *) (bytes + offset) = (uint16_t) size;
@@ -129,7 +126,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
             offset += size;
 
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
+            if (offset + 1 > block_size - 1)
                 throw DbRelationError("index key too big to marshal");
 
             *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
@@ -221,12 +218,13 @@ BTreeInterior::~BTreeInterior() {
     this->boundaries.clear();
 }
 
-// Get next block down in tree where key must be.
+// Get next block down in tree where key must be (the leftmost one if key is nullptr).
 BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
+    // last pointer is correct if we don't find an earlier boundary
+    BlockID down = this->pointers.empty() ? this->first : this->pointers.back();
     for (uint i = 0; i < this->boundaries.size(); i++) {
         KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
+        if (key == nullptr || *boundary > *key) {
             if (i > 0)
                 down = this->pointers[i - 1];
             else
@@ -274,7 +272,7 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
     bool inserted = false;
     for (uint i = 0; i < this->boundaries.size(); i++) {
         KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
+        if (*check > *boundary) {
             this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
             this->pointers.insert(this->pointers.begin() + i, block_id);
             inserted = true;
@@ -336,6 +334,26 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
     }
 }
 
+// Bulk loading: add a boundary that sorts after all the others, as long as the block keeps at least
+// reserve bytes free. Returns false and leaves the node alone if not. The first pointer must already
+// have been saved into the block.
+bool BTreeInterior::append(const KeyValue *boundary, BlockID block_id, uint reserve) {
+    Dbt *key_dbt = marshal_key(boundary);
+    Dbt *id_dbt = marshal_block_id(block_id);
+    uint needed = key_dbt->get_size() + id_dbt->get_size() + 2 * this->block->header_size();  // two records plus headers
+    bool fits = this->block->unused_bytes() >= needed + (this->boundaries.empty() ? 0 : reserve);
+    if (fits) {
+        this->block->add(key_dbt);
+        this->block->add(id_dbt);
+        this->boundaries.push_back(new KeyValue(*boundary));
+        this->pointers.push_back(block_id);
+    }
+    delete[] (char *) key_dbt->get_data();
+    delete key_dbt;
+    delete[] (char *) id_dbt->get_data();
+    delete id_dbt;
+    return fits;
+}
 
 ostream &operator<<(ostream &out, const BTreeInterior &node) {
     out << "(interior block " << node.id << "): " << node.first;
@@ -385,6 +403,16 @@ Handle BTreeLeaf::find_eq(const KeyValue *key) const {
     return this->key_map.at(*key);
 }
 
+// Remove key from the leaf if it is there for the given handle. Returns false if it isn't.
+bool BTreeLeaf::del(const KeyValue *key, Handle handle) {
+    auto it = this->key_map.find(*key);
+    if (it == this->key_map.end() || it->second != handle)
+        return false;
+    this->key_map.erase(it);
+    save();
+    return true;
+}
+
 // Save the key_map and next_leaf data in the correct order
 void BTreeLeaf::save() {
     Dbt *dbt;
@@ -473,4 +501,25 @@ Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
     }
 }
 
+// Bulk loading: add a key that sorts after all the others, as long as the block keeps at least
+// reserve bytes free (and room for the next leaf pointer). Returns false and leaves the leaf alone if not.
+bool BTreeLeaf::append(const KeyValue *key, Handle handle, uint reserve) {
+    Dbt *handle_dbt = marshal_handle(handle);
+    Dbt *key_dbt = marshal_key(key);
+    uint header_size = this->block->header_size();
+    uint needed = handle_dbt->get_size() + key_dbt->get_size() + 2 * header_size   // two records plus headers
+                  + sizeof(BlockID) + header_size;                                 // next leaf pointer
+    bool fits = this->block->unused_bytes() >= needed + (this->key_map.empty() ? 0 : reserve);
+    if (fits) {
+        this->block->add(handle_dbt);
+        this->block->add(key_dbt);
+        this->key_map.emplace_hint(this->key_map.end(), *key, handle);
+    }
+    delete[] (char *) handle_dbt->get_data();
+    delete handle_dbt;
+    delete[] (char *) key_dbt->get_data();
+    delete key_dbt;
+    return fits;
+}
+
 
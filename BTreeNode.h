@@ -85,6 +85,8 @@ public:
 
     Insertion insert(const KeyValue *boundary, BlockID block_id);
 
+    bool append(const KeyValue *boundary, BlockID block_id, uint reserve);
+
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
@@ -106,8 +108,18 @@ public:
     Handle find_eq(const KeyValue *key) const;  // throws if not found
     Insertion insert(const KeyValue *key, Handle handle);
 
+    bool append(const KeyValue *key, Handle handle, uint reserve);
+
+    bool del(const KeyValue *key, Handle handle);
+
     virtual void save();
 
+    void set_next_leaf(BlockID next_leaf) { this->next_leaf = next_leaf; }
+
+    BlockID get_next_leaf() const { return this->next_leaf; }
+
+    const std::map<KeyValue, Handle> &get_key_map() const { return this->key_map; }
+
 protected:
     BlockID next_leaf;
     std::map<KeyValue, Handle> key_map;
@@ -0,0 +1,126 @@
+/**
+ * @file BufferPool.cpp - implementation of BufferPool
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cstring>
+#include <map>
+#include "BufferPool.h"
+#include "HeapFile.h"
+
+using namespace std;
+
+uint BufferPool::default_frames = BufferPool::DEFAULT_FRAMES;
+
+/**
+ * Constructor
+ * @param frame_count  number of frames (at least 1)
+ * @param block_size   size of each frame
+ */
+BufferPool::BufferPool(uint frame_count, uint block_size) : block_size(block_size), memory(nullptr), frames(),
+                                                            page_table(), hand(0) {
+    if (frame_count == 0)
+        frame_count = 1;
+    this->memory = new char[(size_t) frame_count * block_size];
+    Frame free = {nullptr, 0, 0, 0, false};
+    this->frames.assign(frame_count, free);
+}
+
+BufferPool::~BufferPool() {
+    delete[] this->memory;
+}
+
+BufferPool &BufferPool::get_default(uint block_size) {
+    static map<uint, BufferPool *> *pools = new map<uint, BufferPool *>();
+    BufferPool *&pool = (*pools)[block_size];
+    if (pool == nullptr) {
+        uint frame_count = default_frames;
+        if (block_size != DbBlock::BLOCK_SZ) {
+            frame_count = (uint) ((size_t) default_frames * DbBlock::BLOCK_SZ / block_size);
+            if (frame_count < MIN_FRAMES)
+                frame_count = MIN_FRAMES;
+        }
+        pool = new BufferPool(frame_count, block_size);
+    }
+    return *pool;
+}
+
+void BufferPool::set_default_frames(uint frame_count) {
+    default_frames = frame_count;
+}
+
+uint BufferPool::pin(HeapFile &file, BlockID block_id, bool is_new) {
+    PageKey key(&file, block_id);
+    auto it = this->page_table.find(key);
+    if (it != this->page_table.end()) {
+        Frame &frame = this->frames[it->second];
+        frame.pins++;
+        if (frame.usage < MAX_USAGE)
+            frame.usage++;
+        return it->second;
+    }
+
+    uint i = victim();
+    Frame &frame = this->frames[i];
+    if (frame.file != nullptr) {
+        write(i);
+        this->page_table.erase(PageKey(frame.file, frame.block_id));
+        frame.file = nullptr;
+    }
+    if (is_new)
+        memset(get_data(i), 0, this->block_size);
+    else
+        file.read_block(block_id, get_data(i));
+    frame.file = &file;
+    frame.block_id = block_id;
+    frame.pins = 1;
+    frame.usage = 1;
+    frame.dirty = false;
+    this->page_table[key] = i;
+    return i;
+}
+
+void BufferPool::unpin(uint frame) {
+    this->frames[frame].pins--;
+}
+
+void BufferPool::write(uint frame) {
+    Frame &f = this->frames[frame];
+    if (f.file == nullptr || !f.dirty)
+        return;
+    f.file->write_block(f.block_id, get_data(frame));
+    f.dirty = false;
+}
+
+void BufferPool::flush(const HeapFile &file) {
+    for (uint i = 0; i < this->frames.size(); i++)
+        if (this->frames[i].file == &file)
+            write(i);
+}
+
+void BufferPool::discard(const HeapFile &file) {
+    for (uint i = 0; i < this->frames.size(); i++) {
+        Frame &frame = this->frames[i];
+        if (frame.file != &file)
+            continue;
+        write(i);
+        this->page_table.erase(PageKey(frame.file, frame.block_id));
+        frame.file = nullptr;
+        frame.usage = 0;
+    }
+}
+
+// Sweep the clock hand around to an unpinned frame that is free or hasn't been used lately.
+uint BufferPool::victim() {
+    size_t sweep = (MAX_USAGE + 1) * this->frames.size();
+    for (size_t step = 0; step <= sweep; step++) {
+        uint i = this->hand;
+        this->hand = (this->hand + 1) % (uint) this->frames.size();
+        Frame &frame = this->frames[i];
+        if (frame.pins > 0)
+            continue;
+        if (frame.file == nullptr || frame.usage == 0)
+            return i;
+        frame.usage--;
+    }
+    throw DbRelationError("all " + to_string(this->frames.size()) + " buffer pool frames are pinned");
+}
@@ -0,0 +1,194 @@
+/**
+ * @file BufferPool.h - BufferPool: in-memory frames for the blocks of HeapFiles
+ * PinnedPage: SlottedPage
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "SlottedPage.h"
+
+class HeapFile;
+
+
+/**
+ * @class BufferPool - a fixed number of block-sized frames shared by HeapFiles
+ *
+ * All the frames of a pool are the same size, so files with bigger blocks (see HeapFile) go through
+ * a default pool of their own, which gets the same amount of memory in fewer, bigger frames.
+ *
+ * A block is read into a frame the first time it is pinned and stays there while anyone has it
+ * pinned. Getting a block that is already in a frame is just a hash lookup, with no copying, and
+ * everyone who pins the block sees the same bytes. Changes are only marked dirty; a dirty frame is
+ * written back to its file when it is evicted or when its file is flushed (on sync and close).
+ *
+ * Replacement is CLOCK-sweep with usage counts: pinning a frame bumps its count (up to MAX_USAGE),
+ * and the clock hand takes one off of each unpinned frame it passes, evicting the first one that is
+ * already at zero. A block that is only touched once, like most of the blocks a long run of index
+ * lookups visits, is gone after one trip around, while hot blocks like B-tree roots and the tail of
+ * a file that is being appended to stay put.
+ */
+class BufferPool {
+public:
+    /**
+     * Number of frames in the default pool unless set_default_frames() says otherwise.
+     */
+    static const uint DEFAULT_FRAMES = 1024;
+
+    /**
+     * Most trips of the clock hand a frame can survive without being pinned again.
+     */
+    static const uint MAX_USAGE = 5;
+
+    /**
+     * Fewest frames a default pool for bigger blocks gets, however big they are.
+     */
+    static const uint MIN_FRAMES = 16;
+
+    /**
+     * @param frame_count  number of frames (at least 1)
+     * @param block_size   size of each frame, which has to match the blocks of the files using the pool
+     */
+    explicit BufferPool(uint frame_count = DEFAULT_FRAMES, uint block_size = DbBlock::BLOCK_SZ);
+
+    virtual ~BufferPool();
+
+    BufferPool(const BufferPool &other) = delete;
+
+    BufferPool(BufferPool &&temp) = delete;
+
+    BufferPool &operator=(const BufferPool &other) = delete;
+
+    BufferPool &operator=(BufferPool &&temp) = delete;
+
+    /**
+     * The pool that HeapFiles with the given block size use unless they are given another one. It is
+     * created the first time it is asked for and never freed. The one for DbBlock::BLOCK_SZ has the
+     * default number of frames; the others have as many as fit in the same memory (at least MIN_FRAMES).
+     * @param block_size  size of the blocks
+     * @return            the default pool for that size
+     */
+    static BufferPool &get_default(uint block_size = DbBlock::BLOCK_SZ);
+
+    /**
+     * Set how many frames the default pool will have. Has no effect once it has been created.
+     * @param frame_count  number of frames (at least 1)
+     */
+    static void set_default_frames(uint frame_count);
+
+    /**
+     * Pin a block into a frame, reading it from the file if it isn't already in one.
+     * @param file      file the block belongs to
+     * @param block_id  which block
+     * @param is_new    if the block isn't in a frame yet, start with zeros instead of reading it
+     * @return          the frame (unpin when done with it)
+     * @throws DbRelationError if every frame is pinned
+     */
+    uint pin(HeapFile &file, BlockID block_id, bool is_new = false);
+
+    /**
+     * Give up a pin taken with pin().
+     * @param frame  the frame
+     */
+    void unpin(uint frame);
+
+    /**
+     * The memory of a pinned frame (get_block_size() bytes).
+     * @param frame  the frame
+     * @return       the block's bits
+     */
+    char *get_data(uint frame) const { return this->memory + (size_t) frame * this->block_size; }
+
+    /**
+     * Note that a pinned frame has been changed and has to be written back.
+     * @param frame  the frame
+     */
+    void mark_dirty(uint frame) { this->frames[frame].dirty = true; }
+
+    /**
+     * Write a frame back to its file now if it is dirty.
+     * @param frame  the frame
+     */
+    void write(uint frame);
+
+    /**
+     * Write back all the dirty frames of a file.
+     * @param file  the file
+     */
+    void flush(const HeapFile &file);
+
+    /**
+     * Write back and forget all the frames of a file, e.g., when it is closed. Frames that are
+     * still pinned are released once the last pin is given up.
+     * @param file  the file
+     */
+    void discard(const HeapFile &file);
+
+    /**
+     * @return  the number of frames in the pool
+     */
+    uint get_frame_count() const { return (uint) this->frames.size(); }
+
+    /**
+     * @return  the size of each frame
+     */
+    uint get_block_size() const { return this->block_size; }
+
+protected:
+    struct Frame {
+        HeapFile *file;  // nullptr if the frame is free
+        BlockID block_id;
+        uint pins;
+        uint usage;
+        bool dirty;
+    };
+    typedef std::pair<const HeapFile *, BlockID> PageKey;
+    struct PageKeyHash {
+        size_t operator()(const PageKey &key) const {
+            return std::hash<const void *>()(key.first) * 31 + key.second;
+        }
+    };
+
+    static uint default_frames;
+    uint block_size;
+    char *memory;
+    std::vector<Frame> frames;
+    std::unordered_map<PageKey, uint, PageKeyHash> page_table;
+    uint hand;
+
+    uint victim();
+};
+
+
+/**
+ * @class PinnedPage - a SlottedPage that is a view of a BufferPool frame
+ *
+ * Handed out by HeapFile::get() and get_new(). The frame stays pinned until the page is deleted.
+ * All the pages of the same block share the frame's memory, so changes made through one of them
+ * are seen by the others (though each one reads the slotted page header only when it is made).
+ */
+class PinnedPage : public SlottedPage {
+public:
+    PinnedPage(Dbt &block, BlockID block_id, BufferPool &pool, uint frame, bool is_new = false)
+            : SlottedPage(block, block_id, is_new), pool(pool), frame(frame) {}
+
+    virtual ~PinnedPage() { this->pool.unpin(this->frame); }
+
+    PinnedPage(const PinnedPage &other) = delete;
+
+    PinnedPage(PinnedPage &&temp) = delete;
+
+    PinnedPage &operator=(const PinnedPage &other) = delete;
+
+    PinnedPage &operator=(PinnedPage &&temp) = delete;
+
+    BufferPool &get_pool() const { return this->pool; }
+
+    uint get_frame() const { return this->frame; }
+
+protected:
+    BufferPool &pool;
+    uint frame;
+};
@@ -0,0 +1,1467 @@
+/**
+ * @file EvalOperator.cpp - implementation of the plan operators
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+
+#include "EvalOperator.h"
+#include "SpillFile.h"
+#include "SlottedPage.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+
+/**
+ * Find where a column is in a row produced by an operator.
+ * @param column_names  the operator's columns
+ * @param column_name   column to look for
+ * @return              its position
+ */
+static uint position_of(const ColumnNames &column_names, const Identifier &column_name) {
+    for (uint i = 0; i < column_names.size(); i++)
+        if (column_names[i] == column_name)
+            return i;
+    throw DbRelationError("unknown column " + column_name);
+}
+
+/**
+ * Hand out the rows of batches from next_batch() one at a time (for operators that work in batches).
+ * @return  the next row (freed by caller), or nullptr when exhausted
+ */
+Tuple *EvalOperator::next_from_batch() {
+    while (this->pending == nullptr || this->pending_i >= this->pending->get_selection().size()) {
+        drop_pending();
+        this->pending = next_batch();
+        if (this->pending == nullptr)
+            return nullptr;
+    }
+    return this->pending->get_row(this->pending->get_selection()[this->pending_i++]);
+}
+
+/**
+ * Let go of any batch being handed out by next_from_batch().
+ */
+void EvalOperator::drop_pending() {
+    delete this->pending;
+    this->pending = nullptr;
+    this->pending_i = 0;
+}
+
+RowBatch *EvalOperator::next_batch() {
+    RowBatch *batch = new RowBatch((uint) this->column_names.size());
+    Tuple *row;
+    while (batch->size() < RowBatch::BATCH_SZ && (row = next()) != nullptr) {
+        batch->append(*row);
+        delete row;
+    }
+    if (batch->size() == 0) {
+        delete batch;
+        return nullptr;
+    }
+    return batch;
+}
+
+/**
+ * Constructor
+ * @param table         relation to scan
+ * @param where         condition to match (copied), or nullptr for all rows
+ * @param column_names  columns to produce (copied), or nullptr (or empty) for all of the table's columns
+ * @param limit         stop after producing this many rows
+ */
+ScanOperator::ScanOperator(DbRelation &table, const Predicate *where, const ColumnNames *column_names, u_long limit)
+        : EvalOperator(), table(table), where(nullptr), cursor(nullptr), limit(limit), produced(0) {
+    if (where != nullptr)
+        this->where = new Predicate(*where);
+    if (column_names != nullptr && !column_names->empty())
+        this->column_names = *column_names;
+    else
+        this->column_names = table.get_column_names();
+}
+
+ScanOperator::~ScanOperator() {
+    close();
+    delete this->where;
+}
+
+void ScanOperator::open() {
+    close();
+    this->table.open();
+    this->cursor = this->where == nullptr ? this->table.cursor() : this->table.cursor(this->where);
+    this->produced = 0;
+}
+
+Tuple *ScanOperator::next() {
+    Handle handle;
+    if (this->cursor == nullptr || this->produced >= this->limit || !this->cursor->next(handle))
+        return nullptr;
+    this->produced++;
+    return this->table.project_tuple(handle, &this->column_names);
+}
+
+RowBatch *ScanOperator::next_batch() {
+    if (this->cursor == nullptr || this->produced >= this->limit)
+        return nullptr;
+    RowBatch *batch = new RowBatch((uint) this->column_names.size());
+    uint max_rows = (uint) std::min((u_long) RowBatch::BATCH_SZ, this->limit - this->produced);
+    uint rows = this->table.project_batch(this->cursor, &this->column_names, batch, max_rows);
+    if (rows == 0) {
+        delete batch;
+        return nullptr;
+    }
+    this->produced += rows;
+    return batch;
+}
+
+void ScanOperator::close() {
+    delete this->cursor;
+    this->cursor = nullptr;
+}
+
+/**
+ * Constructor
+ * @param index         index to search
+ * @param key           value of each of the index's key columns (copied)
+ * @param column_names  columns to produce (copied), or nullptr for all of the table's columns
+ */
+IndexLookupOperator::IndexLookupOperator(DbIndex &index, const ValueDict *key, const ColumnNames *column_names)
+        : ScanOperator(index.get_relation(), nullptr, column_names), index(index), key(*key) {
+}
+
+void IndexLookupOperator::open() {
+    close();
+    this->table.open();
+    this->index.open();
+    this->cursor = new HandlesCursor(this->index.lookup(&this->key));
+}
+
+/**
+ * Constructor
+ * @param index         index to search
+ * @param low_key       lowest value of each of the index's key columns (copied), or nullptr for no low end
+ * @param high_key      highest value of each of the index's key columns (copied), or nullptr for no high end
+ * @param column_names  columns to produce (copied), or nullptr for all of the table's columns
+ */
+IndexRangeOperator::IndexRangeOperator(DbIndex &index, const ValueDict *low_key, const ValueDict *high_key,
+                                       const ColumnNames *column_names)
+        : ScanOperator(index.get_relation(), nullptr, column_names), index(index), low_key(nullptr),
+          high_key(nullptr) {
+    if (low_key != nullptr)
+        this->low_key = new ValueDict(*low_key);
+    if (high_key != nullptr)
+        this->high_key = new ValueDict(*high_key);
+}
+
+IndexRangeOperator::~IndexRangeOperator() {
+    delete this->low_key;
+    delete this->high_key;
+}
+
+void IndexRangeOperator::open() {
+    close();
+    this->table.open();
+    this->index.open();
+    this->cursor = this->index.range_cursor(this->low_key, this->high_key);
+}
+
+/**
+ * Constructor
+ * @param input      where the rows come from (freed by us)
+ * @param predicate  condition the rows must meet
+ */
+SelectOperator::SelectOperator(EvalOperator *input, const Predicate *predicate) : EvalOperator(), input(input),
+                                                                                  predicate(nullptr, ColumnNames()) {
+    this->column_names = input->get_column_names();
+    try {
+        this->predicate = CompiledPredicate(predicate, this->column_names);
+    } catch (...) {
+        delete input;
+        throw;
+    }
+}
+
+SelectOperator::~SelectOperator() {
+    delete this->input;
+}
+
+Tuple *SelectOperator::next() {
+    Tuple *row;
+    while ((row = this->input->next()) != nullptr) {
+        if (this->predicate.matches(*row))
+            return row;
+        delete row;
+    }
+    return nullptr;
+}
+
+RowBatch *SelectOperator::next_batch() {
+    RowBatch *batch;
+    while ((batch = this->input->next_batch()) != nullptr) {
+        batch->select(this->predicate);
+        if (!batch->get_selection().empty())
+            return batch;
+        delete batch;
+    }
+    return nullptr;
+}
+
+/**
+ * Constructor
+ * @param input         where the rows come from (freed by us)
+ * @param column_names  which of the input's columns to produce and in what order
+ */
+ProjectOperator::ProjectOperator(EvalOperator *input, const ColumnNames *column_names) : EvalOperator(),
+                                                                                        input(input),
+                                                                                        positions() {
+    this->column_names = *column_names;
+    try {
+        for (auto const &column_name: *column_names)
+            this->positions.push_back(position_of(input->get_column_names(), column_name));
+    } catch (...) {
+        delete input;
+        throw;
+    }
+}
+
+ProjectOperator::~ProjectOperator() {
+    delete this->input;
+}
+
+Tuple *ProjectOperator::next() {
+    Tuple *row = this->input->next();
+    if (row == nullptr)
+        return nullptr;
+    Tuple *ret = new Tuple();
+    ret->reserve((uint) this->positions.size());
+    for (auto const &i: this->positions)
+        ret->append(*row, i);
+    delete row;
+    return ret;
+}
+
+RowBatch *ProjectOperator::next_batch() {
+    RowBatch *batch = this->input->next_batch();
+    if (batch == nullptr)
+        return nullptr;
+    RowBatch *ret = batch->gather(this->positions);
+    delete batch;
+    return ret;
+}
+
+/**
+ * Constructor
+ * @param input  where the rows come from (freed by us)
+ * @param alias  qualifier for the column names
+ */
+RenameOperator::RenameOperator(EvalOperator *input, const Identifier &alias) : EvalOperator(), input(input) {
+    for (auto const &column_name: input->get_column_names())
+        this->column_names.push_back(alias + "." + column_name);
+}
+
+RenameOperator::~RenameOperator() {
+    delete this->input;
+}
+
+/**
+ * Constructor
+ * @param left        left input (freed by us)
+ * @param right       right input (freed by us)
+ * @param left_keys   join columns of the left input
+ * @param right_keys  corresponding join columns of the right input
+ * @param memory      most bytes of build side rows to hold in memory before resorting to spilling
+ */
+HashJoinOperator::HashJoinOperator(EvalOperator *left, EvalOperator *right, const ColumnNames *left_keys,
+                                   const ColumnNames *right_keys, size_t memory)
+        : EvalOperator(), memory(memory), build(0), build_batches(), table(), read_ahead(), probe_done(true),
+          probe_file(nullptr), probe(nullptr), k(0), partition(0), key() {
+    this->inputs[0] = left;
+    this->inputs[1] = right;
+    try {
+        if (left_keys->size() != right_keys->size())
+            throw DbRelationError("join needs the same number of key columns on each side");
+        for (auto const &column_name: *left_keys)
+            this->keys[0].push_back(position_of(left->get_column_names(), column_name));
+        for (auto const &column_name: *right_keys)
+            this->keys[1].push_back(position_of(right->get_column_names(), column_name));
+    } catch (...) {
+        delete left;
+        delete right;
+        throw;
+    }
+    this->column_names = left->get_column_names();
+    for (auto const &column_name: right->get_column_names())
+        this->column_names.push_back(column_name);
+}
+
+HashJoinOperator::~HashJoinOperator() {
+    close();
+    delete this->inputs[0];
+    delete this->inputs[1];
+}
+
+/**
+ * Read both inputs until one of them ends (that's the build side) or both have gone over the
+ * memory budget (then spill them both).
+ */
+void HashJoinOperator::open() {
+    close();
+    this->inputs[0]->open();
+    this->inputs[1]->open();
+    std::vector<RowBatch *> ahead[2];
+    size_t size[2] = {0, 0};
+    bool done[2] = {false, false};
+    try {
+        while (!done[0] && !done[1]) {
+            if (size[0] > this->memory && size[1] > this->memory) {
+                spill(ahead);
+                return;
+            }
+            for (uint side = 0; side < 2; side++) {
+                if (done[side] || size[side] > this->memory)
+                    continue;
+                RowBatch *batch = this->inputs[side]->next_batch();
+                if (batch == nullptr) {
+                    done[side] = true;
+                } else {
+                    ahead[side].push_back(batch);
+                    size[side] += batch->bytes();
+                }
+            }
+        }
+    } catch (...) {
+        for (uint side = 0; side < 2; side++)
+            for (auto const &batch: ahead[side])
+                delete batch;
+        throw;
+    }
+    this->build = done[0] && (!done[1] || size[0] <= size[1]) ? 0 : 1;
+    uint other = 1 - this->build;
+    load(ahead[this->build]);
+    for (auto const &batch: ahead[other])
+        this->read_ahead.push_back(batch);
+    this->probe_done = done[other] || this->table.empty();  // no need to read the probe side if nothing can match
+}
+
+/**
+ * Put build side rows into the hash table.
+ * @param batches  the rows (now belonging to us)
+ */
+void HashJoinOperator::load(std::vector<RowBatch *> &batches) {
+    for (auto const &batch: batches) {
+        uint b = (uint) this->build_batches.size();
+        this->build_batches.push_back(batch);
+        for (auto const &r: batch->get_selection()) {
+            batch->get_key(r, this->keys[this->build], this->key);
+            this->table[this->key].push_back(std::make_pair(b, r));
+        }
+    }
+    batches.clear();
+}
+
+/**
+ * Partition everything from both inputs (starting with what's been read already) into temporary files.
+ * @param ahead  batches already read from each input (freed here)
+ */
+void HashJoinOperator::spill(std::vector<RowBatch *> *ahead) {
+    std::hash<std::string> hash;
+    for (uint side = 0; side < 2; side++) {
+        for (uint p = 0; p < PARTITIONS; p++)
+            this->partitions[side].push_back(new SpillFile());
+        uint i = 0;
+        RowBatch *batch = nullptr;
+        try {
+            while (true) {
+                if (i < ahead[side].size()) {
+                    batch = ahead[side][i];
+                    ahead[side][i++] = nullptr;
+                } else if ((batch = this->inputs[side]->next_batch()) == nullptr) {
+                    break;
+                }
+                for (auto const &r: batch->get_selection()) {
+                    batch->get_key(r, this->keys[side], this->key);
+                    this->partitions[side][hash(this->key) % PARTITIONS]->append(*batch, r);
+                }
+                delete batch;
+                batch = nullptr;
+            }
+        } catch (...) {
+            delete batch;
+            for (uint s = 0; s < 2; s++)
+                for (auto const &b: ahead[s])
+                    delete b;
+            throw;
+        }
+    }
+    this->partition = 0;
+    next_partition();
+}
+
+/**
+ * Move on to the next pair of spilled partitions that could have any matches, building on the
+ * smaller of the pair.
+ * @return  false if there are no more
+ */
+bool HashJoinOperator::next_partition() {
+    reset();
+    while (this->partition < this->partitions[0].size()) {
+        uint p = this->partition++;
+        SpillFile *sides[2] = {this->partitions[0][p], this->partitions[1][p]};
+        if (sides[0]->size() == 0 || sides[1]->size() == 0)
+            continue;
+        this->build = sides[0]->bytes() <= sides[1]->bytes() ? 0 : 1;
+        std::vector<RowBatch *> batches;
+        RowBatch *batch;
+        while ((batch = sides[this->build]->next_batch()) != nullptr)
+            batches.push_back(batch);
+        load(batches);
+        this->probe_file = sides[1 - this->build];
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Let go of the hash table and the probe side's current state.
+ */
+void HashJoinOperator::reset() {
+    for (auto const &batch: this->build_batches)
+        delete batch;
+    this->build_batches.clear();
+    this->table.clear();
+    for (auto const &batch: this->read_ahead)
+        delete batch;
+    this->read_ahead.clear();
+    delete this->probe;
+    this->probe = nullptr;
+    this->k = 0;
+    this->probe_file = nullptr;
+    this->probe_done = true;
+}
+
+/**
+ * @return  the next batch of probe side rows, or nullptr if there are no more (in this partition)
+ */
+RowBatch *HashJoinOperator::next_probe() {
+    if (!this->read_ahead.empty()) {
+        RowBatch *batch = this->read_ahead.front();
+        this->read_ahead.pop_front();
+        return batch;
+    }
+    if (this->probe_file != nullptr)
+        return this->probe_file->next_batch();
+    if (this->probe_done)
+        return nullptr;
+    RowBatch *batch = this->inputs[1 - this->build]->next_batch();
+    if (batch == nullptr)
+        this->probe_done = true;
+    return batch;
+}
+
+RowBatch *HashJoinOperator::next_batch() {
+    uint left_width = (uint) this->inputs[0]->get_column_names().size();
+    RowBatch *ret = new RowBatch((uint) this->column_names.size());
+    while (ret->size() < RowBatch::BATCH_SZ) {
+        if (this->probe == nullptr || this->k >= this->probe->get_selection().size()) {
+            delete this->probe;
+            this->probe = next_probe();
+            this->k = 0;
+            if (this->probe == nullptr && !next_partition())
+                break;
+            continue;
+        }
+        uint r = this->probe->get_selection()[this->k++];
+        this->probe->get_key(r, this->keys[1 - this->build], this->key);
+        HashTable::const_iterator found = this->table.find(this->key);
+        if (found == this->table.end())
+            continue;
+        for (auto const &match: found->second) {
+            const RowBatch &matched = *this->build_batches[match.first];
+            if (this->build == 0) {
+                ret->append(0, matched, match.second);
+                ret->append(left_width, *this->probe, r);
+            } else {
+                ret->append(0, *this->probe, r);
+                ret->append(left_width, matched, match.second);
+            }
+            ret->end_row();
+        }
+    }
+    if (ret->size() == 0) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+void HashJoinOperator::close() {
+    reset();
+    for (uint side = 0; side < 2; side++) {
+        for (auto const &file: this->partitions[side])
+            delete file;
+        this->partitions[side].clear();
+    }
+    this->partition = 0;
+    drop_pending();
+    this->inputs[0]->close();
+    this->inputs[1]->close();
+}
+
+/**
+ * Constructor
+ * @param outer          outer input (freed by us)
+ * @param index          index on the inner table whose key columns are all among inner_keys
+ * @param alias          qualifier for the inner table's column names
+ * @param outer_keys     join columns of the outer input
+ * @param inner_keys     corresponding join columns of the inner table (unqualified)
+ * @param inner_columns  inner table columns to produce (unqualified), or nullptr for all of them
+ * @param filter         condition the inner rows must also meet (unqualified), or nullptr for none
+ */
+IndexJoinOperator::IndexJoinOperator(EvalOperator *outer, DbIndex &index, const Identifier &alias,
+                                     const ColumnNames *outer_keys, const ColumnNames *inner_keys,
+                                     const ColumnNames *inner_columns, const Predicate *filter)
+        : EvalOperator(), outer(outer), index(index), table(index.get_relation()), fetched(), probe(), keys(),
+          filter(nullptr, ColumnNames()) {
+    try {
+        this->fetched = inner_columns != nullptr && !inner_columns->empty() ? *inner_columns
+                                                                             : this->table.get_column_names();
+        this->column_names = outer->get_column_names();
+        for (auto const &column_name: this->fetched)
+            this->column_names.push_back(alias + "." + column_name);
+        auto fetch = [this](const Identifier &column_name) {
+            if (std::find(this->fetched.begin(), this->fetched.end(), column_name) == this->fetched.end())
+                this->fetched.push_back(column_name);
+            return position_of(this->fetched, column_name);
+        };
+        for (uint i = 0; i < inner_keys->size(); i++)
+            this->keys.push_back(make_pair(position_of(outer->get_column_names(), (*outer_keys)[i]),
+                                           fetch((*inner_keys)[i])));
+        for (auto const &key_column: index.get_key_columns())
+            this->probe.push_back(this->keys[position_of(*inner_keys, key_column)].first);
+        if (filter != nullptr) {
+            ColumnNames filter_columns;
+            filter->get_column_names(filter_columns);
+            for (auto const &column_name: filter_columns)
+                fetch(column_name);
+            this->filter = CompiledPredicate(filter, this->fetched);
+        }
+    } catch (...) {
+        delete outer;
+        throw;
+    }
+}
+
+IndexJoinOperator::~IndexJoinOperator() {
+    close();
+    delete this->outer;
+}
+
+void IndexJoinOperator::open() {
+    close();
+    this->outer->open();
+    this->table.open();
+    this->index.open();
+}
+
+RowBatch *IndexJoinOperator::next_batch() {
+    uint outer_width = (uint) this->outer->get_column_names().size();
+    uint width = (uint) this->column_names.size();
+    RowBatch *batch;
+    while ((batch = this->outer->next_batch()) != nullptr) {
+        // sort the probes into index order
+        std::vector<std::pair<std::vector<Value>, uint> > probes;
+        probes.reserve(batch->get_selection().size());
+        for (auto const &r: batch->get_selection()) {
+            std::vector<Value> key;
+            for (auto const &j: this->probe)
+                key.push_back(batch->get(j, r));
+            probes.push_back(make_pair(key, r));
+        }
+        std::sort(probes.begin(), probes.end());
+
+        RowBatch *ret = new RowBatch(width);
+        Handles *handles = nullptr;
+        try {
+            for (uint i = 0; i < probes.size(); i++) {
+                if (handles == nullptr || probes[i].first != probes[i - 1].first) {
+                    delete handles;
+                    handles = nullptr;
+                    ValueDict key;
+                    for (uint k = 0; k < this->probe.size(); k++)
+                        key[this->index.get_key_columns()[k]] = probes[i].first[k];
+                    handles = this->index.lookup(&key);
+                }
+                uint r = probes[i].second;
+                for (auto const &handle: *handles) {
+                    Tuple *row = this->table.project_tuple(handle, &this->fetched);
+                    bool is_selected = true;
+                    for (auto const &key: this->keys)
+                        if (!row->equals(key.second, batch->get(key.first, r))) {
+                            is_selected = false;
+                            break;
+                        }
+                    if (is_selected && this->filter.matches(*row)) {
+                        row->resize(width - outer_width);  // drop any columns fetched only for checking
+                        ret->append(0, *batch, r);
+                        ret->append(outer_width, *row);
+                        ret->end_row();
+                    }
+                    delete row;
+                }
+            }
+        } catch (...) {
+            delete handles;
+            delete ret;
+            delete batch;
+            throw;
+        }
+        delete handles;
+        delete batch;
+        if (ret->size() > 0)
+            return ret;
+        delete ret;
+    }
+    return nullptr;
+}
+
+void IndexJoinOperator::close() {
+    drop_pending();
+    this->outer->close();
+}
+
+Identifier Aggregation::get_name() const {
+    static const char *names[] = {"COUNT", "SUM", "MIN", "MAX"};
+    return Identifier(names[this->function]) + "(" + (this->column_name.empty() ? "*" : this->column_name) + ")";
+}
+
+static const uint NO_GROUP = UINT32_MAX;  // find_group result for a row that had to be spilled
+
+/**
+ * Constructor
+ * @param input         rows to aggregate (freed by us)
+ * @param group_by      columns whose values make up the groups (can be empty for a single group)
+ * @param aggregations  aggregates to produce for each group
+ * @param memory        how many bytes the groups can take before we spill
+ */
+HashAggregateOperator::HashAggregateOperator(EvalOperator *input, const ColumnNames *group_by,
+                                             const Aggregations *aggregations, size_t memory)
+        : EvalOperator(), input(input), group_columns(), aggregations(*aggregations), arguments(), memory(memory),
+          slots(), hashes(), keys(), groups(), accumulators(), used(0), spilled(), partitions(), level(0),
+          emitted(0), key() {
+    try {
+        for (auto const &column_name: *group_by) {
+            this->group_columns.push_back(position_of(input->get_column_names(), column_name));
+            this->column_names.push_back(column_name);
+        }
+        for (auto const &aggregation: this->aggregations) {
+            if (aggregation.column_name.empty() && aggregation.function != Aggregation::COUNT)
+                throw DbRelationError(aggregation.get_name() + " needs a column");
+            this->arguments.push_back(aggregation.column_name.empty() ? 0 : position_of(input->get_column_names(),
+                                                                                       aggregation.column_name));
+            this->column_names.push_back(aggregation.get_name());
+        }
+    } catch (...) {
+        delete input;
+        throw;
+    }
+}
+
+HashAggregateOperator::~HashAggregateOperator() {
+    close();
+    delete this->input;
+}
+
+/**
+ * Aggregate the whole input (spilling whatever doesn't fit).
+ */
+void HashAggregateOperator::open() {
+    close();
+    this->input->open();
+    start_pass(0);
+    RowBatch *batch;
+    while ((batch = this->input->next_batch()) != nullptr)
+        consume(batch);
+    finish_pass();
+}
+
+RowBatch *HashAggregateOperator::next_batch() {
+    uint width = (uint) this->column_names.size();
+    uint group_width = (uint) this->group_columns.size();
+    uint n = (uint) this->aggregations.size();
+    while (this->emitted >= this->hashes.size()) {
+        if (this->spilled.empty())
+            return nullptr;
+        std::pair<SpillFile *, uint> next = this->spilled.front();
+        this->spilled.pop_front();
+        try {
+            start_pass(next.second);
+            RowBatch *batch;
+            while ((batch = next.first->next_batch()) != nullptr)
+                consume(batch);
+        } catch (...) {
+            delete next.first;
+            throw;
+        }
+        delete next.first;
+        finish_pass();
+    }
+
+    RowBatch *ret = new RowBatch(width);
+    while (this->emitted < this->hashes.size() && ret->size() < RowBatch::BATCH_SZ) {
+        uint g = this->emitted++;
+        ret->append(0, *this->groups[g / RowBatch::BATCH_SZ], g % RowBatch::BATCH_SZ);
+        for (uint a = 0; a < n; a++) {
+            int64_t value = this->accumulators[g * n + a];
+            if (value == INT64_MAX || value == INT64_MIN)  // MIN or MAX of no rows
+                value = 0;
+            if (value < INT32_MIN || value > INT32_MAX) {
+                delete ret;
+                throw DbRelationError(this->aggregations[a].get_name() + " is out of range for an INT");
+            }
+            ret->append_n(group_width + a, ColumnAttribute::INT, (int32_t) value);
+        }
+        ret->end_row();
+    }
+    return ret;
+}
+
+void HashAggregateOperator::close() {
+    drop_pending();
+    this->input->close();
+    reset();
+    for (auto const &partition: this->spilled)
+        delete partition.first;
+    this->spilled.clear();
+}
+
+/**
+ * Add the rows of a batch to their groups.
+ * @param batch  the rows (freed here)
+ */
+void HashAggregateOperator::consume(RowBatch *batch) {
+    try {
+        uint n = (uint) this->aggregations.size();
+        std::vector<const int32_t *> ns(n, nullptr);
+        for (uint a = 0; a < n; a++)
+            if (this->aggregations[a].function != Aggregation::COUNT) {
+                if (batch->get_data_type(this->arguments[a]) == ColumnAttribute::TEXT)
+                    throw DbRelationError("cannot take " + this->aggregations[a].get_name() + " of a TEXT column");
+                ns[a] = batch->get_ns(this->arguments[a]);
+            }
+        if (this->group_columns.empty()) {
+            consume_all(*batch, ns);
+        } else {
+            for (auto const &r: batch->get_selection()) {
+                batch->get_key(r, this->group_columns, this->key);
+                size_t h = hash(this->key);
+                uint g = find_group(*batch, r, h);
+                if (g == NO_GROUP) {
+                    if (this->partitions.empty())
+                        for (uint p = 0; p < PARTITIONS; p++)
+                            this->partitions.push_back(new SpillFile());
+                    this->partitions[(h >> 40) % PARTITIONS]->append(*batch, r);
+                    continue;
+                }
+                int64_t *accumulator = &this->accumulators[(size_t) g * n];
+                for (uint a = 0; a < n; a++)
+                    switch (this->aggregations[a].function) {
+                        case Aggregation::COUNT:
+                            accumulator[a]++;
+                            break;
+                        case Aggregation::SUM:
+                            accumulator[a] += ns[a][r];
+                            break;
+                        case Aggregation::MIN:
+                            accumulator[a] = std::min(accumulator[a], (int64_t) ns[a][r]);
+                            break;
+                        case Aggregation::MAX:
+                            accumulator[a] = std::max(accumulator[a], (int64_t) ns[a][r]);
+                            break;
+                    }
+            }
+        }
+    } catch (...) {
+        delete batch;
+        throw;
+    }
+    delete batch;
+}
+
+/**
+ * Add all the rows of a batch to the single group (when there are no group columns), an aggregate
+ * at a time.
+ * @param batch  the rows
+ * @param ns     the INT values of each aggregation's column (nullptr for COUNT)
+ */
+void HashAggregateOperator::consume_all(const RowBatch &batch, const std::vector<const int32_t *> &ns) {
+    const std::vector<uint> &selection = batch.get_selection();
+    for (uint a = 0; a < this->aggregations.size(); a++) {
+        int64_t accumulator = this->accumulators[a];
+        const int32_t *values = ns[a];
+        switch (this->aggregations[a].function) {
+            case Aggregation::COUNT:
+                accumulator += selection.size();
+                break;
+            case Aggregation::SUM:
+                for (auto const &r: selection)
+                    accumulator += values[r];
+                break;
+            case Aggregation::MIN:
+                for (auto const &r: selection)
+                    accumulator = std::min(accumulator, (int64_t) values[r]);
+                break;
+            case Aggregation::MAX:
+                for (auto const &r: selection)
+                    accumulator = std::max(accumulator, (int64_t) values[r]);
+                break;
+        }
+        this->accumulators[a] = accumulator;
+    }
+}
+
+/**
+ * Hash an encoded group key, differently at each level of spilling so that a spilled partition
+ * splits up again if it gets spilled itself.
+ */
+size_t HashAggregateOperator::hash(const std::string &key) const {
+    uint64_t h = std::hash<std::string>()(key) ^ (this->level * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t) h;
+}
+
+/**
+ * Find the group of a row (whose encoded key is in this->key), adding a new group if there is room.
+ * @param batch  where the row is
+ * @param r      row number within the batch
+ * @param h      hash of the key
+ * @return       the group number, or NO_GROUP if it is a new group and the groups are using up the memory budget
+ */
+uint HashAggregateOperator::find_group(const RowBatch &batch, uint r, size_t h) {
+    size_t mask = this->slots.size() - 1;
+    size_t i = h & mask;
+    for (; this->slots[i] != 0; i = (i + 1) & mask) {
+        uint g = this->slots[i] - 1;
+        if (this->hashes[g] == h && this->keys[g] == this->key)
+            return g;
+    }
+    if (this->used > this->memory)
+        return NO_GROUP;
+
+    uint g = (uint) this->hashes.size();
+    this->slots[i] = g + 1;
+    this->hashes.push_back(h);
+    this->keys.push_back(this->key);
+    if (g % RowBatch::BATCH_SZ == 0)
+        this->groups.push_back(new RowBatch((uint) this->group_columns.size()));
+    RowBatch *values = this->groups.back();
+    for (uint j = 0; j < this->group_columns.size(); j++) {
+        uint k = this->group_columns[j];
+        if (batch.get_data_type(k) == ColumnAttribute::TEXT)
+            values->append_s(j, batch.get_text(k, r), batch.get_length(k, r));
+        else
+            values->append_n(j, batch.get_data_type(k), batch.get_ns(k)[r]);
+    }
+    values->end_row();
+    for (auto const &aggregation: this->aggregations)
+        this->accumulators.push_back(aggregation.function == Aggregation::MIN ? INT64_MAX :
+                                     aggregation.function == Aggregation::MAX ? INT64_MIN : 0);
+    this->used += 2 * this->key.size() + this->aggregations.size() * sizeof(int64_t) + sizeof(size_t) +
+                  2 * sizeof(uint32_t) + sizeof(std::string);
+    if (this->hashes.size() * 2 > this->slots.size())
+        grow();
+    return g;
+}
+
+/**
+ * Double the number of hash table slots.
+ */
+void HashAggregateOperator::grow() {
+    this->slots.assign(this->slots.size() * 2, 0);
+    size_t mask = this->slots.size() - 1;
+    for (uint g = 0; g < this->hashes.size(); g++) {
+        size_t i = this->hashes[g] & mask;
+        while (this->slots[i] != 0)
+            i = (i + 1) & mask;
+        this->slots[i] = g + 1;
+    }
+}
+
+/**
+ * Start over with no groups (or the single group, if there are no group columns).
+ * @param level  how many times the rows about to be consumed have been spilled
+ */
+void HashAggregateOperator::start_pass(uint level) {
+    reset();
+    this->level = level;
+    this->slots.assign(RowBatch::BATCH_SZ, 0);
+    if (this->group_columns.empty()) {
+        this->key.clear();
+        find_group(RowBatch(0), 0, 0);
+    }
+}
+
+/**
+ * Queue up the partitions spilled during this pass.
+ */
+void HashAggregateOperator::finish_pass() {
+    for (auto const &partition: this->partitions)
+        if (partition->size() > 0)
+            this->spilled.push_back(std::make_pair(partition, this->level + 1));
+        else
+            delete partition;
+    this->partitions.clear();
+}
+
+/**
+ * Let go of the groups of the current pass.
+ */
+void HashAggregateOperator::reset() {
+    for (auto const &batch: this->groups)
+        delete batch;
+    this->groups.clear();
+    this->slots.clear();
+    this->hashes.clear();
+    this->keys.clear();
+    this->accumulators.clear();
+    this->used = 0;
+    this->emitted = 0;
+    for (auto const &partition: this->partitions)
+        delete partition;
+    this->partitions.clear();
+}
+
+/**
+ * Constructor
+ * @param input         rows to sort (freed by us)
+ * @param sort_columns  columns to sort on, most significant first
+ * @param descending    for each of the sort columns, whether it goes from high to low
+ * @param limit         how many rows to produce (at most)
+ * @param memory        how many bytes the rows can take before we spill
+ */
+SortOperator::SortOperator(EvalOperator *input, const ColumnNames *sort_columns, const std::vector<bool> *descending,
+                           u_long limit, size_t memory)
+        : EvalOperator(), input(input), columns(), descending(*descending), limit(limit), memory(memory),
+          top_n(false), batches(), entries(), used(0), runs(), tree(), next_entry(0), produced(0), key() {
+    try {
+        if (sort_columns->size() != descending->size())
+            throw DbRelationError("sort needs a direction for each column");
+        for (auto const &column_name: *sort_columns)
+            this->columns.push_back(position_of(input->get_column_names(), column_name));
+    } catch (...) {
+        delete input;
+        throw;
+    }
+    this->column_names = input->get_column_names();
+}
+
+SortOperator::~SortOperator() {
+    close();
+    delete this->input;
+}
+
+/**
+ * Read and sort the whole input (or get it into sorted runs ready to merge).
+ */
+void SortOperator::open() {
+    close();
+    this->input->open();
+    if (this->limit == 0)
+        return;
+    const size_t row_size = 256;  // rough guess at the memory a kept row and its key take
+    this->top_n = this->limit <= this->memory / row_size;
+    RowBatch *batch;
+    while ((batch = this->input->next_batch()) != nullptr)
+        if (this->top_n)
+            keep_best(batch);
+        else
+            add(batch);
+    if (this->top_n) {
+        std::sort_heap(this->entries.begin(), this->entries.end());
+    } else if (this->runs.empty()) {
+        std::sort(this->entries.begin(), this->entries.end());
+    } else {
+        if (!this->entries.empty())
+            spill_run();
+        uint k = (uint) this->runs.size();
+        for (uint run = 0; run < k; run++)
+            advance(run);
+        std::vector<uint> winners(2 * k);
+        for (uint run = 0; run < k; run++)
+            winners[k + run] = run;
+        this->tree.assign(k, 0);
+        for (uint n = k - 1; n > 0; n--) {
+            uint a = winners[2 * n], b = winners[2 * n + 1];
+            winners[n] = beats(a, b) ? a : b;
+            this->tree[n] = beats(a, b) ? b : a;
+        }
+        this->tree[0] = winners[1];
+    }
+}
+
+RowBatch *SortOperator::next_batch() {
+    if (this->produced >= this->limit)
+        return nullptr;
+    RowBatch *ret = new RowBatch((uint) this->column_names.size());
+    try {
+        while (ret->size() < RowBatch::BATCH_SZ && this->produced < this->limit) {
+            if (this->runs.empty()) {
+                if (this->next_entry >= this->entries.size())
+                    break;
+                const Entry &entry = this->entries[this->next_entry++];
+                ret->append(0, *this->batches[entry.batch], entry.row);
+            } else {
+                uint winner = this->tree[0];
+                const Run &run = this->runs[winner];
+                if (run.file == nullptr)
+                    break;  // the best is an exhausted run, so they all are
+                ret->append(0, *run.batch, run.batch->get_selection()[run.i]);
+                advance(winner);
+                replay(winner);
+            }
+            ret->end_row();
+            this->produced++;
+        }
+    } catch (...) {
+        delete ret;
+        throw;
+    }
+    if (ret->size() == 0) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+void SortOperator::close() {
+    drop_pending();
+    this->input->close();
+    clear();
+}
+
+/**
+ * Take in a batch of rows to be sorted, spilling a run if we're over budget.
+ * @param batch  the rows (now belonging to us)
+ */
+void SortOperator::add(RowBatch *batch) {
+    uint b = (uint) this->batches.size();
+    this->batches.push_back(batch);
+    this->used += batch->bytes();
+    for (auto const &r: batch->get_selection()) {
+        batch->get_sort_key(r, this->columns, this->descending, this->key);
+        this->entries.push_back(Entry{this->key, b, r});
+        this->used += sizeof(Entry) + this->key.size();
+    }
+    if (this->used > this->memory)
+        spill_run();
+}
+
+/**
+ * Keep whichever rows of a batch are among the best limit rows seen so far. The kept rows are
+ * copied into batches[0], and entries is a max-heap on them, so the worst kept row is the one
+ * to beat. Rows that have been pushed out are squeezed out of batches[0] now and then.
+ * @param batch  the rows (freed here)
+ */
+void SortOperator::keep_best(RowBatch *batch) {
+    if (this->batches.empty())
+        this->batches.push_back(new RowBatch(batch->width()));
+    RowBatch *kept = this->batches[0];
+    for (auto const &r: batch->get_selection()) {
+        batch->get_sort_key(r, this->columns, this->descending, this->key);
+        if (this->entries.size() >= this->limit) {
+            if (this->key >= this->entries.front().key)
+                continue;  // ties go to the earlier row
+            std::pop_heap(this->entries.begin(), this->entries.end());
+            this->entries.pop_back();
+        }
+        kept->append(0, *batch, r);
+        kept->end_row();
+        this->entries.push_back(Entry{this->key, 0, kept->size() - 1});
+        std::push_heap(this->entries.begin(), this->entries.end());
+    }
+    delete batch;
+
+    if (kept->size() > 2 * this->limit + RowBatch::BATCH_SZ) {
+        std::sort(this->entries.begin(), this->entries.end(),
+                  [](const Entry &a, const Entry &b) { return a.row < b.row; });  // keeps ties in input order
+        RowBatch *squeezed = new RowBatch(kept->width());
+        for (auto &entry: this->entries) {
+            squeezed->append(0, *kept, entry.row);
+            squeezed->end_row();
+            entry.row = squeezed->size() - 1;
+        }
+        delete kept;
+        this->batches[0] = squeezed;
+        std::make_heap(this->entries.begin(), this->entries.end());
+    }
+}
+
+/**
+ * Sort the rows we're holding and write them out as a run.
+ */
+void SortOperator::spill_run() {
+    std::sort(this->entries.begin(), this->entries.end());
+    this->runs.push_back(Run{new SpillFile(), nullptr, 0, std::string()});
+    SpillFile *file = this->runs.back().file;
+    for (auto const &entry: this->entries)
+        file->append(*this->batches[entry.batch], entry.row);
+    for (auto const &batch: this->batches)
+        delete batch;
+    this->batches.clear();
+    this->entries.clear();
+    this->used = 0;
+}
+
+/**
+ * Whether the current row of run a goes before that of run b (an exhausted run never does).
+ */
+bool SortOperator::beats(uint a, uint b) const {
+    const Run &x = this->runs[a];
+    const Run &y = this->runs[b];
+    if (x.file == nullptr)
+        return false;
+    if (y.file == nullptr)
+        return true;
+    int c = x.key.compare(y.key);
+    return c < 0 || (c == 0 && a < b);  // earlier runs have the earlier rows
+}
+
+/**
+ * Move a run on to its next row (or its first, if it hasn't started), dropping its file when it runs out.
+ */
+void SortOperator::advance(uint run) {
+    Run &r = this->runs[run];
+    r.i++;
+    if (r.batch == nullptr || r.i >= r.batch->get_selection().size()) {
+        delete r.batch;
+        r.batch = r.file->next_batch();
+        r.i = 0;
+        if (r.batch == nullptr) {
+            delete r.file;
+            r.file = nullptr;
+            return;
+        }
+    }
+    r.batch->get_sort_key(r.batch->get_selection()[r.i], this->columns, this->descending, r.key);
+}
+
+/**
+ * Play a run's new row up the loser tree, from its leaf to the root.
+ */
+void SortOperator::replay(uint run) {
+    uint k = (uint) this->runs.size();
+    uint winner = run;
+    for (uint n = (k + run) / 2; n > 0; n /= 2)
+        if (beats(this->tree[n], winner))
+            std::swap(this->tree[n], winner);
+    this->tree[0] = winner;
+}
+
+/**
+ * Let go of all the rows and runs.
+ */
+void SortOperator::clear() {
+    for (auto const &batch: this->batches)
+        delete batch;
+    this->batches.clear();
+    this->entries.clear();
+    for (auto const &run: this->runs) {
+        delete run.batch;
+        delete run.file;
+    }
+    this->runs.clear();
+    this->tree.clear();
+    this->used = 0;
+    this->next_entry = 0;
+    this->produced = 0;
+}
+
+/**
+ * Constructor
+ * @param input   where the rows come from (freed by us)
+ * @param limit   how many rows to produce (at most)
+ * @param offset  how many rows to skip first
+ */
+LimitOperator::LimitOperator(EvalOperator *input, u_long limit, u_long offset)
+        : EvalOperator(), input(input), limit(limit), offset(offset), skipped(0), produced(0) {
+    this->column_names = input->get_column_names();
+}
+
+LimitOperator::~LimitOperator() {
+    close();
+    delete this->input;
+}
+
+void LimitOperator::open() {
+    close();
+    this->skipped = 0;
+    this->produced = 0;
+    if (this->limit > 0)
+        this->input->open();
+}
+
+RowBatch *LimitOperator::next_batch() {
+    while (this->produced < this->limit) {
+        RowBatch *batch = this->input->next_batch();
+        if (batch == nullptr)
+            return nullptr;
+        u_long selected = batch->get_selection().size();
+        u_long skip = std::min(this->offset - this->skipped, selected);
+        u_long take = std::min(this->limit - this->produced, selected - skip);
+        this->skipped += skip;
+        this->produced += take;
+        if (take == 0) {
+            delete batch;
+            continue;
+        }
+        batch->select_range((uint) skip, (uint) take);
+        return batch;
+    }
+    return nullptr;
+}
+
+void LimitOperator::close() {
+    drop_pending();
+    this->input->close();
+}
+
+/**
+ * @class TestRows - made-up rows for testing the operators: row i (counting from 0) is
+ * (prefix + "k": key(i), prefix + "i": i, prefix + "s": "row<i>"), where key(i) = base + i * 7919 % keys
+ * goes through all of 0..keys-1 (shifted by base) before any of them comes around again.
+ */
+class TestRows : public EvalOperator {
+public:
+    TestRows(const Identifier &prefix, uint count, uint keys, int32_t base = 0)
+            : EvalOperator(), count(count), keys(keys), base(base), i(0) {
+        this->column_names.push_back(prefix + "k");
+        this->column_names.push_back(prefix + "i");
+        this->column_names.push_back(prefix + "s");
+    }
+
+    virtual ~TestRows() {}
+
+    int32_t key(uint i) const { return this->base + (int32_t) ((u_long) i * 7919 % this->keys); }
+
+    virtual void open() {
+        drop_pending();
+        this->i = 0;
+    }
+
+    virtual Tuple *next() { return next_from_batch(); }
+
+    virtual RowBatch *next_batch() {
+        if (this->i >= this->count)
+            return nullptr;
+        RowBatch *batch = new RowBatch(3);
+        for (; this->i < this->count && batch->size() < RowBatch::BATCH_SZ; this->i++) {
+            std::string s = "row" + std::to_string(this->i);
+            batch->append_n(0, ColumnAttribute::INT, key(this->i));
+            batch->append_n(1, ColumnAttribute::INT, (int32_t) this->i);
+            batch->append_s(2, s.data(), (uint) s.size());
+            batch->end_row();
+        }
+        return batch;
+    }
+
+    virtual void close() { drop_pending(); }
+
+protected:
+    uint count;
+    uint keys;
+    int32_t base;
+    uint i;
+};
+
+/**
+ * Sort made-up rows on their keys and compare with the (key, i) pairs sorted here.
+ * @param count       number of rows
+ * @param keys        number of different keys (so each one is tied count/keys times)
+ * @param descending  whether to sort from high to low
+ * @param limit       how many rows to ask for
+ * @param memory      the sort's memory budget
+ * @return            true if the rows come out in order, ties in input order, and as many as asked for
+ */
+static bool test_sort(uint count, uint keys, bool descending, u_long limit, size_t memory) {
+    TestRows *rows = new TestRows("", count, keys);
+    std::vector<std::pair<int32_t, int32_t> > expected;
+    for (uint i = 0; i < count; i++)
+        expected.push_back(std::make_pair(descending ? -rows->key(i) : rows->key(i), (int32_t) i));
+    std::sort(expected.begin(), expected.end());
+    if (limit < expected.size())
+        expected.resize(limit);
+
+    ColumnNames sort_columns;
+    sort_columns.push_back("k");
+    std::vector<bool> directions(1, descending);
+    SortOperator sort(rows, &sort_columns, &directions, limit, memory);
+    sort.open();
+    uint n = 0;
+    RowBatch *batch;
+    while ((batch = sort.next_batch()) != nullptr) {
+        for (auto const &r: batch->get_selection()) {
+            int32_t k = batch->get_ns(0)[r];
+            if (n >= expected.size() || (descending ? -k : k) != expected[n].first ||
+                batch->get_ns(1)[r] != expected[n].second) {
+                delete batch;
+                return assertion_failure("sort out of order at row", n);
+            }
+            n++;
+        }
+        delete batch;
+    }
+    sort.close();
+    if (n != expected.size())
+        return assertion_failure("sort produced the wrong number of rows", n, expected.size());
+    return true;
+}
+
+/**
+ * Join two sets of made-up rows on their keys and check the matches against a count done here.
+ * @param left_count   number of left rows
+ * @param left_keys    number of different keys on the left (0..left_keys-1)
+ * @param right_count  number of right rows
+ * @param right_keys   number of different keys on the right (right_base..right_base+right_keys-1)
+ * @param right_base   smallest right key
+ * @param memory       the join's memory budget
+ * @return             true if every row joins equal keys and each matching pair comes out once
+ */
+static bool test_hash_join(uint left_count, uint left_keys, uint right_count, uint right_keys, int32_t right_base,
+                           size_t memory) {
+    TestRows *left = new TestRows("l.", left_count, left_keys);
+    TestRows *right = new TestRows("r.", right_count, right_keys, right_base);
+    std::unordered_map<int32_t, u_long> left_matches;
+    for (uint i = 0; i < left_count; i++)
+        left_matches[left->key(i)]++;
+    u_long expected = 0;
+    for (uint j = 0; j < right_count; j++)
+        if (left_matches.count(right->key(j)) > 0)
+            expected += left_matches[right->key(j)];
+
+    ColumnNames left_join_keys, right_join_keys;
+    left_join_keys.push_back("l.k");
+    right_join_keys.push_back("r.k");
+    HashJoinOperator join(left, right, &left_join_keys, &right_join_keys, memory);
+    if (join.get_column_names().size() != 6 || join.get_column_names()[0] != "l.k" ||
+        join.get_column_names()[3] != "r.k")
+        return assertion_failure("hash join columns");
+    join.open();
+    std::unordered_map<std::string, bool> seen;  // "<l.i> <r.i>" of each match so far
+    RowBatch *batch;
+    while ((batch = join.next_batch()) != nullptr) {
+        for (auto const &r: batch->get_selection()) {
+            if (batch->get_ns(0)[r] != batch->get_ns(3)[r]) {
+                delete batch;
+                return assertion_failure("hash join matched unequal keys", batch->get_ns(0)[r], batch->get_ns(3)[r]);
+            }
+            std::string pair = std::to_string(batch->get_ns(1)[r]) + " " + std::to_string(batch->get_ns(4)[r]);
+            if (seen.count(pair) > 0) {
+                delete batch;
+                return assertion_failure("hash join produced a match twice");
+            }
+            seen[pair] = true;
+        }
+        delete batch;
+    }
+    join.close();
+    if (seen.size() != expected)
+        return assertion_failure("hash join produced the wrong number of matches", seen.size(), expected);
+    return true;
+}
+
+/**
+ * Aggregate made-up rows (COUNT(*), SUM(i), MIN(i), MAX(i)) and compare with the totals worked out here.
+ * @param count    number of rows
+ * @param keys     number of different keys, or 0 for no group columns
+ * @param memory   the aggregation's memory budget
+ * @return         true if each group comes out once with the right aggregates
+ */
+static bool test_hash_aggregate(uint count, uint keys, size_t memory) {
+    TestRows *rows = new TestRows("", count, keys == 0 ? 1 : keys);
+    std::unordered_map<int32_t, std::vector<int64_t> > expected;  // key -> COUNT, SUM, MIN, MAX
+    if (keys == 0)
+        expected[0] = std::vector<int64_t>(4, 0);  // the one group is there even with no rows
+    for (uint i = 0; i < count; i++) {
+        int32_t k = keys == 0 ? 0 : rows->key(i);
+        if (expected.count(k) == 0)
+            expected[k] = std::vector<int64_t>{0, 0, i, i};
+        std::vector<int64_t> &totals = expected[k];
+        totals[0]++;
+        totals[1] += i;
+        totals[2] = std::min(totals[2], (int64_t) i);
+        totals[3] = std::max(totals[3], (int64_t) i);
+    }
+
+    ColumnNames group_by;
+    if (keys > 0)
+        group_by.push_back("k");
+    Aggregations aggregations;
+    aggregations.push_back(Aggregation(Aggregation::COUNT, ""));
+    aggregations.push_back(Aggregation(Aggregation::SUM, "i"));
+    aggregations.push_back(Aggregation(Aggregation::MIN, "i"));
+    aggregations.push_back(Aggregation(Aggregation::MAX, "i"));
+    HashAggregateOperator aggregate(rows, &group_by, &aggregations, memory);
+    uint a = (uint) group_by.size();  // position of the first aggregate
+    aggregate.open();
+    RowBatch *batch;
+    while ((batch = aggregate.next_batch()) != nullptr) {
+        for (auto const &r: batch->get_selection()) {
+            int32_t k = keys == 0 ? 0 : batch->get_ns(0)[r];
+            std::unordered_map<int32_t, std::vector<int64_t> >::iterator totals = expected.find(k);
+            if (totals == expected.end()) {
+                delete batch;
+                return assertion_failure("aggregate produced a group twice (or one that isn't there)", k);
+            }
+            for (uint j = 0; j < 4; j++)
+                if (batch->get_ns(a + j)[r] != totals->second[j]) {
+                    delete batch;
+                    return assertion_failure("wrong " + aggregations[j].get_name() + " for group", k);
+                }
+            expected.erase(totals);
+        }
+        delete batch;
+    }
+    aggregate.close();
+    if (!expected.empty())
+        return assertion_failure("aggregate left out groups", (double) expected.size());
+    return true;
+}
+
+/**
+ * Testing function for the operators that can run out of memory, with budgets small enough to
+ * make them spill.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_eval_operators() {
+    // 5000 rows in 4kB spill five runs; a limit of 10 keeps the best rows in a heap instead
+    for (int descending = 0; descending < 2; descending++) {
+        if (!test_sort(5000, 700, descending, EvalOperator::NO_LIMIT, 4096) ||
+            !test_sort(5000, 700, descending, 100, 4096) ||
+            !test_sort(5000, 700, descending, 10, 4096) ||
+            !test_sort(100, 7, descending, EvalOperator::NO_LIMIT, 4096))
+            return false;
+    }
+    std::cout << "sort ok" << std::endl;
+
+    // both sides go over 8kB before either ends, so they are partitioned into spill files
+    if (!test_hash_join(3000, 1000, 4000, 1500, 500, 8192))
+        return false;
+    // a side that ends within the budget is the build side, whether it is on the left or the right
+    if (!test_hash_join(50, 20, 5000, 1000, -10, 8192) || !test_hash_join(5000, 1000, 50, 20, 990, 8192))
+        return false;
+    // and if nothing on the build side matches, the probe side still comes out empty
+    if (!test_hash_join(5000, 1000, 50, 20, 2000, 8192))
+        return false;
+    std::cout << "hash join ok" << std::endl;
+
+    // 64kB holds enough groups to grow the hash table before spilling the rest once;
+    // in 4kB the spilled partitions have to be spilled again (and rehashed) themselves
+    if (!test_hash_aggregate(12000, 3000, 65536) || !test_hash_aggregate(12000, 3000, 4096))
+        return false;
+    // with no group columns there is one row, even for no rows at all (MIN and MAX of nothing are 0)
+    if (!test_hash_aggregate(12000, 0, 4096) || !test_hash_aggregate(0, 0, 4096))
+        return false;
+    std::cout << "hash aggregate ok" << std::endl;
+    return true;
+}
@@ -0,0 +1,571 @@
+/**
+ * @file EvalOperator.h - Iterator-style (open/next/close) operators that carry out an evaluation plan
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <climits>
+#include <deque>
+#include <unordered_map>
+#include "storage_engine.h"
+
+class SpillFile;
+
+
+/**
+ * @class EvalOperator - abstract base class for a node of an executing plan
+ * Each operator pulls rows from its inputs only as its own caller asks for them, so a row can
+ * make its way all the way up the tree before the next one is read, and nothing gets
+ * materialized along the way. Rows can be pulled one at a time with next() or a batch at a
+ * time with next_batch() (but not both between an open() and close()).
+ * 	open()
+ * 	next()
+ * 	next_batch()
+ * 	close()
+ */
+class EvalOperator {
+public:
+    static const u_long NO_LIMIT = ULONG_MAX;  // for operators that can be told to stop after so many rows
+
+    EvalOperator() : column_names(), pending(nullptr), pending_i(0) {}
+
+    virtual ~EvalOperator() { delete pending; }
+
+    /**
+     * Get ready to produce rows (opening inputs, etc.).
+     */
+    virtual void open() = 0;
+
+    /**
+     * Produce the next row.
+     * @returns  the row, in the order of get_column_names() (freed by caller), or nullptr when exhausted
+     */
+    virtual Tuple *next() = 0;
+
+    /**
+     * Produce the next batch of rows. Operators that don't override this get their next() rows
+     * gathered up into batches.
+     * @returns  batch with columns in the order of get_column_names() and at least one row
+     *           selected (freed by caller), or nullptr when exhausted
+     */
+    virtual RowBatch *next_batch();
+
+    /**
+     * Release whatever open() acquired. The operator can be opened again afterwards.
+     */
+    virtual void close() = 0;
+
+    /**
+     * @returns  names of the columns of the rows we produce
+     */
+    const ColumnNames &get_column_names() const { return column_names; }
+
+protected:
+    ColumnNames column_names;
+    RowBatch *pending;  // for operators that work in batches to hand out rows to next()
+    uint pending_i;
+
+    Tuple *next_from_batch();
+
+    void drop_pending();
+};
+
+
+/**
+ * @class ScanOperator - rows of a relation, optionally restricted by a where clause, with the
+ * given columns projected out (and optionally stopping after so many rows)
+ */
+class ScanOperator : public EvalOperator {
+public:
+    ScanOperator(DbRelation &table, const Predicate *where, const ColumnNames *column_names, u_long limit = NO_LIMIT);
+
+    virtual ~ScanOperator();
+
+    ScanOperator(const ScanOperator &other) = delete;
+
+    ScanOperator(ScanOperator &&temp) = delete;
+
+    ScanOperator &operator=(const ScanOperator &other) = delete;
+
+    ScanOperator &operator=(ScanOperator &&temp) = delete;
+
+    virtual void open();
+
+    virtual Tuple *next();
+
+    virtual RowBatch *next_batch();
+
+    virtual void close();
+
+protected:
+    DbRelation &table;
+    Predicate *where;
+    DbCursor *cursor;
+    u_long limit;
+    u_long produced;
+};
+
+
+/**
+ * @class IndexLookupOperator - rows of a relation found by looking a key up in one of its indices
+ */
+class IndexLookupOperator : public ScanOperator {
+public:
+    IndexLookupOperator(DbIndex &index, const ValueDict *key, const ColumnNames *column_names);
+
+    virtual ~IndexLookupOperator() {}
+
+    virtual void open();
+
+protected:
+    DbIndex &index;
+    ValueDict key;
+};
+
+
+/**
+ * @class IndexRangeOperator - rows of a relation found by scanning a range of keys in one of its indices
+ */
+class IndexRangeOperator : public ScanOperator {
+public:
+    IndexRangeOperator(DbIndex &index, const ValueDict *low_key, const ValueDict *high_key,
+                       const ColumnNames *column_names);
+
+    virtual ~IndexRangeOperator();
+
+    virtual void open();
+
+protected:
+    DbIndex &index;
+    ValueDict *low_key;
+    ValueDict *high_key;
+};
+
+
+/**
+ * @class SelectOperator - rows of the input that satisfy a predicate
+ */
+class SelectOperator : public EvalOperator {
+public:
+    SelectOperator(EvalOperator *input, const Predicate *predicate);
+
+    virtual ~SelectOperator();
+
+    SelectOperator(const SelectOperator &other) = delete;
+
+    SelectOperator(SelectOperator &&temp) = delete;
+
+    SelectOperator &operator=(const SelectOperator &other) = delete;
+
+    SelectOperator &operator=(SelectOperator &&temp) = delete;
+
+    virtual void open() { input->open(); }
+
+    virtual Tuple *next();
+
+    virtual RowBatch *next_batch();
+
+    virtual void close() { input->close(); }
+
+protected:
+    EvalOperator *input;
+    CompiledPredicate predicate;  // against the input's columns
+};
+
+
+/**
+ * @class ProjectOperator - the given columns of each row of the input
+ */
+class ProjectOperator : public EvalOperator {
+public:
+    ProjectOperator(EvalOperator *input, const ColumnNames *column_names);
+
+    virtual ~ProjectOperator();
+
+    ProjectOperator(const ProjectOperator &other) = delete;
+
+    ProjectOperator(ProjectOperator &&temp) = delete;
+
+    ProjectOperator &operator=(const ProjectOperator &other) = delete;
+
+    ProjectOperator &operator=(ProjectOperator &&temp) = delete;
+
+    virtual void open() { input->open(); }
+
+    virtual Tuple *next();
+
+    virtual RowBatch *next_batch();
+
+    virtual void close() { input->close(); }
+
+protected:
+    EvalOperator *input;
+    std::vector<uint> positions;  // input column position for each of our columns
+};
+
+
+/**
+ * @class RenameOperator - the rows of the input with each column name qualified by an alias
+ * (so the columns of the tables in a join can be told apart)
+ */
+class RenameOperator : public EvalOperator {
+public:
+    RenameOperator(EvalOperator *input, const Identifier &alias);
+
+    virtual ~RenameOperator();
+
+    RenameOperator(const RenameOperator &other) = delete;
+
+    RenameOperator(RenameOperator &&temp) = delete;
+
+    RenameOperator &operator=(const RenameOperator &other) = delete;
+
+    RenameOperator &operator=(RenameOperator &&temp) = delete;
+
+    virtual void open() { input->open(); }
+
+    virtual Tuple *next() { return input->next(); }
+
+    virtual RowBatch *next_batch() { return input->next_batch(); }
+
+    virtual void close() { input->close(); }
+
+protected:
+    EvalOperator *input;
+};
+
+
+/**
+ * @class HashJoinOperator - equijoin of two inputs: each row of the left input together with each
+ * row of the right input whose key columns are equal to its own
+ *
+ * Rows come out as the left input's columns followed by the right input's. On open(), both inputs
+ * are read a batch at a time, alternately, until one of them runs out. That one is the smaller, so
+ * it becomes the build side: its rows go into a hash table on their encoded key values. The other
+ * input is then streamed through as the probe side, starting with the batches already read.
+ * If both inputs grow past the memory budget first, each is partitioned on a hash of its keys into
+ * temporary SpillFiles. The partitions are then joined one pair at a time, building on the smaller
+ * of each pair.
+ */
+class HashJoinOperator : public EvalOperator {
+public:
+    static const size_t MEMORY_SZ = 64 * 1024 * 1024;  // default memory budget for holding the build side
+    static const uint PARTITIONS = 32;  // number of partitions to spill into
+
+    HashJoinOperator(EvalOperator *left, EvalOperator *right, const ColumnNames *left_keys,
+                     const ColumnNames *right_keys, size_t memory = MEMORY_SZ);
+
+    virtual ~HashJoinOperator();
+
+    HashJoinOperator(const HashJoinOperator &other) = delete;
+
+    HashJoinOperator(HashJoinOperator &&temp) = delete;
+
+    HashJoinOperator &operator=(const HashJoinOperator &other) = delete;
+
+    HashJoinOperator &operator=(HashJoinOperator &&temp) = delete;
+
+    virtual void open();
+
+    virtual Tuple *next() { return next_from_batch(); }
+
+    virtual RowBatch *next_batch();
+
+    virtual void close();
+
+protected:
+    // encoded key -> (build batch, row within batch) of each build row with that key
+    typedef std::unordered_map<std::string, std::vector<std::pair<uint, uint> > > HashTable;
+
+    EvalOperator *inputs[2];  // left and right
+    std::vector<uint> keys[2];  // positions of the key columns in each input
+    size_t memory;
+    uint build;  // which of the inputs is being held in the hash table
+    std::vector<RowBatch *> build_batches;
+    HashTable table;
+    std::deque<RowBatch *> read_ahead;  // probe side batches read while picking the build side
+    bool probe_done;  // probe input exhausted
+    SpillFile *probe_file;  // probe side of the current partition, if we spilled
+    RowBatch *probe;
+    uint k;  // position in probe's selection
+    std::vector<SpillFile *> partitions[2];
+    uint partition;  // next partition to join
+    std::string key;
+
+    void load(std::vector<RowBatch *> &batches);
+
+    void spill(std::vector<RowBatch *> *ahead);
+
+    bool next_partition();
+
+    RowBatch *next_probe();
+
+    void reset();
+};
+
+
+/**
+ * @class IndexJoinOperator - equijoin that looks up each outer row's key in an index on the inner table
+ *
+ * Rows come out as the outer input's columns followed by the inner table's (qualified by its alias).
+ * The outer rows are taken a batch at a time and their keys sorted into index order, so that probes
+ * for neighboring keys follow the same path down the index while its blocks are still cached, and a
+ * key repeated in the batch is only looked up once.
+ */
+class IndexJoinOperator : public EvalOperator {
+public:
+    IndexJoinOperator(EvalOperator *outer, DbIndex &index, const Identifier &alias, const ColumnNames *outer_keys,
+                      const ColumnNames *inner_keys, const ColumnNames *inner_columns, const Predicate *filter);
+
+    virtual ~IndexJoinOperator();
+
+    IndexJoinOperator(const IndexJoinOperator &other) = delete;
+
+    IndexJoinOperator(IndexJoinOperator &&temp) = delete;
+
+    IndexJoinOperator &operator=(const IndexJoinOperator &other) = delete;
+
+    IndexJoinOperator &operator=(IndexJoinOperator &&temp) = delete;
+
+    virtual void open();
+
+    virtual Tuple *next() { return next_from_batch(); }
+
+    virtual RowBatch *next_batch();
+
+    virtual void close();
+
+protected:
+    EvalOperator *outer;
+    DbIndex &index;
+    DbRelation &table;
+    ColumnNames fetched;  // inner table columns we project for each match
+    std::vector<uint> probe;  // outer column position for each of the index's key columns
+    std::vector<std::pair<uint, uint> > keys;  // (outer position, fetched position) pairs that must be equal
+    CompiledPredicate filter;  // against the fetched columns
+};
+
+
+/**
+ * @class Aggregation - an aggregate function over a column, like SUM(x), or COUNT(*)
+ */
+class Aggregation {
+public:
+    enum Function {
+        COUNT, SUM, MIN, MAX
+    };
+
+    Aggregation(Function function, const Identifier &column_name) : function(function), column_name(column_name) {}
+
+    Function function;
+    Identifier column_name;  // empty for COUNT(*)
+
+    /**
+     * @returns  name of the column holding the aggregate, e.g., "SUM(x)"
+     */
+    Identifier get_name() const;
+};
+
+typedef std::vector<Aggregation> Aggregations;
+
+
+/**
+ * @class HashAggregateOperator - one row for each group of input rows with equal values in the group
+ * columns, holding those values and the aggregates over the group
+ *
+ * Rows come out as the group columns followed by the aggregates (all INT). The groups are found with
+ * an open-addressing hash table on their encoded key values, and each group gets a fixed-size slot
+ * in a flat array of accumulators. Once the groups take up the memory budget, rows of groups not
+ * already in the table are partitioned into temporary SpillFiles, and each of those is aggregated
+ * the same way after the groups in memory have been produced. With no group columns, there is
+ * just the one group: it is accumulated a column at a time straight from the input batches and
+ * comes out even if there were no rows (with 0 for MIN and MAX, since there are no NULLs).
+ */
+class HashAggregateOperator : public EvalOperator {
+public:
+    static const size_t MEMORY_SZ = 64 * 1024 * 1024;  // default memory budget for holding the groups
+    static const uint PARTITIONS = 32;  // number of partitions to spill into
+
+    HashAggregateOperator(EvalOperator *input, const ColumnNames *group_by, const Aggregations *aggregations,
+                          size_t memory = MEMORY_SZ);
+
+    virtual ~HashAggregateOperator();
+
+    HashAggregateOperator(const HashAggregateOperator &other) = delete;
+
+    HashAggregateOperator(HashAggregateOperator &&temp) = delete;
+
+    HashAggregateOperator &operator=(const HashAggregateOperator &other) = delete;
+
+    HashAggregateOperator &operator=(HashAggregateOperator &&temp) = delete;
+
+    virtual void open();
+
+    virtual Tuple *next() { return next_from_batch(); }
+
+    virtual RowBatch *next_batch();
+
+    virtual void close();
+
+protected:
+    EvalOperator *input;
+    std::vector<uint> group_columns;  // positions of the group columns in the input
+    Aggregations aggregations;
+    std::vector<uint> arguments;  // position in the input of each aggregation's column (unused for COUNT)
+    size_t memory;
+    std::vector<uint32_t> slots;  // hash table: group number + 1, or 0 if empty
+    std::vector<size_t> hashes;  // hash of each group's key
+    std::vector<std::string> keys;  // encoded key of each group
+    std::vector<RowBatch *> groups;  // group column values, BATCH_SZ groups to a batch
+    std::vector<int64_t> accumulators;  // aggregations.size() of them for each group
+    size_t used;  // rough number of bytes taken by the groups
+    std::deque<std::pair<SpillFile *, uint> > spilled;  // partitions still to aggregate, with their level
+    std::vector<SpillFile *> partitions;  // where rows of the current pass go when the table is full
+    uint level;  // how many times the rows of the current pass have been spilled (for rehashing)
+    uint emitted;  // groups of the current pass produced so far
+    std::string key;
+
+    void consume(RowBatch *batch);
+
+    void consume_all(const RowBatch &batch, const std::vector<const int32_t *> &ns);
+
+    size_t hash(const std::string &key) const;
+
+    uint find_group(const RowBatch &batch, uint r, size_t hash);
+
+    void grow();
+
+    void start_pass(uint level);
+
+    void finish_pass();
+
+    void reset();
+};
+
+
+/**
+ * @class SortOperator - the rows of the input in order by some of its columns (ties keep their input order)
+ *
+ * Each row gets a normalized key (see RowBatch::get_sort_key), so rows are compared by a single
+ * bytewise comparison whatever the column types. Rows are sorted in memory, by their keys, while
+ * they fit in the memory budget; past that, each memory load is sorted and written out as a run in
+ * a temporary SpillFile, and the runs are merged with a loser tree (so each row output costs about
+ * log2(runs) key comparisons). Given a limit, only that many rows come out, and if the limit is
+ * small enough the best of them are kept in a bounded heap as the input goes by instead.
+ */
+class SortOperator : public EvalOperator {
+public:
+    static const size_t MEMORY_SZ = 64 * 1024 * 1024;  // default memory budget for holding rows being sorted
+
+    SortOperator(EvalOperator *input, const ColumnNames *sort_columns, const std::vector<bool> *descending,
+                 u_long limit = NO_LIMIT, size_t memory = MEMORY_SZ);
+
+    virtual ~SortOperator();
+
+    SortOperator(const SortOperator &other) = delete;
+
+    SortOperator(SortOperator &&temp) = delete;
+
+    SortOperator &operator=(const SortOperator &other) = delete;
+
+    SortOperator &operator=(SortOperator &&temp) = delete;
+
+    virtual void open();
+
+    virtual Tuple *next() { return next_from_batch(); }
+
+    virtual RowBatch *next_batch();
+
+    virtual void close();
+
+protected:
+    // a row being sorted in memory: its key, and where it is (batch and row number)
+    struct Entry {
+        std::string key;
+        uint batch;
+        uint row;
+
+        bool operator<(const Entry &other) const {
+            int c = key.compare(other.key);
+            return c < 0 || (c == 0 && (batch < other.batch || (batch == other.batch && row < other.row)));
+        }
+    };
+
+    // where a run being merged is at
+    struct Run {
+        SpillFile *file;
+        RowBatch *batch;
+        uint i;  // position in batch's selection
+        std::string key;  // of the row at i
+    };
+
+    EvalOperator *input;
+    std::vector<uint> columns;  // positions of the sort columns in the input
+    std::vector<bool> descending;
+    u_long limit;
+    size_t memory;
+    bool top_n;  // keeping just the best limit rows in a heap
+    std::vector<RowBatch *> batches;
+    std::vector<Entry> entries;  // in sorted order once open() is done (a max-heap while top_n is filling)
+    size_t used;  // rough number of bytes taken by batches and entries
+    std::vector<Run> runs;
+    std::vector<uint> tree;  // loser tree over runs: tree[0] is the winner, tree[1..] the losers at each node
+    uint next_entry;  // next of the entries to produce
+    u_long produced;
+    std::string key;
+
+    void add(RowBatch *batch);
+
+    void keep_best(RowBatch *batch);
+
+    void spill_run();
+
+    bool beats(uint a, uint b) const;
+
+    void advance(uint run);
+
+    void replay(uint run);
+
+    void clear();
+};
+
+
+/**
+ * @class LimitOperator - the rows of the input after skipping the first offset of them, up to limit rows
+ *
+ * Once it has its rows, it stops pulling from the input, so nothing under it (scans, projections,
+ * etc.) does any more work than it has already. With a limit of 0, the input isn't even opened.
+ */
+class LimitOperator : public EvalOperator {
+public:
+    LimitOperator(EvalOperator *input, u_long limit, u_long offset);
+
+    virtual ~LimitOperator();
+
+    LimitOperator(const LimitOperator &other) = delete;
+
+    LimitOperator(LimitOperator &&temp) = delete;
+
+    LimitOperator &operator=(const LimitOperator &other) = delete;
+
+    LimitOperator &operator=(LimitOperator &&temp) = delete;
+
+    virtual void open();
+
+    virtual Tuple *next() { return next_from_batch(); }
+
+    virtual RowBatch *next_batch();
+
+    virtual void close();
+
+protected:
+    EvalOperator *input;
+    u_long limit;
+    u_long offset;
+    u_long skipped;
+    u_long produced;
+};
+
+bool test_eval_operators();
@@ -4,7 +4,12 @@
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
 #include "EvalPlan.h"
+#include "schema_tables.h"
+#include "btree.h"
 
 
 class Dummy : public DbRelation {
@@ -43,28 +48,94 @@ public:
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) { return nullptr; }
 };
 
-EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+EvalPlan::EvalPlan(PlanType type, EvalPlan *relation)
+        : type(type), relation(relation), right(nullptr), projection(nullptr), select_conjunction(nullptr),
+          predicate(nullptr), high_key(nullptr), table(Dummy::one()), index(nullptr), alias(), left_keys(nullptr),
+          right_keys(nullptr), aggregations(nullptr), descending(nullptr), limit(EvalOperator::NO_LIMIT), offset(0) {
 }
 
-EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
-                                                                  projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation)
+        : type(Project), relation(relation), right(nullptr), projection(projection), select_conjunction(nullptr),
+          predicate(nullptr), high_key(nullptr), table(Dummy::one()), index(nullptr), alias(), left_keys(nullptr),
+          right_keys(nullptr), aggregations(nullptr), descending(nullptr), limit(EvalOperator::NO_LIMIT), offset(0) {
 }
 
-EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+EvalPlan::EvalPlan(Predicate *predicate, EvalPlan *relation)
+        : type(Select), relation(relation), right(nullptr), projection(nullptr), select_conjunction(nullptr),
+          predicate(predicate), high_key(nullptr), table(Dummy::one()), index(nullptr), alias(), left_keys(nullptr),
+          right_keys(nullptr), aggregations(nullptr), descending(nullptr), limit(EvalOperator::NO_LIMIT), offset(0) {
 }
 
-EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+EvalPlan::EvalPlan(DbRelation &table)
+        : type(TableScan), relation(nullptr), right(nullptr), projection(nullptr), select_conjunction(nullptr),
+          predicate(nullptr), high_key(nullptr), table(table), index(nullptr), alias(), left_keys(nullptr),
+          right_keys(nullptr), aggregations(nullptr), descending(nullptr), limit(EvalOperator::NO_LIMIT), offset(0) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *key)
+        : type(IndexLookup), relation(nullptr), right(nullptr), projection(nullptr), select_conjunction(key),
+          predicate(nullptr), high_key(nullptr), table(index.get_relation()), index(&index), alias(),
+          left_keys(nullptr), right_keys(nullptr), aggregations(nullptr), descending(nullptr),
+          limit(EvalOperator::NO_LIMIT), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *low_key, ValueDict *high_key)
+        : type(IndexRange), relation(nullptr), right(nullptr), projection(nullptr), select_conjunction(low_key),
+          predicate(nullptr), high_key(high_key), table(index.get_relation()), index(&index), alias(),
+          left_keys(nullptr), right_keys(nullptr), aggregations(nullptr), descending(nullptr),
+          limit(EvalOperator::NO_LIMIT), offset(0) {
+}
+
+EvalPlan::EvalPlan(const Identifier &alias, EvalPlan *relation)
+        : type(Rename), relation(relation), right(nullptr), projection(nullptr), select_conjunction(nullptr),
+          predicate(nullptr), high_key(nullptr), table(Dummy::one()), index(nullptr), alias(alias), left_keys(nullptr),
+          right_keys(nullptr), aggregations(nullptr), descending(nullptr), limit(EvalOperator::NO_LIMIT), offset(0) {
+}
+
+EvalPlan::EvalPlan(EvalPlan *left, EvalPlan *right, ColumnNames *left_keys, ColumnNames *right_keys)
+        : type(HashJoin), relation(left), right(right), projection(nullptr), select_conjunction(nullptr),
+          predicate(nullptr), high_key(nullptr), table(Dummy::one()), index(nullptr), alias(), left_keys(left_keys),
+          right_keys(right_keys), aggregations(nullptr), descending(nullptr), limit(EvalOperator::NO_LIMIT),
+          offset(0) {
+}
+
+EvalPlan::EvalPlan(EvalPlan *outer, DbIndex &index, const Identifier &alias, ColumnNames *outer_keys,
+                   ColumnNames *inner_keys, Predicate *filter)
+        : type(IndexJoin), relation(outer), right(nullptr), projection(nullptr), select_conjunction(nullptr),
+          predicate(filter), high_key(nullptr), table(index.get_relation()), index(&index), alias(alias),
+          left_keys(outer_keys), right_keys(inner_keys), aggregations(nullptr), descending(nullptr),
+          limit(EvalOperator::NO_LIMIT), offset(0) {
+}
+
+EvalPlan::EvalPlan(ColumnNames *group_by, Aggregations *aggregations, EvalPlan *relation)
+        : type(Aggregate), relation(relation), right(nullptr), projection(group_by), select_conjunction(nullptr),
+          predicate(nullptr), high_key(nullptr), table(Dummy::one()), index(nullptr), alias(), left_keys(nullptr),
+          right_keys(nullptr), aggregations(aggregations), descending(nullptr), limit(EvalOperator::NO_LIMIT),
+          offset(0) {
+}
+
+EvalPlan::EvalPlan(ColumnNames *sort_columns, std::vector<bool> *descending, u_long limit, EvalPlan *relation)
+        : type(Sort), relation(relation), right(nullptr), projection(sort_columns), select_conjunction(nullptr),
+          predicate(nullptr), high_key(nullptr), table(Dummy::one()), index(nullptr), alias(), left_keys(nullptr),
+          right_keys(nullptr), aggregations(nullptr), descending(descending), limit(limit), offset(0) {
+}
+
+EvalPlan::EvalPlan(u_long limit, u_long offset, EvalPlan *relation)
+        : type(Limit), relation(relation), right(nullptr), projection(nullptr), select_conjunction(nullptr),
+          predicate(nullptr), high_key(nullptr), table(Dummy::one()), index(nullptr), alias(), left_keys(nullptr),
+          right_keys(nullptr), aggregations(nullptr), descending(nullptr), limit(limit), offset(offset) {
+}
+
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table), index(other->index),
+                                            alias(other->alias), limit(other->limit), offset(other->offset) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
         relation = nullptr;
+    if (other->right != nullptr)
+        right = new EvalPlan(other->right);
+    else
+        right = nullptr;
     if (other->projection != nullptr)
         projection = new ColumnNames(*other->projection);
     else
@@ -73,53 +144,734 @@ EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->tabl
         select_conjunction = new ValueDict(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    if (other->predicate != nullptr)
+        predicate = new Predicate(*other->predicate);
+    else
+        predicate = nullptr;
+    if (other->high_key != nullptr)
+        high_key = new ValueDict(*other->high_key);
+    else
+        high_key = nullptr;
+    if (other->left_keys != nullptr)
+        left_keys = new ColumnNames(*other->left_keys);
+    else
+        left_keys = nullptr;
+    if (other->right_keys != nullptr)
+        right_keys = new ColumnNames(*other->right_keys);
+    else
+        right_keys = nullptr;
+    if (other->aggregations != nullptr)
+        aggregations = new Aggregations(*other->aggregations);
+    else
+        aggregations = nullptr;
+    if (other->descending != nullptr)
+        descending = new std::vector<bool>(*other->descending);
+    else
+        descending = nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
+    delete right;
     delete projection;
     delete select_conjunction;
+    delete predicate;
+    delete high_key;
+    delete left_keys;
+    delete right_keys;
+    delete aggregations;
+    delete descending;
 }
 
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+EvalPlan *EvalPlan::optimize(Indices *indices) {
+    if (indices != nullptr && this->type == Select && this->relation->type == TableScan) {
+        EvalPlan *plan = use_index(indices);
+        if (plan != nullptr)
+            return plan;
+    }
+    if (indices != nullptr && this->type == HashJoin) {
+        EvalPlan *plan = use_index_join(indices);
+        if (plan != nullptr)
+            return plan;
+    }
+    EvalPlan *ret = new EvalPlan(this);
+    if (indices != nullptr && this->relation != nullptr) {
+        delete ret->relation;
+        ret->relation = this->relation->optimize(indices);
+    }
+    if (indices != nullptr && this->right != nullptr) {
+        delete ret->right;
+        ret->right = this->right->optimize(indices);
+    }
+    if (ret->type == Limit && ret->relation->type == Sort && ret->limit != EvalOperator::NO_LIMIT)
+        ret->relation->limit = std::min(ret->relation->limit, ret->limit + ret->offset);  // only sort out what's needed
+    return ret;
 }
 
-ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
+/**
+ * Try to turn this Select over a TableScan into an index scan. An IndexLookup works when the
+ * predicate has an equality condition on every key column of one of the table's indices (if
+ * there's more than one, we take the one with the longest key). Failing that, we look for an
+ * IndexRange. Any conditions the index doesn't take care of go into a Select on top.
+ * @param indices  the indices of the database
+ * @return         the rewritten plan (freed by caller), or nullptr if no index helps
+ */
+EvalPlan *EvalPlan::use_index(Indices *indices) const {
+    DbRelation &table = this->relation->table;
+    Identifier table_name = table.get_table_name();
+    std::vector<const Predicate *> conjuncts;
+    this->predicate->get_conjuncts(conjuncts);
+    std::map<Identifier, const Predicate *> equalities;
+    for (auto const &conjunct: conjuncts)
+        if (conjunct->get_type() == Predicate::EQ && equalities.find(conjunct->get_column_name()) == equalities.end())
+            equalities[conjunct->get_column_name()] = conjunct;
+    DbIndex *best = nullptr;
+    for (auto const &index_name: indices->get_index_names(table_name)) {
+        DbIndex &candidate = indices->get_index(table_name, index_name);
+        bool covered = true;
+        for (auto const &column_name: candidate.get_key_columns())
+            if (equalities.find(column_name) == equalities.end()) {
+                covered = false;
+                break;
+            }
+        if (covered && (best == nullptr || candidate.get_key_columns().size() > best->get_key_columns().size()))
+            best = &candidate;
+    }
+
+    std::vector<const Predicate *> used;
+    EvalPlan *plan;
+    if (best != nullptr) {
+        ValueDict *key = new ValueDict();
+        for (auto const &column_name: best->get_key_columns()) {
+            (*key)[column_name] = equalities[column_name]->get_values()[0];
+            used.push_back(equalities[column_name]);
+        }
+        plan = new EvalPlan(*best, key);
+    } else {
+        plan = use_index_range(indices, conjuncts, used);
+        if (plan == nullptr)
+            return nullptr;
+    }
+    std::vector<Predicate *> residual;
+    for (auto const &conjunct: conjuncts)
+        if (std::find(used.begin(), used.end(), conjunct) == used.end())
+            residual.push_back(new Predicate(*conjunct));
+    if (!residual.empty())
+        plan = new EvalPlan(new Predicate(Predicate::AND, residual), plan);
+    return plan;
+}
+
+/**
+ * Try to scan a range of a single-column index for the range conditions (<, <=, >, >=, and
+ * BETWEEN) on its column. Each row the range finds costs a block read, so it only pays off when
+ * it finds fewer rows than the table has blocks. To see, we count the index entries in the range,
+ * giving up once there are that many or RANGE_PROBE_SZ, whichever is fewer, so planning never reads
+ * more than a few leaves; a range bigger than that is left to a table scan. If more than one index
+ * qualifies, we take the one with the fewest rows. Strict inequalities still have to be checked on
+ * top, since the range includes its ends.
+ * @param indices    the indices of the database
+ * @param conjuncts  the conditions of this Select
+ * @param used       returned by reference: the conditions the range takes care of
+ * @return           the IndexRange plan (freed by caller), or nullptr if no index helps
+ */
+EvalPlan *EvalPlan::use_index_range(Indices *indices, const std::vector<const Predicate *> &conjuncts,
+                                    std::vector<const Predicate *> &used) const {
+    DbRelation &table = this->relation->table;
+    Identifier table_name = table.get_table_name();
+    u_long best_rows = std::min((u_long) table.get_block_count(), (u_long) RANGE_PROBE_SZ);
+    EvalPlan *best = nullptr;
+    for (auto const &index_name: indices->get_index_names(table_name)) {
+        DbIndex &index = indices->get_index(table_name, index_name);
+        if (index.get_key_columns().size() != 1)
+            continue;
+        Identifier column_name = index.get_key_columns()[0];
+        ColumnAttributes *column_attributes = table.get_column_attributes(ColumnNames(1, column_name));
+        ColumnAttribute::DataType data_type = (*column_attributes)[0].get_data_type();
+        delete column_attributes;
+
+        const Value *low = nullptr;
+        const Value *high = nullptr;
+        std::vector<const Predicate *> covered;
+        for (auto const &conjunct: conjuncts) {
+            Predicate::Type type = conjunct->get_type();
+            if (type < Predicate::LT || type > Predicate::BETWEEN || conjunct->get_column_name() != column_name)
+                continue;
+            const std::vector<Value> &values = conjunct->get_values();
+            bool same_type = true;
+            for (auto const &value: values)
+                same_type = same_type && value.data_type == data_type;
+            if (!same_type)
+                continue;
+            if ((type == Predicate::GT || type == Predicate::GE || type == Predicate::BETWEEN) &&
+                (low == nullptr || *low < values[0]))
+                low = &values[0];
+            if ((type == Predicate::LT || type == Predicate::LE) && (high == nullptr || values[0] < *high))
+                high = &values[0];
+            if (type == Predicate::BETWEEN && (high == nullptr || values[1] < *high))
+                high = &values[1];
+            if (type == Predicate::GE || type == Predicate::LE || type == Predicate::BETWEEN)
+                covered.push_back(conjunct);
+        }
+        if (low == nullptr && high == nullptr)
+            continue;
+
+        ValueDict *low_key = low == nullptr ? nullptr : new ValueDict({{column_name, *low}});
+        ValueDict *high_key = high == nullptr ? nullptr : new ValueDict({{column_name, *high}});
+        u_long rows = 0;
+        try {
+            index.open();
+            DbCursor *cursor = index.range_cursor(low_key, high_key);
+            Handle handle;
+            while (rows < best_rows && cursor->next(handle))
+                rows++;
+            delete cursor;
+        } catch (DbRelationError &e) {
+            rows = best_rows;  // this kind of index can't do ranges
+        }
+        if (rows < best_rows) {
+            delete best;
+            best = new EvalPlan(index, low_key, high_key);
+            best_rows = rows;
+            used = covered;
+        } else {
+            delete low_key;
+            delete high_key;
+        }
+    }
+    return best;
+}
+
+/**
+ * Try to turn this HashJoin into an IndexJoin. That works when one side is a (possibly filtered)
+ * scan of a table with an index whose key columns are all among that side's join keys. It pays off
+ * when the other side is expected to be small enough that probing the index for each of its rows
+ * reads fewer blocks than scanning the whole table would. If both sides qualify, the one with the
+ * smaller other side is probed.
+ * @param indices  the indices of the database
+ * @return         the rewritten plan (freed by caller), or nullptr if no index helps
+ */
+EvalPlan *EvalPlan::use_index_join(Indices *indices) {
+    EvalPlan *sides[2] = {this->relation, this->right};
+    ColumnNames *keys[2] = {this->left_keys, this->right_keys};
+    DbIndex *best = nullptr;
+    uint inner_side = 0;
+    double best_rows = 0.0;
+    for (uint side = 0; side < 2; side++) {
+        EvalPlan *inner = sides[side];
+        if (inner->type != Rename)
+            continue;
+        EvalPlan *base = inner->relation;
+        if (base->type == Select)
+            base = base->relation;
+        if (base->type != TableScan)
+            continue;
+        double outer_rows = sides[1 - side]->estimate();
+        if (outer_rows * PROBE_COST >= base->table.get_block_count() || (best != nullptr && outer_rows >= best_rows))
+            continue;
+
+        Identifier table_name = base->table.get_table_name();
+        Identifier prefix = inner->alias + ".";
+        DbIndex *found = nullptr;
+        for (auto const &index_name: indices->get_index_names(table_name)) {
+            DbIndex &candidate = indices->get_index(table_name, index_name);
+            bool covered = true;
+            for (auto const &column_name: candidate.get_key_columns())
+                if (std::find(keys[side]->begin(), keys[side]->end(), prefix + column_name) == keys[side]->end()) {
+                    covered = false;
+                    break;
+                }
+            if (covered && (found == nullptr || candidate.get_key_columns().size() > found->get_key_columns().size()))
+                found = &candidate;
+        }
+        if (found != nullptr) {
+            best = found;
+            inner_side = side;
+            best_rows = outer_rows;
+        }
+    }
+    if (best == nullptr)
+        return nullptr;
+
+    EvalPlan *inner = sides[inner_side];
+    Identifier prefix = inner->alias + ".";
+    ColumnNames *inner_keys = new ColumnNames();
+    for (auto const &column_name: *keys[inner_side])
+        inner_keys->push_back(column_name.substr(prefix.size()));
+    Predicate *filter = nullptr;
+    if (inner->relation->type == Select)
+        filter = new Predicate(*inner->relation->predicate);
+    EvalPlan *plan = new EvalPlan(sides[1 - inner_side]->optimize(indices), *best, inner->alias,
+                                  new ColumnNames(*keys[1 - inner_side]), inner_keys, filter);
+    if (inner_side == 0)  // put the columns back in left-then-right order
+        plan = new EvalPlan(new ColumnNames(get_column_names()), plan);
+    return plan;
+}
+
+Tuples *EvalPlan::evaluate() {
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
+    Tuples *ret = new Tuples();
+    EvalOperator *root = operate();
+    try {
+        root->open();
+        RowBatch *batch;
+        while ((batch = root->next_batch()) != nullptr) {
+            for (auto const &r: batch->get_selection())
+                ret->push_back(batch->get_row(r));
+            delete batch;
+        }
+        root->close();
+    } catch (...) {
+        delete root;
+        for (auto const &row: *ret)
+            delete row;
+        delete ret;
+        throw;
+    }
+    delete root;
+    return ret;
+}
+
+/**
+ * Build the tree of operators for this plan. Where a scan or index lookup feeds straight into a
+ * projection, it only fetches the projected columns in the first place. A selection on a table
+ * scan is handed to the scan, which checks it on the raw records and only decodes the ones that pass.
+ * @param column_names  columns wanted from this node, or nullptr for all that it has
+ * @return              the root operator (freed by caller)
+ */
+EvalOperator *EvalPlan::operate(const ColumnNames *column_names) {
+    // base cases
+    if (this->type == TableScan)
+        return new ScanOperator(this->table, nullptr, column_names);
+    if (this->type == IndexLookup)
+        return new IndexLookupOperator(*this->index, this->select_conjunction, column_names);
+    if (this->type == IndexRange)
+        return new IndexRangeOperator(*this->index, this->select_conjunction, this->high_key, column_names);
+    if (this->type == Select && this->relation->type == TableScan)
+        return new ScanOperator(this->relation->table, this->predicate, column_names);
+
+    // recursive cases
+    if (this->type == Limit)
+        return limit_rows(column_names);
+    if (this->type == Rename) {
+        if (column_names == nullptr)
+            return new RenameOperator(this->relation->operate(nullptr), this->alias);
+        ColumnNames unqualified;
+        Identifier prefix = this->alias + ".";
+        for (auto const &column_name: *column_names) {
+            if (column_name.compare(0, prefix.size(), prefix) != 0)
+                throw DbRelationError("unknown column " + column_name);
+            unqualified.push_back(column_name.substr(prefix.size()));
+        }
+        return new RenameOperator(this->relation->operate(&unqualified), this->alias);
+    }
+    EvalOperator *op;
     if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
+        op = this->relation->operate(nullptr);
     else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
+        op = this->relation->operate(this->projection);
+    else if (this->type == Select)
+        op = new SelectOperator(this->relation->operate(nullptr), this->predicate);
+    else if (this->type == HashJoin)
+        op = join(column_names);
+    else if (this->type == IndexJoin)
+        op = index_join(column_names);
+    else if (this->type == Aggregate)
+        op = aggregate();
+    else if (this->type == Sort)
+        op = sort(column_names);
+    else
+        throw DbRelationError("Not implemented: operator for this plan");
+    if (column_names != nullptr)
+        op = new ProjectOperator(op, column_names);
+    return op;
+}
+
+/**
+ * Build a hash join, having each side produce only the columns that are wanted from it
+ * (plus its join keys).
+ * @param column_names  columns wanted from the join, or nullptr for all of them
+ * @return              the join operator (freed by caller)
+ */
+EvalOperator *EvalPlan::join(const ColumnNames *column_names) {
+    if (column_names == nullptr)
+        return new HashJoinOperator(this->relation->operate(nullptr), this->right->operate(nullptr),
+                                    this->left_keys, this->right_keys);
+    ColumnNames available[2] = {this->relation->get_column_names(), this->right->get_column_names()};
+    ColumnNames wanted[2] = {*this->left_keys, *this->right_keys};
+    for (auto const &column_name: *column_names)
+        for (uint side = 0; side < 2; side++)
+            if (std::find(available[side].begin(), available[side].end(), column_name) != available[side].end() &&
+                std::find(wanted[side].begin(), wanted[side].end(), column_name) == wanted[side].end())
+                wanted[side].push_back(column_name);
+    EvalOperator *left = this->relation->operate(wanted[0].empty() ? nullptr : &wanted[0]);
+    EvalOperator *right;
+    try {
+        right = this->right->operate(wanted[1].empty() ? nullptr : &wanted[1]);
+    } catch (...) {
+        delete left;
+        throw;
+    }
+    return new HashJoinOperator(left, right, this->left_keys, this->right_keys);
+}
+
+/**
+ * Build an index join, having the outer side produce only the columns that are wanted from it
+ * (plus its join keys), and fetching only the wanted inner columns.
+ * @param column_names  columns wanted from the join, or nullptr for all of them
+ * @return              the join operator (freed by caller)
+ */
+EvalOperator *EvalPlan::index_join(const ColumnNames *column_names) {
+    if (column_names == nullptr)
+        return new IndexJoinOperator(this->relation->operate(nullptr), *this->index, this->alias, this->left_keys,
+                                     this->right_keys, nullptr, this->predicate);
+    ColumnNames available = this->relation->get_column_names();
+    ColumnNames outer_wanted = *this->left_keys;
+    ColumnNames inner_wanted;
+    Identifier prefix = this->alias + ".";
+    for (auto const &column_name: *column_names)
+        if (std::find(available.begin(), available.end(), column_name) != available.end()) {
+            if (std::find(outer_wanted.begin(), outer_wanted.end(), column_name) == outer_wanted.end())
+                outer_wanted.push_back(column_name);
+        } else if (column_name.compare(0, prefix.size(), prefix) == 0) {
+            Identifier unqualified = column_name.substr(prefix.size());
+            if (std::find(inner_wanted.begin(), inner_wanted.end(), unqualified) == inner_wanted.end())
+                inner_wanted.push_back(unqualified);
+        } else {
+            throw DbRelationError("unknown column " + column_name);
+        }
+    EvalOperator *outer = this->relation->operate(&outer_wanted);
+    return new IndexJoinOperator(outer, *this->index, this->alias, this->left_keys, this->right_keys,
+                                 inner_wanted.empty() ? this->right_keys : &inner_wanted, this->predicate);
+}
+
+/**
+ * Build a hash aggregation, having the input produce just the group columns and the columns
+ * being aggregated.
+ * @return  the aggregation operator (freed by caller)
+ */
+EvalOperator *EvalPlan::aggregate() {
+    ColumnNames wanted = *this->projection;
+    for (auto const &aggregation: *this->aggregations)
+        if (!aggregation.column_name.empty() &&
+            std::find(wanted.begin(), wanted.end(), aggregation.column_name) == wanted.end())
+            wanted.push_back(aggregation.column_name);
+    EvalOperator *input = this->relation->operate(wanted.empty() ? nullptr : &wanted);
+    return new HashAggregateOperator(input, this->projection, this->aggregations);
+}
+
+/**
+ * Build a limit. When it's right over a table scan, the scan is told to stop as soon as it has
+ * produced enough rows, too.
+ * @param column_names  columns wanted, or nullptr for all of them
+ * @return              the limit operator (freed by caller)
+ */
+EvalOperator *EvalPlan::limit_rows(const ColumnNames *column_names) {
+    u_long rows = this->limit == EvalOperator::NO_LIMIT ? EvalOperator::NO_LIMIT : this->limit + this->offset;
+    EvalOperator *input;
+    if (this->relation->type == TableScan)
+        input = new ScanOperator(this->relation->table, nullptr, column_names, rows);
+    else if (this->relation->type == Select && this->relation->relation->type == TableScan)
+        input = new ScanOperator(this->relation->relation->table, this->relation->predicate, column_names, rows);
+    else
+        input = this->relation->operate(column_names);
+    return new LimitOperator(input, this->limit, this->offset);
+}
+
+/**
+ * Build a sort, having the input produce just the columns wanted from the sort, plus the sort columns.
+ * @param column_names  columns wanted from the sort, or nullptr for all of them
+ * @return              the sort operator (freed by caller)
+ */
+EvalOperator *EvalPlan::sort(const ColumnNames *column_names) {
+    EvalOperator *input;
+    if (column_names == nullptr) {
+        input = this->relation->operate(nullptr);
+    } else {
+        ColumnNames wanted = *column_names;
+        for (auto const &column_name: *this->projection)
+            if (std::find(wanted.begin(), wanted.end(), column_name) == wanted.end())
+                wanted.push_back(column_name);
+        input = this->relation->operate(&wanted);
+    }
+    return new SortOperator(input, this->projection, this->descending, this->limit);
+}
+
+ColumnNames EvalPlan::get_column_names() const {
+    ColumnNames ret;
+    switch (this->type) {
+        case TableScan:
+        case IndexLookup:
+        case IndexRange:
+            return this->table.get_column_names();
+        case Select:
+        case ProjectAll:
+        case Sort:
+        case Limit:
+            return this->relation->get_column_names();
+        case Project:
+            return *this->projection;
+        case Rename:
+            for (auto const &column_name: this->relation->get_column_names())
+                ret.push_back(this->alias + "." + column_name);
+            return ret;
+        case HashJoin:
+            ret = this->relation->get_column_names();
+            for (auto const &column_name: this->right->get_column_names())
+                ret.push_back(column_name);
+            return ret;
+        case IndexJoin:
+            ret = this->relation->get_column_names();
+            for (auto const &column_name: this->table.get_column_names())
+                ret.push_back(this->alias + "." + column_name);
+            return ret;
+        case Aggregate:
+            ret = *this->projection;
+            for (auto const &aggregation: *this->aggregations)
+                ret.push_back(aggregation.get_name());
+            return ret;
+        default:
+            throw DbRelationError("Not implemented: columns of this plan");
+    }
+}
+
+/**
+ * Guess what fraction of rows a predicate lets through: a tenth for an equality condition (or for
+ * each value of an IN list), a third for an inequality, and a quarter for BETWEEN, with the
+ * conditions taken to be independent.
+ * @param predicate  the predicate, or nullptr for none
+ * @return           estimated fraction of the rows
+ */
+static double selectivity(const Predicate *predicate) {
+    if (predicate == nullptr)
+        return 1.0;
+    double ret = 1.0;
+    switch (predicate->get_type()) {
+        case Predicate::EQ:
+            return 0.1;
+        case Predicate::NE:
+            return 0.9;
+        case Predicate::LT:
+        case Predicate::LE:
+        case Predicate::GT:
+        case Predicate::GE:
+            return 1.0 / 3.0;
+        case Predicate::BETWEEN:
+            return 0.25;
+        case Predicate::IN:
+            return std::min(1.0, 0.1 * (double) predicate->get_values().size());
+        case Predicate::AND:
+            for (auto const &operand: predicate->get_operands())
+                ret *= selectivity(operand);
+            return ret;
+        case Predicate::OR:
+            for (auto const &operand: predicate->get_operands())
+                ret *= 1.0 - selectivity(operand);
+            return 1.0 - ret;
+        case Predicate::NOT:
+            return 1.0 - selectivity(predicate->get_operands()[0]);
+    }
     return ret;
 }
 
+/**
+ * Guess how many rows the plan will produce, for choosing between plans. Tables are taken to have
+ * ROWS_PER_BLOCK rows in each of their blocks, and conditions to let through the fraction of them
+ * that selectivity() guesses (a unique index lookup finds at most one). A join is guessed to be as
+ * big as its bigger side, as it would be for a foreign key, and grouping to leave a tenth of the rows.
+ * @return  estimated number of rows
+ */
+double EvalPlan::estimate() const {
+    const double group_selectivity = 0.1;
+    double rows = (double) std::max(this->table.get_block_count(), 1U) * ROWS_PER_BLOCK;
+    switch (this->type) {
+        case TableScan:
+            return rows;
+        case IndexLookup:
+            if (this->index->is_unique())
+                return 1.0;
+            return rows * std::pow(0.1, (double) this->select_conjunction->size());
+        case IndexRange:
+            if (this->select_conjunction != nullptr && this->high_key != nullptr)
+                return rows * 0.25;
+            return rows / 3.0;
+        case Select:
+            return this->relation->estimate() * selectivity(this->predicate);
+        case ProjectAll:
+        case Project:
+        case Rename:
+            return this->relation->estimate();
+        case HashJoin:
+            return std::max(this->relation->estimate(), this->right->estimate());
+        case Sort:
+        case Limit:
+            if (this->limit != EvalOperator::NO_LIMIT)
+                return std::min(this->relation->estimate(), (double) this->limit);
+            return this->relation->estimate();
+        case Aggregate:
+            if (this->projection->empty())
+                return 1.0;
+            return std::max(this->relation->estimate() * group_selectivity, 1.0);
+        case IndexJoin:
+            return std::max(this->relation->estimate(), rows * selectivity(this->predicate));
+        default:
+            throw DbRelationError("Not implemented: estimate for this plan");
+    }
+}
+
 EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
-        return EvalPipeline(&this->table, this->table.select());
+        return EvalPipeline(&this->table, this->table.cursor());
+    if (this->type == IndexLookup) {
+        this->index->open();
+        return EvalPipeline(&this->table, new HandlesCursor(this->index->lookup(this->select_conjunction)));
+    }
+    if (this->type == IndexRange) {
+        this->index->open();
+        return EvalPipeline(&this->table, this->index->range_cursor(this->select_conjunction, this->high_key));
+    }
     if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        return EvalPipeline(&this->relation->table, this->relation->table.cursor(this->predicate));
 
     // recursive case
     if (this->type == Select) {
         EvalPipeline pipeline = this->relation->pipeline();
         DbRelation *temp_table = pipeline.first;
-        Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
-        delete handles;
-        return ret;
+        return EvalPipeline(temp_table, temp_table->cursor(pipeline.second, this->predicate));
+    }
+
+    throw DbRelationError("Not implemented: pipeline other than Select, TableScan, IndexLookup, or IndexRange");
+}
+
+/**
+ * @class TestIndex - a BTreeIndex that counts its lookups (for testing)
+ */
+class TestIndex : public BTreeIndex {
+public:
+    TestIndex(DbRelation &relation, Identifier name, ColumnNames key_columns)
+            : BTreeIndex(relation, name, key_columns, true), lookups(0) {}
+
+    virtual ~TestIndex() {}
+
+    virtual Handles *lookup(ValueDict *key) const {
+        this->lookups++;
+        return BTreeIndex::lookup(key);
+    }
+
+    mutable u_long lookups;
+};
+
+/**
+ * @class TestIndices - stands in for the _indices table, knowing just the one index (for testing)
+ */
+class TestIndices : public Indices {
+public:
+    TestIndices(DbIndex &index) : Indices(), index(index) {}
+
+    virtual ~TestIndices() {}
+
+    virtual DbIndex &get_index(Identifier table_name, Identifier index_name) { return this->index; }
+
+    virtual IndexNames get_index_names(Identifier table_name) {
+        IndexNames index_names;
+        if (table_name == this->index.get_relation().get_table_name())
+            index_names.push_back("id");
+        return index_names;
     }
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+protected:
+    DbIndex &index;
+};
+
+// name of the inner row with a given id in test_eval_plan (long enough that probing beats scanning)
+static std::string test_name(int32_t id) {
+    return "name" + std::to_string(id) + std::string(100, '.');
 }
 
+/**
+ * Testing function for the planner's choice of an index join.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_eval_plan() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("name");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable inner("_test_plan_inner", column_names, column_attributes);
+    inner.create();
+    for (int id = 0; id < 4000; id++) {
+        ValueDict row;
+        row["id"] = Value(id);
+        row["name"] = Value(test_name(id));
+        inner.insert(&row);
+    }
+    TestIndex index(inner, "_test_plan_inner_id", ColumnNames(1, "id"));
+    index.create();
+
+    column_names.clear();
+    column_names.push_back("fid");
+    column_names.push_back("label");
+    HeapTable outer("_test_plan_outer", column_names, column_attributes);
+    outer.create();
+    int fids[] = {17, 5, 17, 3999, 5000, 17, 42};  // 5000 has no match; 17 is only looked up once
+    for (auto const &fid: fids) {
+        ValueDict row;
+        row["fid"] = Value(fid);
+        row["label"] = Value("label" + std::to_string(fid));
+        outer.insert(&row);
+    }
 
+    // plan SELECT * FROM outer AS o JOIN inner AS i ON o.fid = i.id the way SQLExec does, then
+    // the same with inner first in FROM
+    bool ok = true;
+    for (int inner_first = 0; inner_first < 2 && ok; inner_first++) {
+        EvalPlan *sides[2] = {new EvalPlan("o", new EvalPlan(outer)), new EvalPlan("i", new EvalPlan(inner))};
+        ColumnNames *keys[2] = {new ColumnNames(1, "o.fid"), new ColumnNames(1, "i.id")};
+        uint first = inner_first ? 1 : 0;
+        EvalPlan *join = new EvalPlan(sides[first], sides[1 - first], keys[first], keys[1 - first]);
+        EvalPlan *plan = new EvalPlan(EvalPlan::ProjectAll, join);
+        TestIndices indices(index);
+        EvalPlan *optimized = plan->optimize(&indices);
+        delete plan;
+        join = optimized->relation;
+        if (inner_first && join->type == EvalPlan::Project)  // putting the columns back in FROM order
+            join = join->relation;
+        if (join->type != EvalPlan::IndexJoin || &join->table != &inner) {
+            delete optimized;
+            ok = assertion_failure("index join not chosen", inner_first);
+            break;
+        }
+
+        ColumnNames result_columns = optimized->get_column_names();
+        uint o = inner_first ? 2 : 0, i = inner_first ? 0 : 2;  // where each table's columns are
+        if (result_columns.size() != 4 || result_columns[o] != "o.fid" || result_columns[o + 1] != "o.label" ||
+            result_columns[i] != "i.id" || result_columns[i + 1] != "i.name") {
+            delete optimized;
+            ok = assertion_failure("index join columns out of order", inner_first);
+            break;
+        }
+        index.lookups = 0;
+        Tuples *rows = optimized->evaluate();
+        delete optimized;
+        if (rows->size() != 6 || index.lookups != 5)
+            ok = assertion_failure("index join rows or lookups", rows->size(), index.lookups);
+        for (auto const &row: *rows) {
+            if (ok && (row->get_n(o) != row->get_n(i) || row->get_s(o + 1) != "label" + std::to_string(row->get_n(o)) ||
+                       row->get_s(i + 1) != test_name(row->get_n(i))))
+                ok = assertion_failure("index join row", row->get_n(o), row->get_n(i));
+            delete row;
+        }
+        delete rows;
+    }
+    index.drop();
+    inner.drop();
+    outer.drop();
+    if (ok)
+        std::cout << "index join ok" << std::endl;
+    return ok;
+}
@@ -7,38 +7,96 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "EvalOperator.h"
 
 
-typedef std::pair<DbRelation *, Handles *> EvalPipeline;
+typedef std::pair<DbRelation *, DbCursor *> EvalPipeline;  // cursor is freed by caller
+
+class Indices;
 
 class EvalPlan {
 public:
     enum PlanType {
-        ProjectAll, Project, Select, TableScan
+        ProjectAll, Project, Select, TableScan, IndexLookup, IndexRange, Rename, HashJoin, IndexJoin, Aggregate, Sort,
+        Limit
     };
 
+    static const uint ROWS_PER_BLOCK = 40;  // guess at how many rows fit in a block, for estimates
+    static const uint PROBE_COST = 2;  // guess at how many blocks are read per index join probe
+    static const uint RANGE_PROBE_SZ = 1000;  // most index entries counted while planning an index range
+
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
-    EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(Predicate *predicate, EvalPlan *relation);  // use for Select
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(DbIndex &index, ValueDict *key);  // use for IndexLookup
+    EvalPlan(DbIndex &index, ValueDict *low_key, ValueDict *high_key);  // use for IndexRange (either may be nullptr)
+    EvalPlan(const Identifier &alias, EvalPlan *relation);  // use for Rename
+    EvalPlan(EvalPlan *left, EvalPlan *right, ColumnNames *left_keys, ColumnNames *right_keys);  // use for HashJoin
+    EvalPlan(EvalPlan *outer, DbIndex &index, const Identifier &alias, ColumnNames *outer_keys,
+             ColumnNames *inner_keys, Predicate *filter);  // use for IndexJoin
+    EvalPlan(ColumnNames *group_by, Aggregations *aggregations, EvalPlan *relation);  // use for Aggregate
+    EvalPlan(ColumnNames *sort_columns, std::vector<bool> *descending, u_long limit, EvalPlan *relation);  // use for Sort
+    EvalPlan(u_long limit, u_long offset, EvalPlan *relation);  // use for Limit
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // Attempt to get the best equivalent evaluation plan (using any of the given indices that help)
+    EvalPlan *optimize(Indices *indices = nullptr);
 
-    // Evaluate the plan: evaluate gets values, pipeline gets handles
-    ValueDicts *evaluate();
+    // Evaluate the plan: evaluate gets values, pipeline gets a cursor over the handles
+    Tuples *evaluate();
 
     EvalPipeline pipeline();
 
+    // Build the operators that carry out the plan (freed by caller)
+    EvalOperator *operate(const ColumnNames *column_names = nullptr);
+
+    // Names of the columns the plan produces
+    ColumnNames get_column_names() const;
+
+    // Rough number of rows the plan produces
+    double estimate() const;
+
 protected:
 
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan
-    ColumnNames *projection;  // for Project
-    ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    EvalPlan *relation;  // for all but TableScan, IndexLookup, and IndexRange (left of HashJoin, outer of IndexJoin)
+    EvalPlan *right;  // for HashJoin
+    ColumnNames *projection;  // for Project, the group columns for Aggregate, and the sort columns for Sort
+    ValueDict *select_conjunction;  // the search key for IndexLookup, and the low key for IndexRange
+    Predicate *predicate;  // for Select, and the inner filter for IndexJoin
+    ValueDict *high_key;  // for IndexRange
+    DbRelation &table;  // for TableScan, IndexLookup, IndexRange, and IndexJoin (inner)
+    DbIndex *index;  // for IndexLookup, IndexRange, and IndexJoin
+    Identifier alias;  // for Rename and IndexJoin (inner)
+    ColumnNames *left_keys;  // for HashJoin and IndexJoin (outer)
+    ColumnNames *right_keys;  // for HashJoin and IndexJoin (inner, unqualified)
+    Aggregations *aggregations;  // for Aggregate
+    std::vector<bool> *descending;  // for Sort
+    u_long limit;  // for Sort and Limit (EvalOperator::NO_LIMIT for none)
+    u_long offset;  // for Limit
+
+    EvalPlan *use_index(Indices *indices) const;
+
+    EvalPlan *use_index_range(Indices *indices, const std::vector<const Predicate *> &conjuncts,
+                              std::vector<const Predicate *> &used) const;
+
+    EvalPlan *use_index_join(Indices *indices);
+
+    EvalOperator *join(const ColumnNames *column_names);
+
+    EvalOperator *index_join(const ColumnNames *column_names);
+
+    EvalOperator *aggregate();
+
+    EvalOperator *sort(const ColumnNames *column_names);
+
+    EvalOperator *limit_rows(const ColumnNames *column_names);
+
+    friend bool test_eval_plan();
 };
 
+bool test_eval_plan();
+
 
@@ -0,0 +1,100 @@
+/**
+ * @file FreeSpaceMap.cpp - implementation of FreeSpaceMap
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include "FreeSpaceMap.h"
+
+using namespace std;
+
+FreeSpaceMap::FreeSpaceMap(string path, uint block_size) : path(path), block_size(block_size), tree(),
+                                                             leaves(0), block_count(0), dirty(false) {
+}
+
+void FreeSpaceMap::load() {
+    this->tree.clear();
+    this->leaves = 0;
+    this->block_count = 0;
+    ifstream in(this->path.c_str(), ios::binary);
+    if (in) {
+        vector<char> entries((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        if (!entries.empty()) {
+            grow((BlockID) entries.size());
+            this->block_count = (BlockID) entries.size();
+            for (uint i = 0; i < entries.size(); i++)
+                this->tree[this->leaves + i] = (uint8_t) entries[i];
+            for (uint i = this->leaves - 1; i > 0; i--)
+                this->tree[i] = max(this->tree[2 * i], this->tree[2 * i + 1]);
+        }
+    }
+    this->dirty = false;
+}
+
+void FreeSpaceMap::save() {
+    if (!this->dirty)
+        return;
+    ofstream out(this->path.c_str(), ios::binary | ios::trunc);
+    if (this->block_count > 0)
+        out.write((const char *) &this->tree[this->leaves], this->block_count);
+    if (!out)
+        throw DbRelationError("cannot write " + this->path);
+    this->dirty = false;
+}
+
+void FreeSpaceMap::remove() {
+    this->tree.clear();
+    this->leaves = 0;
+    this->block_count = 0;
+    this->dirty = false;
+    ::remove(this->path.c_str());
+}
+
+void FreeSpaceMap::set(BlockID block_id, uint free_bytes) {
+    uint8_t entry = (uint8_t) min((uint64_t) free_bytes * 256 / this->block_size, (uint64_t) UINT8_MAX);
+    if (block_id > this->block_count) {
+        if (entry == 0)
+            return;  // same as no entry
+        grow(block_id);
+        this->block_count = block_id;
+    }
+    uint i = this->leaves + block_id - 1;
+    if (this->tree[i] == entry)
+        return;
+    this->tree[i] = entry;
+    for (i /= 2; i > 0; i /= 2) {
+        uint8_t biggest = max(this->tree[2 * i], this->tree[2 * i + 1]);
+        if (this->tree[i] == biggest)
+            break;
+        this->tree[i] = biggest;
+    }
+    this->dirty = true;
+}
+
+BlockID FreeSpaceMap::find(uint size) const {
+    // entries are rounded down, so round the need up (and an entry of 0 is never enough)
+    uint64_t need = max(((uint64_t) size * 256 + this->block_size - 1) / this->block_size, (uint64_t) 1);
+    if (this->leaves == 0 || need > this->tree[1])
+        return 0;
+    uint i = 1;
+    while (i < this->leaves)
+        i = this->tree[2 * i] >= need ? 2 * i : 2 * i + 1;
+    return i - this->leaves + 1;
+}
+
+// Make room in the tree for entries up to the given block, keeping the ones already there.
+void FreeSpaceMap::grow(BlockID block_id) {
+    if (block_id <= this->leaves)
+        return;
+    uint leaves = this->leaves == 0 ? 1 : this->leaves;
+    while (leaves < block_id)
+        leaves *= 2;
+    vector<uint8_t> tree(2 * (size_t) leaves, 0);
+    for (BlockID b = 0; b < this->block_count; b++)
+        tree[leaves + b] = this->tree[this->leaves + b];
+    for (uint i = leaves - 1; i > 0; i--)
+        tree[i] = max(tree[2 * i], tree[2 * i + 1]);
+    this->tree.swap(tree);
+    this->leaves = leaves;
+}
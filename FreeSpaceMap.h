@@ -0,0 +1,82 @@
+/**
+ * @file FreeSpaceMap.h - FreeSpaceMap: roughly how much room each block of a HeapFile has left
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <vector>
+#include "storage_engine.h"
+
+
+/**
+ * @class FreeSpaceMap - which blocks of a HeapFile have room for another record
+ *
+ * Each block gets one byte: its free space in 256ths of a block, rounded down, so the map never
+ * claims more room than there is (as long as it has been kept up to date). The bytes are the leaves
+ * of a complete binary tree in an array where each inner node is the biggest of its two children,
+ * so finding the first block with enough room and changing a block's entry both take O(log n).
+ *
+ * The map is kept in its own file (name.fsm, next to the file it describes), read when the file is
+ * opened and written back on sync and close if it has changed. A map file that is missing or out
+ * of date (e.g., after a crash) only means some room goes unused or a block turns out to be full
+ * when it is tried, and the entry gets fixed then.
+ */
+class FreeSpaceMap {
+public:
+    /**
+     * @param path        the map file's path
+     * @param block_size  size of the blocks being mapped
+     */
+    FreeSpaceMap(std::string path, uint block_size);
+
+    virtual ~FreeSpaceMap() {}
+
+    FreeSpaceMap(const FreeSpaceMap &other) = delete;
+
+    FreeSpaceMap(FreeSpaceMap &&temp) = delete;
+
+    FreeSpaceMap &operator=(const FreeSpaceMap &other) = delete;
+
+    FreeSpaceMap &operator=(FreeSpaceMap &&temp) = delete;
+
+    /**
+     * Read the map file, if there is one; otherwise start with no room recorded anywhere.
+     */
+    virtual void load();
+
+    /**
+     * Write the map file if the map has changed since it was loaded or last saved.
+     * @throws DbRelationError if it can't be written
+     */
+    virtual void save();
+
+    /**
+     * Forget every entry and delete the map file.
+     */
+    virtual void remove();
+
+    /**
+     * Record how much room a block has.
+     * @param block_id    which block
+     * @param free_bytes  bytes it has free for new records
+     */
+    virtual void set(BlockID block_id, uint free_bytes);
+
+    /**
+     * Find the first block with room for a record.
+     * @param size  bytes needed (including any overhead)
+     * @return      the block, or 0 if no block in the map is known to have that much room
+     */
+    virtual BlockID find(uint size) const;
+
+protected:
+    std::string path;
+    uint block_size;
+    std::vector<uint8_t> tree;  // tree[1] is the root; the leaves start at tree[leaves]
+    uint leaves;  // capacity of the tree, a power of two
+    BlockID block_count;  // highest block with an entry
+    bool dirty;
+
+    void grow(BlockID block_id);
+};
@@ -3,6 +3,7 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
 #include <cstring>
 #include "db_cxx.h"
 #include "HeapFile.h"
@@ -13,16 +14,37 @@ typedef uint16_t u16;
 /**
  * Constructor
  * @param name
+ * @param storage     where to keep the blocks if the file gets created
+ * @param block_size  size of the blocks
+ * @param pool        buffer pool to use, or nullptr for the default one
  */
-HeapFile::HeapFile(string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {
+HeapFile::HeapFile(string name, Storage storage, uint block_size, BufferPool *pool)
+        : DbFile(name), dbfilename(""), last(0), closed(true), storage(storage), block_size(block_size),
+          db(_DB_ENV, 0), pages(page_file_path(name), block_size),
+          free_space(home_path(name + ".fsm"), block_size), pool(pool == nullptr ? BufferPool::get_default(block_size) : *pool) {
+    if (!DbBlock::valid_block_size(block_size))
+        throw DbRelationError("invalid block size " + to_string(block_size) + " for " + name);
+    if (this->pool.get_block_size() != block_size)
+        throw DbRelationError("buffer pool frames don't match the block size of " + name);
     this->dbfilename = this->name + ".db";
 }
 
+HeapFile::~HeapFile() {
+    close();
+}
+
 /**
  * Create physical file.
  */
 void HeapFile::create(void) {
-    db_open(DB_CREATE | DB_EXCL);
+    this->free_space.remove();  // in case one was left behind
+    if (this->storage == PAGE_FILE) {
+        this->pages.create();
+        this->last = 0;
+        this->closed = false;
+    } else {
+        db_open(DB_CREATE | DB_EXCL);
+    }
     SlottedPage *page = get_new(); // force one page to exist
     delete page;
 }
@@ -32,22 +54,45 @@ void HeapFile::create(void) {
  */
 void HeapFile::drop(void) {
     close();
-    Db db(_DB_ENV, 0);
-    db.remove(this->dbfilename.c_str(), nullptr, 0);
+    this->free_space.remove();
+    if (PageFile::exists(page_file_path(this->name))) {
+        this->pages.remove();
+    } else {
+        Db db(_DB_ENV, 0);
+        db.remove(this->dbfilename.c_str(), nullptr, 0);
+    }
 }
 
 /**
- * Open physical file.
+ * Open physical file, whichever kind it is.
  */
 void HeapFile::open(void) {
-    db_open();
+    if (!this->closed)
+        return;
+    if (PageFile::exists(page_file_path(this->name))) {
+        this->storage = PAGE_FILE;
+        this->pages.open();
+        this->last = this->pages.get_block_count();
+        this->closed = false;
+    } else {
+        this->storage = BERKELEY_DB;
+        db_open();
+    }
+    this->free_space.load();
 }
 
 /**
- * Close the physical file.
+ * Close the physical file, writing back and letting go of its blocks in the buffer pool.
  */
 void HeapFile::close(void) {
-    this->db.close(0);
+    if (this->closed)
+        return;
+    this->free_space.save();
+    this->pool.discard(*this);
+    if (this->storage == PAGE_FILE)
+        this->pages.close();
+    else
+        this->db.close(0);
     this->closed = true;
 }
 
@@ -56,41 +101,122 @@ void HeapFile::close(void) {
  * @return the new empty DbBlock that is managing the records in this block and its block id.
  */
 SlottedPage *HeapFile::get_new(void) {
-    char block[DbBlock::BLOCK_SZ];
-    memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
-
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
+    BlockID block_id = this->last + 1;
+    uint frame = this->pool.pin(*this, block_id, true);
+    Dbt data(this->pool.get_data(frame), this->block_size);
+    PinnedPage *page = new PinnedPage(data, block_id, this->pool, frame, true);
 
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage *page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
-    delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    // write out the initialized block once so the file has it; the frame already has it, so no need to read it back
+    try {
+        write_block(block_id, this->pool.get_data(frame));
+    } catch (...) {
+        delete page;
+        throw;
+    }
+    this->last = block_id;
+    return page;
 }
 
 /**
  * Get a block from the database file.
  * @param block_id
- * @return          the given slotted page (freed by caller)
+ * @return          the given slotted page, pinned in the buffer pool until it is freed (freed by caller)
  */
 SlottedPage *HeapFile::get(BlockID block_id) {
-    Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, block_id, false);
+    uint frame = this->pool.pin(*this, block_id);
+    Dbt data(this->pool.get_data(frame), this->block_size);
+    return new PinnedPage(data, block_id, this->pool, frame);
 }
 
 /**
- * Write a block back to the database file.
+ * Write a block back to the database file. A block from get() or get_new() is already in the
+ * buffer pool, so this only marks it dirty; the pool writes it out later.
  * @param block
  */
 void HeapFile::put(DbBlock *block) {
-    int block_id = block->get_block_id();
-    Dbt key(&block_id, sizeof(block_id));
-    this->db.put(nullptr, &key, block->get_block(), 0);
+    uint frame = this->pool.pin(*this, block->get_block_id(), true);
+    if (this->pool.get_data(frame) != block->get_data())
+        memcpy(this->pool.get_data(frame), block->get_data(), this->block_size);
+    this->pool.mark_dirty(frame);
+    this->pool.unpin(frame);
+}
+
+/**
+ * Add a record to a block that has room left by deleted records, if the free space map knows of
+ * one, or else to the last block, starting a new one if it is full. The last block is usually
+ * already in the buffer pool, so a run of appends only writes each block out once, when the pool
+ * evicts it or the file is synced.
+ * @param record  bits to add
+ * @return        handle of the new record
+ */
+Handle HeapFile::append(const Dbt *record) {
+    uint needed = record->get_size() + 8;  // room for its header, too
+    BlockID block_id;
+    while ((block_id = this->free_space.find(needed)) != 0) {
+        SlottedPage *page = get(block_id);
+        try {
+            RecordID record_id = page->add(record);
+            put(page);
+            this->free_space.set(block_id, page->free_bytes());
+            delete page;
+            return Handle(block_id, record_id);
+        } catch (DbBlockNoRoomError &e) {
+            // the map was out of date; the block is no good until something in it is deleted
+            this->free_space.set(block_id, 0);
+            delete page;
+        } catch (...) {
+            delete page;
+            throw;
+        }
+    }
+
+    SlottedPage *page = get(this->last);
+    try {
+        RecordID record_id;
+        try {
+            record_id = page->add(record);
+        } catch (DbBlockNoRoomError &e) {
+            // need a new block
+            delete page;
+            page = nullptr;
+            page = get_new();
+            record_id = page->add(record);
+        }
+        Handle handle(page->get_block_id(), record_id);
+        put(page);
+        delete page;
+        return handle;
+    } catch (...) {
+        delete page;
+        throw;
+    }
+}
+
+/**
+ * Delete a record and note the room that leaves in its block in the free space map.
+ * @param handle  the record
+ */
+void HeapFile::del(Handle handle) {
+    SlottedPage *page = get(handle.first);
+    try {
+        page->del(handle.second);
+        put(page);
+        this->free_space.set(handle.first, page->free_bytes());
+    } catch (...) {
+        delete page;
+        throw;
+    }
+    delete page;
+}
+
+/**
+ * Write out any changes (and the free space map) that are still only in memory.
+ */
+void HeapFile::sync(void) {
+    if (!this->closed) {
+        this->pool.flush(*this);
+        this->free_space.save();
+    }
 }
 
 /**
@@ -109,6 +235,8 @@ BlockIDs *HeapFile::block_ids() const {
  * @return number of blocks
  */
 uint32_t HeapFile::get_block_count() {
+    if (this->storage == PAGE_FILE)
+        return this->pages.get_block_count();
     DB_BTREE_STAT *stat;
     this->db.stat(nullptr, &stat, DB_FAST_STAT);
     uint32_t bt_ndata = stat->bt_ndata;
@@ -123,10 +251,149 @@ uint32_t HeapFile::get_block_count() {
 void HeapFile::db_open(uint flags) {
     if (!this->closed)
         return;
-    this->db.set_re_len(DbBlock::BLOCK_SZ); // record length - will be ignored if file already exists
+    this->db.set_re_len(this->block_size); // record length - will be ignored if file already exists
+    // a block-sized record is always a Berkeley DB overflow item (a page can't hold one whole), but
+    // bigger pages mean each big block is spread over fewer of them
+    if (this->block_size > DbBlock::BLOCK_SZ)
+        this->db.set_pagesize(this->block_size < MAX_DB_PAGE_SZ ? this->block_size : (uint) MAX_DB_PAGE_SZ);
     this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0644);
 
     this->last = flags ? 0 : get_block_count();
     this->closed = false;
 }
 
+/**
+ * Read a block from the file straight into the given memory (for the buffer pool).
+ * @param block_id  which block
+ * @param bits      where to put it (block_size bytes)
+ */
+void HeapFile::read_block(BlockID block_id, char *bits) {
+    if (this->storage == PAGE_FILE) {
+        this->pages.read(block_id, bits);
+        return;
+    }
+    Dbt key(&block_id, sizeof(block_id));
+    Dbt data(bits, this->block_size);
+    data.set_ulen(this->block_size);
+    data.set_flags(DB_DBT_USERMEM);
+    if (this->db.get(nullptr, &key, &data, 0) == DB_NOTFOUND)
+        throw DbRelationError("no block " + to_string(block_id) + " in " + this->dbfilename);
+}
+
+/**
+ * Write a block to the file (for the buffer pool).
+ * @param block_id  which block
+ * @param bits      its contents (block_size bytes)
+ */
+void HeapFile::write_block(BlockID block_id, const char *bits) {
+    if (this->storage == PAGE_FILE) {
+        this->pages.write(block_id, bits);
+        return;
+    }
+    Dbt key(&block_id, sizeof(block_id));
+    Dbt data((void *) bits, this->block_size);
+    this->db.put(nullptr, &key, &data, 0);
+}
+
+/**
+ * See if either kind of file is there.
+ * @return  true if the file exists
+ */
+bool HeapFile::exists() const {
+    return PageFile::exists(page_file_path(this->name)) || PageFile::exists(home_path(this->dbfilename));
+}
+
+/**
+ * Where the PageFile for a HeapFile goes: alongside the Berkeley DB files, in the environment's home.
+ * @param name  name of the HeapFile
+ * @return      path of its PageFile
+ */
+string HeapFile::page_file_path(const string &name) {
+    return home_path(name + ".pages");
+}
+
+/**
+ * @param file_name  name of a file in the environment's home
+ * @return           its path
+ */
+string HeapFile::home_path(const string &file_name) {
+    const char *home = nullptr;
+    _DB_ENV->get_home(&home);
+    return (home == nullptr ? string(".") : string(home)) + "/" + file_name;
+}
+
+
+/**
+ * Constructor -- file must be open.
+ * @param file         file to scan
+ * @param buffer_size  size of the bulk retrieval buffer
+ */
+HeapFileScan::HeapFileScan(HeapFile &file, uint buffer_size)
+        : block_size(file.block_size),
+          buffer_size(buffer_size < 2 * file.block_size ? 2 * file.block_size : buffer_size),
+          fetch_size(FIRST_FETCH_SZ < 2 * file.block_size ? 2 * file.block_size : FIRST_FETCH_SZ),
+          cursor(nullptr), mapping(nullptr), mapped_blocks(0), next_block_id(1),
+          buffer(new char[file.storage == HeapFile::PAGE_FILE ? file.block_size : this->buffer_size]),
+          data(buffer, file.storage == HeapFile::PAGE_FILE ? file.block_size : this->buffer_size),
+          batch(nullptr), page(data, 0, true), done(false) {
+    if (this->fetch_size > this->buffer_size)
+        this->fetch_size = this->buffer_size;
+    file.sync();
+    if (file.storage == HeapFile::PAGE_FILE) {
+        this->mapping = file.pages.map(this->mapped_blocks);
+        return;
+    }
+    this->data.set_ulen(this->fetch_size);
+    this->data.set_flags(DB_DBT_USERMEM);
+    file.db.cursor(nullptr, &this->cursor, 0);
+}
+
+HeapFileScan::~HeapFileScan() {
+    delete this->batch;
+    if (this->cursor != nullptr)
+        this->cursor->close();
+    PageFile::unmap(this->mapping, this->mapped_blocks, this->block_size);
+    delete[] this->buffer;
+}
+
+/**
+ * Get the next block from the current batch, fetching another batch when it runs out.
+ * @return  view of the next block or nullptr if there aren't any more
+ */
+SlottedPage *HeapFileScan::next() {
+    if (this->cursor == nullptr) {
+        if (this->next_block_id > this->mapped_blocks)
+            return nullptr;
+        Dbt mapped((void *) (this->mapping + (size_t) (this->next_block_id - 1) * this->block_size),
+                   this->block_size);
+        this->page = SlottedPage(mapped, this->next_block_id++);
+        return &this->page;
+    }
+    db_recno_t block_id;
+    Dbt block;
+    while (this->batch == nullptr || !this->batch->next(block_id, block))
+        if (!fetch_batch())
+            return nullptr;
+    this->page = SlottedPage(block, block_id);
+    return &this->page;
+}
+
+/**
+ * Bulk fetch as many of the following blocks as fit into the next fetch's share of the buffer.
+ * @return  false if we have already reached the end of the file
+ */
+bool HeapFileScan::fetch_batch() {
+    delete this->batch;
+    this->batch = nullptr;
+    if (this->done)
+        return false;
+    this->data.set_ulen(this->fetch_size);
+    this->fetch_size = std::min(this->buffer_size, 2 * this->fetch_size);
+    Dbt key;
+    if (this->cursor->get(&key, &this->data, DB_MULTIPLE_KEY | DB_NEXT) == DB_NOTFOUND) {
+        this->done = true;
+        return false;
+    }
+    this->batch = new DbMultipleRecnoDataIterator(this->data);
+    return true;
+}
@@ -9,6 +9,9 @@
 
 #include "db_cxx.h"
 #include "SlottedPage.h"
+#include "BufferPool.h"
+#include "PageFile.h"
+#include "FreeSpaceMap.h"
 
 
 /**
@@ -16,14 +19,47 @@
  *
  * Heap file organization. Built on top of Berkeley DB RecNo file. There is one of our
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
-        for buffer management and file management.
+        for file management. Alternatively, the blocks can go in a plain PageFile (name.pages instead of
+        name.db), skipping Berkeley DB altogether. Which one is picked when the file is created; after
+        that, open() goes by which kind of file is there.
         Uses SlottedPage for storing records within blocks.
+
+        Blocks are DbBlock::BLOCK_SZ unless the file is made with a bigger block size (any
+        DbBlock::valid_block_size). The size isn't looked up from the file; whoever opens it has to
+        say the same size it was created with (HeapTable and BTreeIndex get it from the catalog).
+
+        Blocks are read through a BufferPool. get() and get_new() hand out PinnedPages that are views of
+        the pool's frames, and put() just marks the frame dirty; it gets written back when the pool
+        evicts it or the file is synced or closed. Appends go into the last block of the file, which
+        is usually still in the pool, so a run of appends costs about one write per block.
+
+        Room left by records deleted with del() is noted in a FreeSpaceMap (name.fsm), and append()
+        puts a record into the first block the map says has room for it before falling back to the
+        last block. Files that are only ever appended to (or that use put() to change their blocks,
+        like the B-tree's) fill up in order as before.
  */
 class HeapFile : public DbFile {
 public:
-    HeapFile(std::string name);
+    /**
+     * Where the blocks are kept.
+     */
+    enum Storage {
+        BERKELEY_DB,  // a Berkeley DB RecNo file
+        PAGE_FILE  // a plain PageFile
+    };
 
-    virtual ~HeapFile() {}
+    /**
+     * @param name        name of the file (without the .db or .pages)
+     * @param storage     where to keep the blocks if the file gets created
+     * @param block_size  size of the blocks
+     * @param pool        buffer pool to read the file's blocks through (with frames of block_size), or
+     *                    nullptr for the default one for block_size
+     * @throws DbRelationError if block_size isn't valid or doesn't match the pool
+     */
+    HeapFile(std::string name, Storage storage = BERKELEY_DB, uint block_size = DbBlock::BLOCK_SZ,
+             BufferPool *pool = nullptr);
+
+    virtual ~HeapFile();
 
     HeapFile(const HeapFile &other) = delete;
 
@@ -49,21 +85,125 @@ public:
 
     virtual BlockIDs *block_ids() const;
 
+    virtual Handle append(const Dbt *record);
+
+    virtual void del(Handle handle);
+
+    virtual void sync(void);
+
     /**
      * Get the id of the current final block in the heap file.
      * @return block id of last block
      */
     virtual uint32_t get_last_block_id() { return last; }
 
+    /**
+     * @return  where the blocks are kept (once open, where they actually are)
+     */
+    virtual Storage get_storage() const { return storage; }
+
+    /**
+     * @return  size of the file's blocks
+     */
+    virtual uint get_block_size() const { return block_size; }
+
+    /**
+     * @return  true if the file is open
+     */
+    virtual bool is_open() const { return !closed; }
+
+    /**
+     * @return  true if the file has been created (of either kind)
+     */
+    virtual bool exists() const;
+
 protected:
+    static const uint MAX_DB_PAGE_SZ = 64 * 1024;  // biggest page Berkeley DB has
     std::string dbfilename;
     uint32_t last;
     bool closed;
+    Storage storage;
+    uint block_size;
     Db db;
+    PageFile pages;
+    FreeSpaceMap free_space;
+    BufferPool &pool;
 
     virtual void db_open(uint flags = 0);
 
+    static std::string page_file_path(const std::string &name);
+
+    static std::string home_path(const std::string &file_name);
+
     virtual uint32_t get_block_count();
+
+    virtual void read_block(BlockID block_id, char *bits);
+
+    virtual void write_block(BlockID block_id, const char *bits);
+
+    friend class HeapFileScan;
+    friend class BufferPool;
+};
+
+
+/**
+ * @class HeapFileScan - sequential scan over all the blocks of a HeapFile
+ *
+ * Uses a Berkeley DB cursor with bulk retrieval (DB_MULTIPLE_KEY) to pull many blocks at a time
+ * into one large buffer that we own, then hands out SlottedPage views into that buffer one block
+ * at a time. (For a PAGE_FILE, the whole file is mapped instead and the views point right into
+ * the mapping.) Costs one Berkeley DB call per buffer-full instead of one per block. The first fetch
+ * only fills FIRST_FETCH_SZ of the buffer, and each one after that twice as much as the last, so
+ * a scan that is abandoned early (e.g., for a LIMIT) hasn't read much more than it used.
+ * Syncs the file first so the scan sees every change that is still only in the buffer pool.
+ */
+class HeapFileScan {
+public:
+    /**
+     * Default bulk buffer size (must be a multiple of 1024). The buffer is made bigger if the file's
+     * blocks are too big for it to hold two.
+     */
+    static const uint BUFFER_SZ = 256 * DbBlock::BLOCK_SZ;
+
+    /**
+     * How much of the buffer the first bulk fetch fills (must be a multiple of 1024), or two blocks'
+     * worth if that is more.
+     */
+    static const uint FIRST_FETCH_SZ = 8 * DbBlock::BLOCK_SZ;
+
+    HeapFileScan(HeapFile &file, uint buffer_size = BUFFER_SZ);
+
+    virtual ~HeapFileScan();
+
+    HeapFileScan(const HeapFileScan &other) = delete;
+
+    HeapFileScan(HeapFileScan &&temp) = delete;
+
+    HeapFileScan &operator=(const HeapFileScan &other) = delete;
+
+    HeapFileScan &operator=(HeapFileScan &&temp) = delete;
+
+    /**
+     * Get the next block of the file.
+     * @returns  a view of the block (owned by the scan and only good until the next call), or nullptr at the end
+     */
+    virtual SlottedPage *next();
+
+protected:
+    uint block_size;
+    uint buffer_size;
+    uint fetch_size;  // how much of the buffer the next fetch fills
+    Dbc *cursor;  // nullptr when scanning a mapped PAGE_FILE
+    const char *mapping;
+    uint32_t mapped_blocks;
+    BlockID next_block_id;  // next block of the mapping
+    char *buffer;
+    Dbt data;
+    DbMultipleRecnoDataIterator *batch;
+    SlottedPage page;
+    bool done;
+
+    bool fetch_batch();
 };
 
 
@@ -3,8 +3,11 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include "HeapTable.h"
+#include "SpillFile.h"
 
 using namespace std;
 typedef uint16_t u16;
@@ -14,9 +17,19 @@ typedef uint16_t u16;
  * @param table_name
  * @param column_names
  * @param column_attributes
+ * @param storage            where to keep the table's blocks if it gets created (an existing table
+ *                           stays wherever it already is)
+ * @param block_size         size of the table's blocks (the same every time the table is opened)
  */
-HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) : DbRelation(
-        table_name, column_names, column_attributes), file(table_name) {
+HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                     HeapFile::Storage storage, uint block_size) : DbRelation(table_name, column_names,
+                                                                              column_attributes),
+                                                                   file(table_name, storage, block_size),
+                                                                   overflow(nullptr) {
+}
+
+HeapTable::~HeapTable() {
+    delete this->overflow;
 }
 
 /**
@@ -44,6 +57,11 @@ void HeapTable::create_if_not_exists() {
  */
 void HeapTable::drop() {
     file.drop();
+    if (this->overflow == nullptr)
+        this->overflow = new HeapFile(this->table_name + ".overflow", this->file.get_storage(),
+                                      this->file.get_block_size());
+    if (this->overflow->exists())
+        this->overflow->drop();
 }
 
 /**
@@ -58,6 +76,25 @@ void HeapTable::open() {
  */
 void HeapTable::close() {
     file.close();
+    if (this->overflow != nullptr)
+        this->overflow->close();
+}
+
+/**
+ * Write out any rows still held in memory by the file.
+ */
+void HeapTable::sync() {
+    this->file.sync();
+    if (this->overflow != nullptr)
+        this->overflow->sync();
+}
+
+/**
+ * Number of blocks in the file (for the optimizer's estimates).
+ */
+uint32_t HeapTable::get_block_count() {
+    open();
+    return this->file.get_last_block_id();
 }
 
 /**
@@ -73,6 +110,34 @@ Handle HeapTable::insert(const ValueDict *row) {
     return handle;
 }
 
+/**
+ * Execute: INSERT INTO <table_name> (<row_keys>) VALUES (<row_values>), (<row_values>), ...
+ * All the rows are validated before any are added, so a bad row leaves the table untouched.
+ * The rows are then packed into the file's tail block one after another.
+ * @param rows dictionaries with column name keys
+ * @return the handles of the inserted rows, in order (freed by caller)
+ */
+Handles *HeapTable::insert_batch(const ValueDicts *rows) {
+    open();
+    ValueDicts full_rows;
+    full_rows.reserve(rows->size());
+    try {
+        for (auto const &row: *rows)
+            full_rows.push_back(validate(row));
+    } catch (DbRelationError &e) {
+        for (auto const &full_row: full_rows)
+            delete full_row;
+        throw;
+    }
+    Handles *handles = new Handles();
+    handles->reserve(full_rows.size());
+    for (auto const &full_row: full_rows) {
+        handles->push_back(append(full_row));
+        delete full_row;
+    }
+    return handles;
+}
+
 /**
  * Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
  * where handle is sufficient to identify one specific record (e.g., returned from an insert
@@ -95,9 +160,16 @@ void HeapTable::del(const Handle handle) {
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage *block = this->file.get(block_id);
-    block->del(record_id);
-    this->file.put(block);
+    try {
+        Dbt data;
+        if (block->view(record_id, data))
+            free_overflow(data);
+    } catch (...) {
+        delete block;
+        throw;
+    }
     delete block;
+    this->file.del(handle);
 }
 
 /**
@@ -114,21 +186,12 @@ Handles *HeapTable::select() {
  * @return list of handles of the selected rows
  */
 Handles *HeapTable::select(const ValueDict *where) {
-    open();
     Handles *handles = new Handles();
-    BlockIDs *block_ids = file.block_ids();
-    for (auto const &block_id: *block_ids) {
-        SlottedPage *block = file.get(block_id);
-        RecordIDs *record_ids = block->ids();
-        for (auto const &record_id: *record_ids) {
-            Handle handle(block_id, record_id);
-            if (selected(handle, where))
-                handles->push_back(handle);
-        }
-        delete record_ids;
-        delete block;
-    }
-    delete block_ids;
+    DbCursor *rows = cursor(where);
+    Handle handle;
+    while (rows->next(handle))
+        handles->push_back(handle);
+    delete rows;
     return handles;
 }
 
@@ -140,13 +203,65 @@ Handles *HeapTable::select(const ValueDict *where) {
  * @return                  list of handles of the selected rows
  */
 Handles *HeapTable::select(Handles *current_selection, const ValueDict *where) {
+    Predicate conjunction(where == nullptr ? ValueDict() : *where);
+    RecordPredicate predicate(this->column_names, this->column_attributes, &conjunction, this);
     Handles *handles = new Handles();
     for (auto const &handle: *current_selection)
-        if (selected(handle, where))
+        if (selected(handle, predicate))
             handles->push_back(handle);
     return handles;
 }
 
+/**
+ * Streaming version of select().
+ * @return cursor over all rows (freed by caller)
+ */
+DbCursor *HeapTable::cursor() {
+    open();
+    return new HeapTableCursor(*this, nullptr);
+}
+
+/**
+ * Streaming version of select(where).
+ * @param where predicates to match
+ * @return cursor over the selected rows (freed by caller)
+ */
+DbCursor *HeapTable::cursor(const ValueDict *where) {
+    Predicate conjunction(where == nullptr ? ValueDict() : *where);
+    return cursor(&conjunction);
+}
+
+/**
+ * Streaming version of select(current_selection, where).
+ * @param current_selection cursor of handles to filter (freed along with the returned cursor)
+ * @param where             predicates to match
+ * @return                  cursor over the selected rows (freed by caller)
+ */
+DbCursor *HeapTable::cursor(DbCursor *current_selection, const ValueDict *where) {
+    Predicate conjunction(where == nullptr ? ValueDict() : *where);
+    return cursor(current_selection, &conjunction);
+}
+
+/**
+ * Streaming select with any where clause.
+ * @param where predicate to match
+ * @return cursor over the selected rows (freed by caller)
+ */
+DbCursor *HeapTable::cursor(const Predicate *where) {
+    open();
+    return new HeapTableCursor(*this, where);
+}
+
+/**
+ * Streaming version of select(current_selection, where) with any where clause.
+ * @param current_selection cursor of handles to filter (freed along with the returned cursor)
+ * @param where             predicate to match
+ * @return                  cursor over the selected rows (freed by caller)
+ */
+DbCursor *HeapTable::cursor(DbCursor *current_selection, const Predicate *where) {
+    return new HeapTableCursor(*this, where, current_selection);
+}
+
 /**
  * Project all columns from a given row.
  * @param handle row to be projected
@@ -163,23 +278,118 @@ ValueDict *HeapTable::project(Handle handle) {
  * @return a sequence of values for handle given by column_names
  */
 ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
+    Tuple *tuple = project_tuple(handle, column_names);
+    ValueDict *row = tuple->to_dict(column_names->empty() ? this->column_names : *column_names);
+    delete tuple;
+    return row;
+}
+
+/**
+ * Project all columns from a given row into a tuple.
+ * @param handle row to be projected
+ * @return all values for handle in column order (freed by caller)
+ */
+Tuple *HeapTable::project_tuple(Handle handle) {
+    return project_tuple(handle, &this->column_names);
+}
+
+/**
+ * Project given columns from a given row into a tuple.
+ * @param handle row to be projected
+ * @param column_names of columns to be included in the result (all columns if empty)
+ * @return values for handle in the order of column_names (freed by caller)
+ */
+Tuple *HeapTable::project_tuple(Handle handle, const ColumnNames *column_names) {
+    ColumnPositions positions;
+    uint width = layout(column_names, positions);
+    return fetch(handle, positions, width);
+}
+
+/**
+ * Project given columns from each of a list of rows. Works out where the columns go just once for all the rows.
+ * @param handles rows to be projected
+ * @param column_names of columns to be included in the result (all columns if empty)
+ * @return values for each handle in the order of column_names (freed by caller)
+ */
+Tuples *HeapTable::project(Handles *handles, const ColumnNames *column_names) {
+    ColumnPositions positions;
+    uint width = layout(column_names, positions);
+    Tuples *ret = new Tuples();
+    ret->reserve(handles->size());
+    for (auto const &handle: *handles)
+        ret->push_back(fetch(handle, positions, width));
+    return ret;
+}
+
+/**
+ * Add the given columns of the next rows from a cursor to a batch. When the cursor is one of our own
+ * scans, the rows are decoded straight out of the blocks it is holding, so there's no fetching of
+ * each row's block again and no tuple per row.
+ * @param cursor        where to get the rows
+ * @param column_names  columns to project (all columns if empty)
+ * @param batch         where to put the values
+ * @param max_rows      most rows to add
+ * @return              number of rows added (zero once the cursor is exhausted)
+ */
+uint HeapTable::project_batch(DbCursor *cursor, const ColumnNames *column_names, RowBatch *batch, uint max_rows) {
+    ColumnPositions positions;
+    uint width = layout(column_names, positions);
+    HeapTableCursor *scan = dynamic_cast<HeapTableCursor *>(cursor);
+    if (scan != nullptr && scan->source == nullptr && &scan->table == this)
+        return scan->next_batch(positions, batch, max_rows);
+
+    uint n = 0;
+    Handle handle;
+    while (n < max_rows && cursor->next(handle)) {
+        Tuple *row = fetch(handle, positions, width);
+        batch->append(*row);
+        delete row;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Read a row and pull out the columns given by positions. The record is decoded in place
+ * within the block, so the only copying is of the projected values into the tuple.
+ * @param handle     row to read
+ * @param positions  from layout()
+ * @param width      from layout()
+ * @return           the projected tuple (freed by caller)
+ */
+Tuple *HeapTable::fetch(Handle handle, const ColumnPositions &positions, uint width) {
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage *block = file.get(block_id);
-    Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
-    delete data;
+    Dbt data;
+    if (!block->view(record_id, data)) {
+        delete block;
+        throw DbRelationError("row has been deleted");
+    }
+    Tuple *tuple = unmarshal(&data, positions, width);  // decodes straight out of the block
     delete block;
+    return tuple;
+}
+
+/**
+ * Figure out where each of the table's columns goes in a projection.
+ * @param column_names  columns to project (all columns if empty)
+ * @param positions     returned by reference: positions for each table column
+ * @return              width of the projected tuple
+ * @throws DbRelationError if a column isn't in the table
+ */
+uint HeapTable::layout(const ColumnNames *column_names, ColumnPositions &positions) const {
+    positions.assign(this->column_names.size(), std::vector<uint>());
     if (column_names->empty())
-        return row;
-    ValueDict *result = new ValueDict();
+        column_names = &this->column_names;
+    uint position = 0;
     for (auto const &column_name: *column_names) {
-        if (row->find(column_name) == row->end())
+        auto it = std::find(this->column_names.begin(), this->column_names.end(), column_name);
+        if (it == this->column_names.end())
             throw DbRelationError("table does not have column named '" + column_name + "'");
-        (*result)[column_name] = (*row)[column_name];
+        positions[it - this->column_names.begin()].push_back(position++);
     }
-    delete row;
-    return result;
+    return position;
 }
 
 /**
@@ -209,67 +419,259 @@ ValueDict *HeapTable::validate(const ValueDict *row) const {
  */
 Handle HeapTable::append(const ValueDict *row) {
     Dbt *data = marshal(row);
-    SlottedPage *block = this->file.get(this->file.get_last_block_id());
-    RecordID record_id;
+    Handle handle;
     try {
-        record_id = block->add(data);
-    } catch (DbBlockNoRoomError &e) {
-        // need a new block
-        delete block;
-        block = this->file.get_new();
-        record_id = block->add(data);
+        handle = this->file.append(data);
+    } catch (...) {
+        try {
+            free_overflow(*data);
+        } catch (...) {
+            // keep the original error
+        }
+        delete[] (char *) data->get_data();
+        delete data;
+        throw;
     }
-    this->file.put(block);
-    delete block;
     delete[] (char *) data->get_data();
     delete data;
-    return Handle(this->file.get_last_block_id(), record_id);
+    return handle;
 }
 
 /**
- * Figure out the bits to go into the file.
+ * Figure out the bits to go into the file, first writing out any TEXT values that are to be kept
+ * out of line: the ones longer than a quarter of a block, and then the longest of the rest until
+ * the row fits into a block.
  * The caller is responsible for freeing the returned Dbt and its enclosed ret->get_data().
  * @param row data for the tuple
  * @return bits of the record as it should appear on disk
  */
-Dbt *HeapTable::marshal(const ValueDict *row) const {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
+Dbt *HeapTable::marshal(const ValueDict *row) {
+    uint max_size = SlottedPage::max_record_size(this->file.get_block_size());
+    uint max_inline = this->file.get_block_size() / 4;
+    if (max_inline > MAX_INLINE_TEXT)
+        max_inline = MAX_INLINE_TEXT;
+
+    // work out the size of the row and which values go out of line
+    std::vector<const Value *> values;
+    std::vector<bool> out_of_line(this->column_names.size(), false);
+    uint size = 0;
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+        const Value &value = row->find(this->column_names[col_num])->second;
+        values.push_back(&value);
+        ColumnAttribute::DataType data_type = ColumnAttribute(this->column_attributes[col_num]).get_data_type();
+        if (data_type == ColumnAttribute::DataType::INT) {
+            size += sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            out_of_line[col_num] = value.s.length() > max_inline;
+            size += sizeof(u16);
+            if (out_of_line[col_num])
+                size += OVERFLOW_POINTER_SZ;
+            else
+                size += (uint) value.s.length();
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            size += sizeof(uint8_t);
+        } else {
+            throw DbRelationError("Only know how to marshal INT, TEXT, and BOOLEAN");
+        }
+    }
+    while (size > max_size) {
+        uint longest = UINT_MAX;
+        for (uint col_num = 0; col_num < values.size(); col_num++)
+            if (ColumnAttribute(this->column_attributes[col_num]).get_data_type() == ColumnAttribute::DataType::TEXT
+                && !out_of_line[col_num] && values[col_num]->s.length() > OVERFLOW_POINTER_SZ
+                && (longest == UINT_MAX || values[col_num]->s.length() > values[longest]->s.length()))
+                longest = col_num;
+        if (longest == UINT_MAX)
+            throw DbRelationError("row too big to marshal");
+        out_of_line[longest] = true;
+        size -= (uint) values[longest]->s.length() - OVERFLOW_POINTER_SZ;
+    }
+
+    char *bytes = new char[size];
     uint offset = 0;
-    uint col_num = 0;
-    for (auto const &column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
+    uint done = 0;  // bytes of the columns finished so far
+    try {
+        for (uint col_num = 0; col_num < values.size(); col_num++, done = offset) {
+            const Value &value = *values[col_num];
+            ColumnAttribute::DataType data_type = ColumnAttribute(this->column_attributes[col_num]).get_data_type();
+            if (data_type == ColumnAttribute::DataType::INT) {
+                *(int32_t *) (bytes + offset) = value.n;
+                offset += sizeof(int32_t);
+            } else if (data_type == ColumnAttribute::DataType::TEXT) {
+                if (out_of_line[col_num]) {
+                    *(u16 *) (bytes + offset) = OVERFLOW_MARK;
+                    offset += sizeof(u16);
+                    write_overflow(value.s, bytes + offset);
+                    offset += OVERFLOW_POINTER_SZ;
+                } else {
+                    u16 length = (u16) value.s.length();
+                    *(u16 *) (bytes + offset) = length;
+                    offset += sizeof(u16);
+                    memcpy(bytes + offset, value.s.c_str(), length); // assume ascii for now
+                    offset += length;
+                }
+            } else {
+                *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
+                offset += sizeof(uint8_t);
+            }
+        }
+    } catch (...) {
+        // free the values already written out of line
+        try {
+            free_overflow(Dbt(bytes, done));
+        } catch (...) {
+            // keep the original error
+        }
+        delete[] bytes;
+        throw;
+    }
+    return new Dbt(bytes, size);
+}
+
+/**
+ * Write a TEXT value out to the overflow file as a chain of pieces. The pieces are written last
+ * first so that each one can start with the handle of the one after it.
+ * @param value    the value
+ * @param pointer  where to put what goes after OVERFLOW_MARK in the row (OVERFLOW_POINTER_SZ bytes)
+ */
+void HeapTable::write_overflow(const std::string &value, char *pointer) {
+    HeapFile *overflow = overflow_file(true);
+    uint chunk = SlottedPage::max_record_size(overflow->get_block_size()) - OVERFLOW_LINK_SZ;
+    uint length = (uint) value.length();
+    BlockID next_block_id = 0;
+    RecordID next_record_id = 0;
+    char *bytes = new char[OVERFLOW_LINK_SZ + chunk];
+    try {
+        for (uint pieces = (length + chunk - 1) / chunk; pieces > 0; pieces--) {
+            uint start = (pieces - 1) * chunk;
+            uint size = std::min(chunk, length - start);
+            *(BlockID *) bytes = next_block_id;
+            *(RecordID *) (bytes + sizeof(BlockID)) = next_record_id;
+            memcpy(bytes + OVERFLOW_LINK_SZ, value.data() + start, size);
+            Dbt piece(bytes, OVERFLOW_LINK_SZ + size);
+            Handle handle = overflow->append(&piece);
+            next_block_id = handle.first;
+            next_record_id = handle.second;
+        }
+    } catch (...) {
+        delete[] bytes;
+        try {
+            free_overflow(next_block_id, next_record_id);  // the pieces written so far
+        } catch (...) {
+            // keep the original error
+        }
+        throw;
+    }
+    delete[] bytes;
+    *(uint32_t *) pointer = length;
+    *(BlockID *) (pointer + sizeof(uint32_t)) = next_block_id;
+    *(RecordID *) (pointer + sizeof(uint32_t) + sizeof(BlockID)) = next_record_id;
+}
 
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("row too big to marshal");
-            *(int32_t *) (bytes + offset) = value.n;
+/**
+ * Read a TEXT value that is kept out of line by following its chain of pieces in the overflow file.
+ * @param pointer  what follows OVERFLOW_MARK in the row
+ * @param value    returned by reference: the value
+ * @throws DbRelationError if its pieces can't all be found
+ */
+void HeapTable::read_overflow(const char *pointer, std::string &value) const {
+    HeapFile *overflow = overflow_file(false);
+    uint32_t length = *(uint32_t *) pointer;
+    BlockID block_id = *(BlockID *) (pointer + sizeof(uint32_t));
+    RecordID record_id = *(RecordID *) (pointer + sizeof(uint32_t) + sizeof(BlockID));
+    value.clear();
+    value.reserve(length);
+    while (block_id != 0) {
+        SlottedPage *block = overflow->get(block_id);
+        Dbt piece;
+        if (!block->view(record_id, piece) || piece.get_size() < OVERFLOW_LINK_SZ) {
+            delete block;
+            throw DbRelationError("broken overflow chain in " + this->table_name);
+        }
+        const char *bytes = (const char *) piece.get_data();
+        value.append(bytes + OVERFLOW_LINK_SZ, piece.get_size() - OVERFLOW_LINK_SZ);
+        block_id = *(BlockID *) bytes;
+        record_id = *(RecordID *) (bytes + sizeof(BlockID));
+        delete block;
+    }
+    if (value.length() != length)
+        throw DbRelationError("broken overflow chain in " + this->table_name);
+}
+
+/**
+ * Delete the overflow pieces of the out-of-line TEXT values of a row that is about to be deleted
+ * (or that couldn't be added after all).
+ * @param data  the row's bits (or just the first few columns of them)
+ */
+void HeapTable::free_overflow(const Dbt &data) {
+    const char *bytes = (const char *) data.get_data();
+    uint offset = 0;
+    for (uint col_num = 0; col_num < this->column_names.size() && offset < data.get_size(); col_num++) {
+        ColumnAttribute::DataType data_type = ColumnAttribute(this->column_attributes[col_num]).get_data_type();
+        if (data_type == ColumnAttribute::DataType::INT) {
             offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            u_long size = value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("row too big to marshal");
-            *(u16 *) (bytes + offset) = size;
-            offset += sizeof(u16);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("row too big to marshal");
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
             offset += sizeof(uint8_t);
         } else {
-            throw DbRelationError("Only know how to marshal INT, TEXT, and BOOLEAN");
+            u16 size = *(u16 *) (bytes + offset);
+            offset += sizeof(u16);
+            if (size != OVERFLOW_MARK) {
+                offset += size;
+                continue;
+            }
+            free_overflow(*(BlockID *) (bytes + offset + sizeof(uint32_t)),
+                          *(RecordID *) (bytes + offset + sizeof(uint32_t) + sizeof(BlockID)));
+            offset += OVERFLOW_POINTER_SZ;
         }
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+}
+
+/**
+ * Delete a chain of overflow pieces.
+ * @param block_id   where the first piece is (0 for none)
+ * @param record_id  where the first piece is
+ */
+void HeapTable::free_overflow(BlockID block_id, RecordID record_id) {
+    if (block_id == 0)
+        return;
+    HeapFile *overflow = overflow_file(false);
+    while (block_id != 0) {
+        SlottedPage *block = overflow->get(block_id);
+        Dbt piece;
+        BlockID next_block_id = 0;
+        RecordID next_record_id = 0;
+        bool found = block->view(record_id, piece) && piece.get_size() >= OVERFLOW_LINK_SZ;
+        if (found) {
+            next_block_id = *(BlockID *) piece.get_data();
+            next_record_id = *(RecordID *) ((char *) piece.get_data() + sizeof(BlockID));
+        }
+        delete block;
+        if (found)
+            overflow->del(Handle(block_id, record_id));
+        block_id = next_block_id;
+        record_id = next_record_id;
+    }
+}
+
+/**
+ * Get the overflow file, opening it (or creating it) if it isn't open yet.
+ * @param create  whether to create the file if there isn't one yet
+ * @return        the open overflow file
+ * @throws DbRelationError if there isn't one and create is false
+ */
+HeapFile *HeapTable::overflow_file(bool create) const {
+    if (this->overflow == nullptr)
+        this->overflow = new HeapFile(this->table_name + ".overflow", this->file.get_storage(),
+                                      this->file.get_block_size());
+    if (!this->overflow->is_open()) {
+        if (this->overflow->exists())
+            this->overflow->open();
+        else if (create)
+            this->overflow->create();
+        else
+            throw DbRelationError("no overflow file for " + this->table_name);
+    }
+    return this->overflow;
 }
 
 /**
@@ -278,51 +680,350 @@ Dbt *HeapTable::marshal(const ValueDict *row) const {
  * @return row data for the tuple
  */
 ValueDict *HeapTable::unmarshal(Dbt *data) const {
-    ValueDict *row = new ValueDict();
-    Value value;
+    ColumnPositions positions;
+    uint width = layout(&this->column_names, positions);
+    Tuple *tuple = unmarshal(data, positions, width);
+    ValueDict *row = tuple->to_dict(this->column_names);
+    delete tuple;
+    return row;
+}
+
+/**
+ * Decode just the projected columns from the given bits gotten from the file.
+ * Works fine on a view into a block. TEXT values are copied directly into the tuple.
+ * Stops reading once the last projected column has been decoded.
+ * @param data       file data for the tuple
+ * @param positions  where each column goes in the result, from layout()
+ * @param width      number of columns in the result
+ * @return           the projected tuple (freed by caller)
+ */
+Tuple *HeapTable::unmarshal(Dbt *data, const ColumnPositions &positions, uint width) const {
+    Tuple *tuple = new Tuple();
+    tuple->resize(width);
     char *bytes = (char *) data->get_data();
     uint offset = 0;
-    uint col_num = 0;
-    for (auto const &column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        value.data_type = ca.get_data_type();
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
+    uint remaining = width;
+    for (uint col_num = 0; remaining > 0 && col_num < this->column_names.size(); col_num++) {
+        ColumnAttribute ca = this->column_attributes[col_num];
+        ColumnAttribute::DataType data_type = ca.get_data_type();
+        const std::vector<uint> &to = positions[col_num];
+        if (offset >= data->get_size()) {
+            // written before this column was added to the end of the (schema) table: zero or empty
+            for (auto const &i: to)
+                if (data_type == ColumnAttribute::DataType::TEXT)
+                    tuple->set_s(i, bytes, 0);
+                else
+                    tuple->set_n(i, data_type, 0);
+        } else if (data_type == ColumnAttribute::DataType::INT) {
+            int32_t n = *(int32_t *) (bytes + offset);
+            for (auto const &i: to)
+                tuple->set_n(i, data_type, n);
             offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
             u16 size = *(u16 *) (bytes + offset);
             offset += sizeof(u16);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
+            if (size == OVERFLOW_MARK) {
+                if (!to.empty()) {
+                    std::string value;
+                    try {
+                        read_overflow(bytes + offset, value);
+                    } catch (...) {
+                        delete tuple;
+                        throw;
+                    }
+                    for (auto const &i: to)
+                        tuple->set_s(i, value.data(), (uint) value.size());
+                }
+                offset += OVERFLOW_POINTER_SZ;
+            } else {
+                for (auto const &i: to)
+                    tuple->set_s(i, bytes + offset, size);  // assume ascii for now
+                offset += size;
+            }
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            int32_t n = *(uint8_t *) (bytes + offset);
+            for (auto const &i: to)
+                tuple->set_n(i, data_type, n);
             offset += sizeof(uint8_t);
         } else {
+            delete tuple;
             throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
         }
-        (*row)[column_name] = value;
+        remaining -= (uint) to.size();
     }
-    return row;
+    return tuple;
+}
+
+/**
+ * Decode just the projected columns from the given bits gotten from the file, adding them to
+ * a batch as a new row.
+ * @param data       file data for the tuple
+ * @param positions  which batch columns each table column goes to, from layout()
+ * @param batch      where to put the row
+ */
+void HeapTable::unmarshal(Dbt *data, const ColumnPositions &positions, RowBatch *batch) const {
+    char *bytes = (char *) data->get_data();
+    uint offset = 0;
+    uint remaining = batch->width();
+    for (uint col_num = 0; remaining > 0 && col_num < this->column_names.size(); col_num++) {
+        ColumnAttribute ca = this->column_attributes[col_num];
+        ColumnAttribute::DataType data_type = ca.get_data_type();
+        const std::vector<uint> &to = positions[col_num];
+        if (offset >= data->get_size()) {
+            // written before this column was added to the end of the (schema) table: zero or empty
+            for (auto const &j: to)
+                if (data_type == ColumnAttribute::DataType::TEXT)
+                    batch->append_s(j, bytes, 0);
+                else
+                    batch->append_n(j, data_type, 0);
+        } else if (data_type == ColumnAttribute::DataType::INT) {
+            int32_t n = *(int32_t *) (bytes + offset);
+            for (auto const &j: to)
+                batch->append_n(j, data_type, n);
+            offset += sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            u16 size = *(u16 *) (bytes + offset);
+            offset += sizeof(u16);
+            if (size == OVERFLOW_MARK) {
+                if (!to.empty()) {
+                    std::string value;
+                    read_overflow(bytes + offset, value);
+                    for (auto const &j: to)
+                        batch->append_s(j, value.data(), (uint) value.size());
+                }
+                offset += OVERFLOW_POINTER_SZ;
+            } else {
+                for (auto const &j: to)
+                    batch->append_s(j, bytes + offset, size);
+                offset += size;
+            }
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            int32_t n = *(uint8_t *) (bytes + offset);
+            for (auto const &j: to)
+                batch->append_n(j, data_type, n);
+            offset += sizeof(uint8_t);
+        } else {
+            throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+        }
+        remaining -= (uint) to.size();
+    }
+    batch->end_row();
 }
 
 /**
  * See if the row at the given handle satisfies the given where clause
- * @param handle  row to check
- * @param where   conditions to check
- * @return        true if conditions met, false otherwise
+ * @param handle     row to check
+ * @param predicate  conditions to check
+ * @return           true if conditions met, false otherwise (including if the row has been deleted)
  */
-bool HeapTable::selected(Handle handle, const ValueDict *where) {
-    if (where == nullptr)
+bool HeapTable::selected(Handle handle, const RecordPredicate &predicate) {
+    if (predicate.empty())
         return true;
-    ValueDict *row = this->project(handle, where);
-    bool is_selected = *row == *where;
-    delete row;
+    SlottedPage *block = this->file.get(handle.first);
+    Dbt data;
+    bool is_selected = block->view(handle.second, data) && predicate.matches(&data);
+    delete block;
     return is_selected;
 }
 
+/**
+ * Compile a where clause.
+ * @param column_names       the table's columns
+ * @param column_attributes  the table's column types
+ * @param where              conditions to check, or nullptr for none
+ * @param table              where to read out-of-line TEXT values from
+ * @throws DbRelationError if a column isn't in the table
+ */
+RecordPredicate::RecordPredicate(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                                 const Predicate *where, const HeapTable *table)
+        : data_types(), offsets(), first_text(0), predicate(where, column_names), found(), table(table) {
+    int offset = 0;
+    for (auto const &ca: column_attributes) {
+        ColumnAttribute::DataType data_type = ColumnAttribute(ca).get_data_type();
+        this->data_types.push_back(data_type);
+        this->offsets.push_back(offset);
+        if (offset >= 0)
+            this->first_text = (uint) this->offsets.size() - 1;
+        if (data_type == ColumnAttribute::INT)
+            offset += offset >= 0 ? sizeof(int32_t) : 0;
+        else if (data_type == ColumnAttribute::BOOLEAN)
+            offset += offset >= 0 ? sizeof(uint8_t) : 0;
+        else
+            offset = -1;
+    }
+    this->found.resize(this->data_types.size());
+}
+
+/**
+ * @class RecordView - a marshaled record, as CompiledPredicate::matches wants to see it
+ *
+ * Columns past the end of a record written before they were added to the table read as zero or
+ * empty, the same as in HeapTable::unmarshal.
+ */
+class RecordView {
+public:
+    RecordView(const RecordPredicate &predicate, const char *bytes, uint size)
+            : predicate(predicate), bytes(bytes), size(size), known(predicate.first_text), text(),
+              text_column(UINT_MAX) {
+        if (known < predicate.found.size())
+            predicate.found[known] = (uint) predicate.offsets[known];
+    }
+
+    ColumnAttribute::DataType get_data_type(uint j) const { return predicate.data_types[j]; }
+
+    int32_t get_n(uint j) const {
+        if (offset(j) >= size)
+            return 0;
+        if (predicate.data_types[j] == ColumnAttribute::BOOLEAN)
+            return *(uint8_t *) (bytes + offset(j));
+        return *(int32_t *) (bytes + offset(j));
+    }
+
+    const char *get_text(uint j) const {
+        if (offset(j) >= size)
+            return bytes;
+        if (is_out_of_line(j))
+            return read_text(j).data();
+        return bytes + offset(j) + sizeof(u16);
+    }
+
+    uint get_length(uint j) const {
+        if (offset(j) >= size)
+            return 0;
+        if (is_out_of_line(j))
+            return (uint) read_text(j).size();
+        return *(u16 *) (bytes + offset(j));
+    }
+
+protected:
+    const RecordPredicate &predicate;
+    const char *bytes;
+    uint size;
+    mutable uint known;  // offsets of the columns up to this one are in predicate.found
+    mutable std::string text;  // the last out-of-line value read
+    mutable uint text_column;
+
+    bool is_out_of_line(uint j) const { return *(u16 *) (bytes + offset(j)) == HeapTable::OVERFLOW_MARK; }
+
+    const std::string &read_text(uint j) const {
+        if (text_column != j) {
+            if (predicate.table == nullptr)
+                throw DbRelationError("no table to read an out-of-line value from");
+            predicate.table->read_overflow(bytes + offset(j) + sizeof(u16), text);
+            text_column = j;
+        }
+        return text;
+    }
+
+    uint offset(uint j) const {
+        if (predicate.offsets[j] >= 0)
+            return (uint) predicate.offsets[j];
+        std::vector<uint> &found = predicate.found;
+        for (; known < j; known++)
+            if (found[known] >= size)
+                found[known + 1] = found[known];  // past the end of a short record
+            else if (predicate.data_types[known] == ColumnAttribute::INT)
+                found[known + 1] = found[known] + sizeof(int32_t);
+            else if (predicate.data_types[known] == ColumnAttribute::BOOLEAN)
+                found[known + 1] = found[known] + sizeof(uint8_t);
+            else if (*(u16 *) (bytes + found[known]) == HeapTable::OVERFLOW_MARK)
+                found[known + 1] = found[known] + sizeof(u16) + HeapTable::OVERFLOW_POINTER_SZ;
+            else
+                found[known + 1] = found[known] + sizeof(u16) + *(u16 *) (bytes + found[known]);
+        return found[j];
+    }
+};
+
+bool RecordPredicate::matches(const Dbt *data) const {
+    return this->predicate.matches(RecordView(*this, (const char *) data->get_data(), data->get_size()));
+}
+
+/**
+ * Constructor
+ * @param table   relation to scan (must be open)
+ * @param where   predicate to match (copied), or nullptr for all rows
+ * @param source  if given, filter these handles instead of scanning the file (freed by the cursor)
+ */
+HeapTableCursor::HeapTableCursor(HeapTable &table, const Predicate *where, DbCursor *source)
+        : table(table), predicate(table.column_names, table.column_attributes, where, &table), source(source),
+          scan(nullptr), block(nullptr), record_ids(nullptr), i(0) {
+    if (source == nullptr)
+        this->scan = new HeapFileScan(table.file);
+}
+
+HeapTableCursor::~HeapTableCursor() {
+    delete this->source;
+    delete this->record_ids;
+    delete this->scan;
+}
+
+/**
+ * Get the next row satisfying the where clause.
+ * @param handle  set to the next qualifying row
+ * @return        false if there are no more
+ */
+bool HeapTableCursor::next(Handle &handle) {
+    if (this->source != nullptr) {
+        while (this->source->next(handle))
+            if (this->table.selected(handle, this->predicate))
+                return true;
+        return false;
+    }
+    while (true) {
+        while (this->record_ids == nullptr || this->i >= this->record_ids->size())
+            if (!next_block())
+                return false;
+        RecordID record_id = (*this->record_ids)[this->i++];
+        Dbt data;
+        this->block->view(record_id, data);
+        if (this->predicate.matches(&data)) {
+            handle = Handle(this->block->get_block_id(), record_id);
+            return true;
+        }
+    }
+}
+
+/**
+ * Decode the given columns of the next qualifying rows into a batch, working through each block
+ * while we have it in hand.
+ * @param positions  which batch columns each table column goes to, from HeapTable::layout()
+ * @param batch      where to put the values
+ * @param max_rows   most rows to add
+ * @return           number of rows added (zero once the file is exhausted)
+ */
+uint HeapTableCursor::next_batch(const ColumnPositions &positions, RowBatch *batch, uint max_rows) {
+    uint n = 0;
+    while (n < max_rows) {
+        while (this->record_ids == nullptr || this->i >= this->record_ids->size())
+            if (!next_block())
+                return n;
+        RecordID record_id = (*this->record_ids)[this->i++];
+        Dbt data;
+        this->block->view(record_id, data);
+        if (this->predicate.matches(&data)) {
+            this->table.unmarshal(&data, positions, batch);
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * Move on to the next block in the file. The block is a view into the scan's bulk buffer,
+ * which belongs to us, so other reads from the file by the caller in between calls to next()
+ * don't disturb it.
+ * @return  false if we've run off the end of the file
+ */
+bool HeapTableCursor::next_block() {
+    this->block = this->scan->next();
+    if (this->block == nullptr)
+        return false;
+    delete this->record_ids;
+    this->record_ids = this->block->ids();
+    this->i = 0;
+    return true;
+}
+
 /**
  * Test helper. Sets the row's a and b values.
  * @param row to set
@@ -421,6 +1122,28 @@ bool test_heap_storage() {
     cout << "many inserts/select/projects ok" << endl;
     delete handles;
 
+    ValueDict where;
+    where["a"] = Value(500);
+    DbCursor *cursor = table.cursor(&where);
+    Handle handle;
+    if (!cursor->next(handle) || !test_compare(table, handle, 500, b) || cursor->next(handle))
+        return false;
+    delete cursor;
+    Value even(1);
+    even.data_type = ColumnAttribute::BOOLEAN;
+    where["c"] = even;  // after the TEXT column, so found by skipping over b
+    cursor = table.cursor(&where);
+    if (!cursor->next(handle) || !test_compare(table, handle, 500, b) || cursor->next(handle))
+        return false;
+    delete cursor;
+    even.n = 0;
+    where["c"] = even;
+    cursor = table.cursor(&where);
+    if (cursor->next(handle))
+        return false;
+    delete cursor;
+    cout << "cursor ok" << endl;
+
     table.del(last_handle);
     handles = table.select();
     if (handles->size() != 1000)
@@ -433,6 +1156,203 @@ bool test_heap_storage() {
     cout << "del ok" << endl;
     table.drop();
     delete handles;
+
+    HeapTable *pages = new HeapTable("_test_pages_cpp", column_names, column_attributes, HeapFile::PAGE_FILE);
+    pages->create();
+    for (int i = 0; i < 1000; i++) {
+        test_set_row(row, i, b);
+        last_handle = pages->insert(&row);
+    }
+    pages->del(last_handle);
+    pages->close();
+    delete pages;
+    pages = new HeapTable("_test_pages_cpp", column_names, column_attributes);  // finds the page file
+    handles = pages->select();
+    bool ok = handles->size() == 999;
+    i = 0;
+    for (auto const &handle: *handles)
+        ok = ok && test_compare(*pages, handle, i++, b);
+    delete handles;
+    pages->drop();
+    delete pages;
+    if (!ok)
+        return false;
+    cout << "page file ok" << endl;
+
+    // rows written before columns were added at the end read those columns as zero or empty
+    HeapTable *narrow = new HeapTable("_test_short_cpp", column_names, column_attributes);
+    narrow->create();
+    for (int i = 0; i < 10; i++) {
+        test_set_row(row, i, b);
+        narrow->insert(&row);
+    }
+    narrow->close();
+    delete narrow;
+    ColumnNames wide_names = column_names;
+    ColumnAttributes wide_attributes = column_attributes;
+    wide_names.push_back("d");
+    wide_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    wide_names.push_back("e");
+    wide_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable *wide = new HeapTable("_test_short_cpp", wide_names, wide_attributes);
+    where.clear();
+    where["d"] = Value(string());
+    where["e"] = Value(0);
+    cursor = wide->cursor(&where);
+    i = 0;
+    while (cursor->next(handle))
+        i++;
+    delete cursor;
+    ok = i == 10;
+    where["e"] = Value(1);
+    cursor = wide->cursor(&where);
+    ok = ok && !cursor->next(handle);
+    delete cursor;
+    wide->drop();
+    delete wide;
+    if (!ok)
+        return false;
+    cout << "short records ok" << endl;
+
+    // bigger pages hold rows that don't fit in a 4kB block, in either kind of file
+    string long_b(10000, 'b');
+    uint block_sizes[] = {64 * 1024, 128 * 1024};
+    for (auto const &block_size: block_sizes) {
+        HeapFile::Storage storage = block_size > 64 * 1024 ? HeapFile::PAGE_FILE : HeapFile::BERKELEY_DB;
+        HeapTable *big = new HeapTable("_test_big_cpp", column_names, column_attributes, storage, block_size);
+        big->create();
+        for (int i = 0; i < 100; i++) {
+            test_set_row(row, i, long_b);
+            big->insert(&row);
+        }
+        big->close();
+        delete big;
+        big = new HeapTable("_test_big_cpp", column_names, column_attributes, storage, block_size);
+        handles = big->select();
+        ok = handles->size() == 100;
+        i = 0;
+        for (auto const &handle: *handles)
+            ok = ok && test_compare(*big, handle, i++, long_b);
+        delete handles;
+        big->drop();
+        delete big;
+        if (!ok)
+            return false;
+    }
+    cout << "big pages ok" << endl;
+
+    // TEXT values that don't fit in a block go out of line, in either kind of file
+    HeapFile::Storage storages[] = {HeapFile::BERKELEY_DB, HeapFile::PAGE_FILE};
+    for (auto const &storage: storages) {
+        HeapTable *long_text = new HeapTable("_test_overflow_cpp", column_names, column_attributes, storage);
+        long_text->create();
+        for (int i = 0; i < 20; i++) {
+            test_set_row(row, i, i == 10 ? b : string(200000 + i, (char) ('a' + i)));
+            last_handle = long_text->insert(&row);
+        }
+        long_text->close();
+        delete long_text;
+        long_text = new HeapTable("_test_overflow_cpp", column_names, column_attributes, storage);
+        handles = long_text->select();
+        ok = handles->size() == 20;
+        i = 0;
+        for (auto const &handle: *handles) {
+            ok = ok && test_compare(*long_text, handle, i, i == 10 ? b : string(200000 + i, (char) ('a' + i)));
+            i++;
+        }
+        ColumnNames just_a;
+        just_a.push_back("a");
+        ValueDict *projected = long_text->project((*handles)[3], &just_a);
+        ok = ok && projected->size() == 1 && (*projected)["a"].n == 3;
+        delete projected;
+        delete handles;
+        where.clear();
+        where["b"] = Value(string(200007, 'h'));
+        where["c"] = Value(0);
+        where["c"].data_type = ColumnAttribute::BOOLEAN;
+        cursor = long_text->cursor(&where);
+        ok = ok && cursor->next(handle) && test_compare(*long_text, handle, 7, string(200007, 'h'))
+             && !cursor->next(handle);
+        delete cursor;
+        long_text->del(last_handle);
+        handles = long_text->select();
+        ok = ok && handles->size() == 19 && test_compare(*long_text, (*handles)[18], 18, string(200018, 's'));
+        delete handles;
+        long_text->drop();
+        delete long_text;
+        if (!ok)
+            return false;
+    }
+    // the longest value going out of line first mustn't stop the shorter ones from following it
+    ColumnNames text_names;
+    ColumnAttributes text_attributes;
+    ValueDict text_row;
+    for (int j = 0; j < 6; j++) {
+        text_names.push_back("t" + to_string(j));
+        text_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+        text_row[text_names.back()] = Value(string(j == 0 ? 5000 : 1000, (char) ('a' + j)));
+    }
+    HeapTable *texts = new HeapTable("_test_overflow_first_cpp", text_names, text_attributes);
+    texts->create();
+    handle = texts->insert(&text_row);
+    ValueDict *result = texts->project(handle);
+    ok = *result == text_row;
+    delete result;
+    texts->drop();
+    delete texts;
+    if (!ok)
+        return false;
+    cout << "overflow ok" << endl;
+
+    // room left by deletes gets used again, even after the table is closed and reopened
+    HeapTable *reuse = new HeapTable("_test_free_space_cpp", column_names, column_attributes);
+    reuse->create();
+    handles = new Handles();
+    for (int i = 0; i < 1000; i++) {
+        test_set_row(row, i, b);
+        handles->push_back(reuse->insert(&row));
+    }
+    uint32_t block_count = reuse->get_block_count();
+    for (uint i = 0; i < handles->size(); i += 2)
+        reuse->del((*handles)[i]);
+    delete handles;
+    reuse->close();
+    delete reuse;
+    reuse = new HeapTable("_test_free_space_cpp", column_names, column_attributes);
+    for (int i = 0; i < 500; i++) {
+        test_set_row(row, i, b);
+        reuse->insert(&row);
+    }
+    ok = reuse->get_block_count() == block_count;
+    handles = reuse->select();
+    ok = ok && handles->size() == 1000;
+    delete handles;
+    reuse->drop();
+    delete reuse;
+    if (!ok)
+        return false;
+    cout << "free space ok" << endl;
+
+    // rows too big for a block spill and come back whole
+    SpillFile *spill = new SpillFile();
+    RowBatch rows(2);
+    for (int i = 0; i < 3; i++) {
+        string text = i == 1 ? string(100000, 'x') : b;
+        rows.append_n(0, ColumnAttribute::INT, i);
+        rows.append_s(1, text.data(), (uint) text.size());
+        rows.end_row();
+        spill->append(rows, i);
+    }
+    RowBatch *spilled = spill->next_batch();
+    ok = spilled != nullptr && spilled->size() == 3;
+    for (uint r = 0; ok && r < 3; r++)
+        ok = spilled->get_ns(0)[r] == (int) r && spilled->get(1, r).s == (r == 1 ? string(100000, 'x') : b);
+    delete spilled;
+    ok = ok && spill->next_batch() == nullptr;
+    delete spill;
+    if (!ok)
+        return false;
+    cout << "spill file ok" << endl;
     return true;
 }
 
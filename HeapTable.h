@@ -11,15 +11,85 @@
 #include "SlottedPage.h"
 #include "HeapFile.h"
 
+/**
+ * For each column of a table (in schema order), which positions it occupies in a projected tuple
+ * (usually none or one).
+ */
+typedef std::vector<std::vector<uint> > ColumnPositions;
+
+class HeapTable;
+
+/**
+ * @class RecordPredicate - where clause compiled against a table's record layout
+ *
+ * Checks the conditions right on the marshaled bytes of a record, so rows that don't qualify
+ * (which is usually most of them) never get unmarshaled. A column's offset is worked out ahead of
+ * time when all the columns before it are fixed width; otherwise we skip forward over the TEXT
+ * lengths before it the first time a condition looks at it, and remember it for the rest of the
+ * record. The operands of an AND are checked in column order and we stop at the first that fails.
+ */
+class RecordPredicate {
+public:
+    RecordPredicate(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                    const Predicate *where, const HeapTable *table = nullptr);
+
+    virtual ~RecordPredicate() {}
+
+    /**
+     * @return  true if there are no conditions
+     */
+    bool empty() const { return predicate.empty(); }
+
+    /**
+     * Check the conditions against a record.
+     * @param data  the record's bits (typically a view into a block)
+     * @return      true if the record satisfies the where clause
+     */
+    bool matches(const Dbt *data) const;
+
+protected:
+    std::vector<ColumnAttribute::DataType> data_types;  // of each table column
+    std::vector<int> offsets;  // fixed offset of each column within the record, or -1 if it depends on a TEXT before it
+    uint first_text;  // column number of the first TEXT column (the last one with a fixed offset)
+    CompiledPredicate predicate;
+    mutable std::vector<uint> found;  // offsets worked out so far for the record being checked
+    const HeapTable *table;  // to read TEXT values kept out of line
+
+    friend class RecordView;
+};
+
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
+ *
+ * A TEXT value longer than a quarter of a block (or than MAX_INLINE_TEXT) is kept out of line, and so
+ * are the longest of the rest if the row still doesn't fit in a block. Such a value is split into
+ * pieces that go into a side HeapFile (name.overflow), each piece starting with the handle of the
+ * next, and the row just has OVERFLOW_MARK for the length followed by the value's length and the
+ * handle of its first piece. Scans and projections that don't look at the column never read the
+ * pieces. The side file is created the first time it is needed.
  */
 
 class HeapTable : public DbRelation {
 public:
-    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
+    /**
+     * TEXT length in a row that means the value is kept out of line
+     */
+    static const u_int16_t OVERFLOW_MARK = UINT16_MAX;
+
+    /**
+     * Longest TEXT value kept in the row
+     */
+    static const uint MAX_INLINE_TEXT = UINT16_MAX - 1;
+
+    /**
+     * Bytes after OVERFLOW_MARK in the row: the value's length and the handle of its first piece
+     */
+    static const uint OVERFLOW_POINTER_SZ = sizeof(uint32_t) + sizeof(BlockID) + sizeof(RecordID);
+
+    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+              HeapFile::Storage storage = HeapFile::BERKELEY_DB, uint block_size = DbBlock::BLOCK_SZ);
 
-    virtual ~HeapTable() {}
+    virtual ~HeapTable();
 
     HeapTable(const HeapTable &other) = delete;
 
@@ -39,8 +109,14 @@ public:
 
     virtual void close();
 
+    virtual void sync();
+
+    virtual uint32_t get_block_count();
+
     virtual Handle insert(const ValueDict *row);
 
+    virtual Handles *insert_batch(const ValueDicts *rows);
+
     virtual void update(const Handle handle, const ValueDict *new_values);
 
     virtual void del(const Handle handle);
@@ -51,24 +127,109 @@ public:
 
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
 
+    virtual DbCursor *cursor();
+
+    virtual DbCursor *cursor(const ValueDict *where);
+
+    virtual DbCursor *cursor(DbCursor *current_selection, const ValueDict *where);
+
+    virtual DbCursor *cursor(const Predicate *where);
+
+    virtual DbCursor *cursor(DbCursor *current_selection, const Predicate *where);
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
+    virtual Tuple *project_tuple(Handle handle);
+
+    virtual Tuple *project_tuple(Handle handle, const ColumnNames *column_names);
+
+    virtual Tuples *project(Handles *handles, const ColumnNames *column_names);
+
+    virtual uint project_batch(DbCursor *cursor, const ColumnNames *column_names, RowBatch *batch, uint max_rows);
+
     using DbRelation::project;
 
+    /**
+     * Read a TEXT value that is kept out of line.
+     * @param pointer  what follows OVERFLOW_MARK in the row
+     * @param value    returned by reference: the value
+     * @throws DbRelationError if its pieces can't all be found
+     */
+    virtual void read_overflow(const char *pointer, std::string &value) const;
+
 protected:
+    static const uint OVERFLOW_LINK_SZ = sizeof(BlockID) + sizeof(RecordID);  // at the front of each piece
     HeapFile file;
+    mutable HeapFile *overflow;  // side file for values kept out of line, nullptr until needed
 
     virtual ValueDict *validate(const ValueDict *row) const;
 
     virtual Handle append(const ValueDict *row);
 
-    virtual Dbt *marshal(const ValueDict *row) const;
+    virtual Dbt *marshal(const ValueDict *row);
+
+    virtual void write_overflow(const std::string &value, char *pointer);
+
+    virtual void free_overflow(const Dbt &data);
+
+    virtual void free_overflow(BlockID block_id, RecordID record_id);
+
+    virtual HeapFile *overflow_file(bool create) const;
 
     virtual ValueDict *unmarshal(Dbt *data) const;
 
-    virtual bool selected(Handle handle, const ValueDict *where);
+    virtual Tuple *unmarshal(Dbt *data, const ColumnPositions &positions, uint width) const;
+
+    virtual void unmarshal(Dbt *data, const ColumnPositions &positions, RowBatch *batch) const;
+
+    virtual uint layout(const ColumnNames *column_names, ColumnPositions &positions) const;
+
+    virtual Tuple *fetch(Handle handle, const ColumnPositions &positions, uint width);
+
+    virtual bool selected(Handle handle, const RecordPredicate &predicate);
+
+    friend class HeapTableCursor;
+};
+
+/**
+ * @class HeapTableCursor - streaming scan of a HeapTable (implementation of DbCursor)
+ *
+ * Walks the HeapFile with a bulk HeapFileScan, checking the compiled where clause directly against
+ * the marshaled records in each block view, so memory use is bounded by the scan buffer no matter how big the
+ * table is. If given a source cursor, filters that cursor's handles instead of scanning the file.
+ */
+class HeapTableCursor : public DbCursor {
+public:
+    HeapTableCursor(HeapTable &table, const Predicate *where, DbCursor *source = nullptr);
+
+    virtual ~HeapTableCursor();
+
+    HeapTableCursor(const HeapTableCursor &other) = delete;
+
+    HeapTableCursor(HeapTableCursor &&temp) = delete;
+
+    HeapTableCursor &operator=(const HeapTableCursor &other) = delete;
+
+    HeapTableCursor &operator=(HeapTableCursor &&temp) = delete;
+
+    virtual bool next(Handle &handle);
+
+    virtual uint next_batch(const ColumnPositions &positions, RowBatch *batch, uint max_rows);
+
+protected:
+    HeapTable &table;
+    RecordPredicate predicate;
+    DbCursor *source;
+    HeapFileScan *scan;
+    SlottedPage *block;
+    RecordIDs *record_ids;
+    RecordIDs::size_type i;
+
+    bool next_block();
+
+    friend class HeapTable;
 };
 
 bool test_heap_storage();
@@ -0,0 +1,109 @@
+/**
+ * @file PageFile.cpp - implementation of PageFile
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "PageFile.h"
+
+using namespace std;
+
+PageFile::PageFile(string path, uint block_size) : path(path), block_size(block_size), fd(-1), block_count(0) {
+}
+
+PageFile::~PageFile() {
+    close();
+}
+
+bool PageFile::exists(const string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+void PageFile::create() {
+    close();
+    this->fd = ::open(this->path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (this->fd < 0)
+        fail("create");
+    this->block_count = 0;
+}
+
+void PageFile::open() {
+    if (this->fd >= 0)
+        return;
+    this->fd = ::open(this->path.c_str(), O_RDWR);
+    if (this->fd < 0)
+        fail("open");
+    struct stat st;
+    if (fstat(this->fd, &st) < 0)
+        fail("stat");
+    this->block_count = (uint32_t) (st.st_size / this->block_size);
+}
+
+void PageFile::close() {
+    if (this->fd < 0)
+        return;
+    ::close(this->fd);
+    this->fd = -1;
+}
+
+void PageFile::remove() {
+    close();
+    unlink(this->path.c_str());
+}
+
+void PageFile::read(BlockID block_id, char *bits) const {
+    if (block_id == 0 || block_id > this->block_count)
+        throw DbRelationError("no block " + to_string(block_id) + " in " + this->path);
+    off_t offset = (off_t) (block_id - 1) * this->block_size;
+    size_t done = 0;
+    while (done < this->block_size) {
+        ssize_t n = pread(this->fd, bits + done, this->block_size - done, offset + (off_t) done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            fail("read");
+        done += (size_t) n;
+    }
+}
+
+void PageFile::write(BlockID block_id, const char *bits) {
+    off_t offset = (off_t) (block_id - 1) * this->block_size;
+    size_t done = 0;
+    while (done < this->block_size) {
+        ssize_t n = pwrite(this->fd, bits + done, this->block_size - done, offset + (off_t) done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            fail("write");
+        done += (size_t) n;
+    }
+    if (block_id > this->block_count)
+        this->block_count = block_id;
+}
+
+const char *PageFile::map(uint32_t &block_count) const {
+    block_count = this->block_count;
+    if (block_count == 0)
+        return nullptr;
+    size_t length = (size_t) block_count * this->block_size;
+    void *bits = mmap(nullptr, length, PROT_READ, MAP_SHARED, this->fd, 0);
+    if (bits == MAP_FAILED)
+        fail("map");
+    madvise(bits, length, MADV_SEQUENTIAL);
+    return (const char *) bits;
+}
+
+void PageFile::unmap(const char *bits, uint32_t block_count, uint block_size) {
+    if (bits != nullptr)
+        munmap((void *) bits, (size_t) block_count * block_size);
+}
+
+// Throw a DbRelationError for a failed system call.
+void PageFile::fail(const string &what) const {
+    throw DbRelationError("cannot " + what + " " + this->path + ": " + strerror(errno));
+}
@@ -0,0 +1,107 @@
+/**
+ * @file PageFile.h - PageFile: fixed-size blocks in a plain operating system file
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "storage_engine.h"
+
+
+/**
+ * @class PageFile - the blocks of a HeapFile kept in a plain file instead of a Berkeley DB RecNo file
+ *
+ * Block n (counting from 1) is the block_size bytes at offset (n - 1) * block_size, in the same
+ * SlottedPage format as ever. The file doesn't record its block size; the owner has to know it. Single blocks are read and written with pread and pwrite
+ * (straight into and out of buffer pool frames), and a sequential scan maps the whole file with
+ * mmap and looks at the blocks right where they sit in the operating system's page cache.
+ */
+class PageFile {
+public:
+    /**
+     * @param path        the file's path
+     * @param block_size  size of its blocks
+     */
+    explicit PageFile(std::string path, uint block_size = DbBlock::BLOCK_SZ);
+
+    virtual ~PageFile();
+
+    PageFile(const PageFile &other) = delete;
+
+    PageFile(PageFile &&temp) = delete;
+
+    PageFile &operator=(const PageFile &other) = delete;
+
+    PageFile &operator=(PageFile &&temp) = delete;
+
+    /**
+     * @param path  a file's path
+     * @return      true if there is a file there
+     */
+    static bool exists(const std::string &path);
+
+    /**
+     * Create the (empty) file and open it.
+     * @throws DbRelationError if it already exists or can't be created
+     */
+    virtual void create();
+
+    /**
+     * Open the existing file.
+     * @throws DbRelationError if it can't be opened
+     */
+    virtual void open();
+
+    /**
+     * Close the file (if it is open).
+     */
+    virtual void close();
+
+    /**
+     * Close and delete the file.
+     */
+    virtual void remove();
+
+    /**
+     * @return  number of blocks in the file
+     */
+    virtual uint32_t get_block_count() const { return block_count; }
+
+    /**
+     * Read a block.
+     * @param block_id  which block
+     * @param bits      where to put it (block_size bytes)
+     * @throws DbRelationError if there is no such block
+     */
+    virtual void read(BlockID block_id, char *bits) const;
+
+    /**
+     * Write a block, growing the file if it is past the end.
+     * @param block_id  which block
+     * @param bits      its contents (block_size bytes)
+     */
+    virtual void write(BlockID block_id, const char *bits);
+
+    /**
+     * Map the whole file read-only for a sequential scan.
+     * @param block_count  returned by reference: how many blocks are mapped
+     * @return             the first block, or nullptr if the file is empty (unmap() when done)
+     */
+    virtual const char *map(uint32_t &block_count) const;
+
+    /**
+     * Undo a map().
+     * @param bits         from map()
+     * @param block_count  from map()
+     * @param block_size   size of the mapped file's blocks
+     */
+    static void unmap(const char *bits, uint32_t block_count, uint block_size);
+
+protected:
+    std::string path;
+    uint block_size;
+    int fd;  // -1 when closed
+    uint32_t block_count;
+
+    void fail(const std::string &what) const;
+};
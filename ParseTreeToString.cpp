@@ -68,8 +68,24 @@ string ParseTreeToString::operator_expression(const Expr *expr) {
         return "null";
 
     string ret;
+    if (expr->opType == Expr::UMINUS)
+        return "-" + expression(expr->expr);
+    if ((expr->opType == Expr::BETWEEN || expr->opType == Expr::IN) && expr->exprList != NULL) {
+        ret += expression(expr->expr);
+        if (expr->opType == Expr::BETWEEN && expr->exprList->size() == 2)
+            return ret + " BETWEEN " + expression((*expr->exprList)[0]) + " AND " + expression((*expr->exprList)[1]);
+        ret += " IN (";
+        bool doComma = false;
+        for (Expr *item: *expr->exprList) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(item);
+            doComma = true;
+        }
+        return ret + ")";
+    }
     if (expr->opType == Expr::NOT)
-        ret += "NOT ";
+        return "NOT " + expression(expr->expr);
     ret += expression(expr->expr) + " ";
     switch (expr->opType) {
         case Expr::SIMPLE_OP:
@@ -88,10 +104,13 @@ string ParseTreeToString::operator_expression(const Expr *expr) {
         case Expr::CASE:
             break;
         case Expr::NOT_EQUALS:
+            ret += "<>";
             break;
         case Expr::LESS_EQ:
+            ret += "<=";
             break;
         case Expr::GREATER_EQ:
+            ret += ">=";
             break;
         case Expr::LIKE:
             break;
@@ -137,7 +156,7 @@ string ParseTreeToString::expression(const Expr *expr) {
             ret += to_string(expr->ival);
             break;
         case kExprFunctionRef:
-            ret += string(expr->name) + "?" + expr->expr->name;
+            ret += string(expr->name) + "(" + (expr->distinct ? "DISTINCT " : "") + expression(expr->expr) + ")";
             break;
         case kExprOperator:
             ret += operator_expression(expr);
@@ -230,6 +249,26 @@ string ParseTreeToString::select(const SelectStatement *stmt) {
     ret += " FROM " + table_ref(stmt->fromTable);
     if (stmt->whereClause != NULL)
         ret += " WHERE " + expression(stmt->whereClause);
+    if (stmt->groupBy != NULL) {
+        ret += " GROUP BY ";
+        doComma = false;
+        for (Expr *expr : *stmt->groupBy->columns) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(expr);
+            doComma = true;
+        }
+        if (stmt->groupBy->having != NULL)
+            ret += " HAVING " + expression(stmt->groupBy->having);
+    }
+    if (stmt->order != NULL)
+        ret += " ORDER BY " + expression(stmt->order->expr) + (stmt->order->type == kOrderDesc ? " DESC" : "");
+    if (stmt->limit != NULL) {
+        if (stmt->limit->limit != kNoLimit)
+            ret += " LIMIT " + to_string(stmt->limit->limit);
+        if (stmt->limit->offset != kNoOffset)
+            ret += " OFFSET " + to_string(stmt->limit->offset);
+    }
     return ret;
 }
 
@@ -340,6 +379,22 @@ string ParseTreeToString::del(const DeleteStatement *stmt) {
     return ret;
 }
 
+string ParseTreeToString::import(const ImportStatement *stmt) {
+    string ret("IMPORT FROM ");
+    switch (stmt->type) {
+        case kImportCSV:
+            ret += "CSV";
+            break;
+        case kImportTbl:
+            ret += "TBL";
+            break;
+        default:
+            ret += "?what?";
+    }
+    ret += string(" FILE '") + stmt->filePath + "' INTO " + stmt->tableName;
+    return ret;
+}
+
 string ParseTreeToString::statement(const SQLStatement *stmt) {
     switch (stmt->type()) {
         case kStmtSelect:
@@ -354,9 +409,10 @@ string ParseTreeToString::statement(const SQLStatement *stmt) {
             return drop((const DropStatement *) stmt);
         case kStmtShow:
             return show((const ShowStatement *) stmt);
+        case kStmtImport:
+            return import((const ImportStatement *) stmt);
 
         case kStmtError:
-        case kStmtImport:
         case kStmtUpdate:
         case kStmtPrepare:
         case kStmtExecute:
@@ -50,6 +50,8 @@ private:
     static std::string drop(const hsql::DropStatement *stmt);
 
     static std::string show(const hsql::ShowStatement *stmt);
+
+    static std::string import(const hsql::ImportStatement *stmt);
 };
 
 
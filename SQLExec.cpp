@@ -3,6 +3,9 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
+#include <algorithm>
+#include <fstream>
+#include <functional>
 #include "SQLExec.h"
 
 using namespace std;
@@ -11,6 +14,8 @@ using namespace hsql;
 // define static data
 Tables *SQLExec::tables = nullptr;
 Indices *SQLExec::indices = nullptr;
+uint SQLExec::page_size = DbBlock::BLOCK_SZ;
+HeapFile::Storage SQLExec::storage = HeapFile::BERKELEY_DB;
 
 // make query result be printable
 ostream &operator<<(ostream &out, const QueryResult &qres) {
@@ -22,17 +27,18 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
             out << "----------+";
         out << endl;
         for (auto const &row: *qres.rows) {
-            for (auto const &column_name: *qres.column_names) {
-                Value value = row->at(column_name);
-                switch (value.data_type) {
+            for (uint i = 0; i < row->size(); i++) {
+                switch (row->get_data_type(i)) {
                     case ColumnAttribute::INT:
-                        out << value.n;
+                        out << row->get_n(i);
                         break;
                     case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
+                        out << "\"";
+                        out.write(row->get_text(i), row->get_length(i));
+                        out << "\"";
                         break;
                     case ColumnAttribute::BOOLEAN:
-                        out << (value.n == 0 ? "false" : "true");
+                        out << (row->get_n(i) == 0 ? "false" : "true");
                         break;
                     default:
                         out << "???";
@@ -46,6 +52,17 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
     return out;
 }
 
+QueryResult::QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows,
+                         string message) : column_names(column_names), column_attributes(column_attributes),
+                                           rows(new Tuples()), message(message) {
+    this->rows->reserve(rows->size());
+    for (auto row: *rows) {
+        this->rows->push_back(Tuple::from_dict(*row, *column_names));
+        delete row;
+    }
+    delete rows;
+}
+
 QueryResult::~QueryResult() {
     if (column_names != nullptr)
         delete column_names;
@@ -80,6 +97,8 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) {
                 return del((const DeleteStatement *) statement);
             case kStmtSelect:
                 return select((const SelectStatement *) statement);
+            case kStmtImport:
+                return import((const ImportStatement *) statement);
             default:
                 return new QueryResult("not implemented");
         }
@@ -88,6 +107,17 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) {
     }
 }
 
+void SQLExec::set_page_size(uint page_size) {
+    if (!DbBlock::valid_block_size(page_size))
+        throw SQLExecError("page size has to be a power of two from " + to_string(DbBlock::BLOCK_SZ) + " to " +
+                           to_string(DbBlock::MAX_BLOCK_SZ));
+    SQLExec::page_size = page_size;
+}
+
+void SQLExec::set_storage(HeapFile::Storage storage) {
+    SQLExec::storage = storage;
+}
+
 Value value_from_expr(const Expr *expr, const DbRelation &table) {
     Value value;
     if (!expr) {
@@ -102,105 +132,310 @@ Value value_from_expr(const Expr *expr, const DbRelation &table) {
             value.data_type = ColumnAttribute::TEXT;
             value.s = expr->name;
             break;
+        case kExprOperator:
+            if (expr->opType == Expr::UMINUS && expr->expr != nullptr && expr->expr->type == kExprLiteralInt) {
+                value.data_type = ColumnAttribute::INT;
+                value.n = -expr->expr->ival;
+                break;
+            }
+            throw SQLExecError("Unsupported data type in expression");
         default:
             throw SQLExecError("Unsupported data type in expression");
     }
     return value;
 }
 
-ValueDict where_clause_from_expr(const Expr *expr, const DbRelation &table) {
-    ValueDict where_clause;
+/**
+ * Build a predicate from a WHERE expression. The conditions compare a column to literals (with
+ * =, <>, <, <=, >, >=, BETWEEN, or IN), and can be combined with AND, OR, and NOT.
+ * @param expr    the WHERE expression
+ * @param table   table the literals are for
+ * @param column  gives the predicate's name for a column reference
+ * @return        the predicate (freed by caller)
+ */
+Predicate *predicate_from_expr(const Expr *expr, const DbRelation &table,
+                               const function<Identifier(const Expr *)> &column) {
     if (!expr) {
         throw SQLExecError("Null WHERE expression");
     }
-    if (expr->type == kExprOperator) {
-
-        // Simple equality check implementation. 
-        if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '=') {
-            if (expr->expr && expr->expr->type == kExprColumnRef && expr->expr2) {
-                string column_name = expr->expr->name;
-                Value value = value_from_expr(expr->expr2, table);
-                where_clause[column_name] = value;
-            } else {
-                throw SQLExecError("Unsupported WHERE expression structure");
-            }
-        } 
-        // AND expression check implementation
-        else if (expr->opType == Expr::OperatorType::AND) {
-            if (expr->expr && expr->expr2) {
-                ValueDict left_clause = where_clause_from_expr(expr->expr, table);
-                ValueDict right_clause = where_clause_from_expr(expr->expr2, table);
-                // Merge the two ValueDict instances using logical AND
-                for (const auto& pair : left_clause) {
-                    const string& column_name = pair.first;
-                    const Value& value = pair.second;
-                    if (right_clause.find(column_name) != right_clause.end() && right_clause[column_name] == value) {
-                        where_clause[column_name] = value;
-                    }
-                }
-                for (const auto& pair : right_clause) {
-                    const string& column_name = pair.first;
-                    const Value& value = pair.second;
-                    if (right_clause.find(column_name) != right_clause.end() && right_clause[column_name] == value) {
-                        where_clause[column_name] = value;
-                    }
-                }
-            } else {
-                throw SQLExecError("Invalid AND expression");
-            }
-        } else {
-            throw SQLExecError("Unsupported operator in WHERE expression");
-        }
-    } else {
+    if (expr->type != kExprOperator)
         throw SQLExecError("Unsupported WHERE expression type");
+    auto known = [&](const Expr *reference) {
+        Identifier column_name = column(reference);
+        const ColumnNames &column_names = table.get_column_names();
+        if (find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+            throw SQLExecError("unknown column " + column_name);
+        return column_name;
+    };
+
+    if (expr->opType == Expr::AND || expr->opType == Expr::OR || expr->opType == Expr::NOT) {
+        vector<Predicate *> operands;
+        try {
+            operands.push_back(predicate_from_expr(expr->expr, table, column));
+            if (expr->opType != Expr::NOT)
+                operands.push_back(predicate_from_expr(expr->expr2, table, column));
+        } catch (...) {
+            for (auto const &operand: operands)
+                delete operand;
+            throw;
+        }
+        if (expr->opType == Expr::AND)
+            return new Predicate(Predicate::AND, operands);
+        if (expr->opType == Expr::OR)
+            return new Predicate(Predicate::OR, operands);
+        return new Predicate(Predicate::NOT, operands);
+    }
+    if (expr->opType == Expr::BETWEEN) {
+        if (expr->expr == nullptr || expr->expr->type != kExprColumnRef || expr->exprList == nullptr ||
+            expr->exprList->size() != 2)
+            throw SQLExecError("Unsupported BETWEEN expression structure");
+        return new Predicate(known(expr->expr), value_from_expr((*expr->exprList)[0], table),
+                             value_from_expr((*expr->exprList)[1], table));
+    }
+    if (expr->opType == Expr::IN) {
+        if (expr->expr == nullptr || expr->expr->type != kExprColumnRef || expr->exprList == nullptr)
+            throw SQLExecError("Unsupported IN expression structure (only a list of literals)");
+        vector<Value> values;
+        for (auto const &item: *expr->exprList)
+            values.push_back(value_from_expr(item, table));
+        return new Predicate(known(expr->expr), values);
     }
-    return where_clause;
+
+    Predicate::Type type;
+    if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '=')
+        type = Predicate::EQ;
+    else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '<')
+        type = Predicate::LT;
+    else if (expr->opType == Expr::SIMPLE_OP && expr->opChar == '>')
+        type = Predicate::GT;
+    else if (expr->opType == Expr::NOT_EQUALS)
+        type = Predicate::NE;
+    else if (expr->opType == Expr::LESS_EQ)
+        type = Predicate::LE;
+    else if (expr->opType == Expr::GREATER_EQ)
+        type = Predicate::GE;
+    else
+        throw SQLExecError("Unsupported operator in WHERE expression");
+    const Expr *left = expr->expr;
+    const Expr *right = expr->expr2;
+    if (left != nullptr && left->type != kExprColumnRef && right != nullptr && right->type == kExprColumnRef) {
+        swap(left, right);  // literal first, as in 5 < x, so turn it around
+        if (type == Predicate::LT || type == Predicate::GT)
+            type = type == Predicate::LT ? Predicate::GT : Predicate::LT;
+        else if (type == Predicate::LE || type == Predicate::GE)
+            type = type == Predicate::LE ? Predicate::GE : Predicate::LE;
+    }
+    if (left == nullptr || left->type != kExprColumnRef || right == nullptr || right->type == kExprColumnRef)
+        throw SQLExecError("Unsupported WHERE expression structure");
+    return new Predicate(type, known(left), value_from_expr(right, table));
+}
+
+/**
+ * Name of a column reference in a single-table query.
+ * @param expr  the column reference
+ * @return      the column's name
+ */
+Identifier column_name(const Expr *expr) {
+    return expr->name;
 }
 
 
 QueryResult *SQLExec::insert(const InsertStatement *statement) {
+    ValueDicts rows;
     try {
         Identifier table_name = statement->tableName;
         DbRelation &table = SQLExec::tables->get_table(table_name);
-        ValueDict row;
         ColumnNames column_names;
 
-        // If columns are specified in the statement
+        // If columns are specified in the statement use those, otherwise assume values for all columns
         if (statement->columns != nullptr) {
-            for (unsigned int i = 0; i < statement->columns->size(); ++i) {
-                string column_name = (*statement->columns)[i];
-                Expr *value_expr = (*statement->values)[i];
-                Value value = value_from_expr(value_expr, table); 
-                row[column_name] = value;
-            }
+            for (auto const &column_name: *statement->columns)
+                column_names.push_back(column_name);
         } else {
-            // If columns are not specified, assume values for all columns
-            column_names = table.get_column_names(); // You need to implement this method if it doesn't exist
-            if (column_names.size() != statement->values->size()) {
-                throw SQLExecError("Values provided do not match number of columns in table");
-            }
-            for (unsigned int i = 0; i < column_names.size(); ++i) {
-                Expr *value_expr = (*statement->values)[i];
-                Value value = value_from_expr(value_expr, table);
-                row[column_names[i]] = value;
-            }
+            column_names = table.get_column_names();
         }
-        
-        Handle handle = table.insert(&row);
+        if (column_names.size() != statement->values->size())
+            throw SQLExecError("Values provided do not match number of columns in table");
+
+        // The parser only gives us a single VALUES tuple, so this is a batch of one for now
+        ValueDict *row = new ValueDict();
+        rows.push_back(row);
+        for (uint i = 0; i < column_names.size(); ++i)
+            (*row)[column_names[i]] = value_from_expr((*statement->values)[i], table);
+
+        Handles *handles = table.insert_batch(&rows);
 
         // Update indices if any
         auto index_names = SQLExec::indices->get_index_names(table_name);
         for (const auto &index_name : index_names) {
             DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
-            index.insert(handle);
+            index.insert_batch(handles);
+            index.sync();
         }
-        
-        return new QueryResult("successfully inserted 1 row into " + table_name);
+        table.sync();
+
+        size_t n = handles->size();
+        delete handles;
+        for (auto const &r: rows)
+            delete r;
+        return new QueryResult("successfully inserted " + to_string(n) + (n == 1 ? " row" : " rows") + " into " +
+                               table_name);
     } catch (const exception &e) {
+        for (auto const &r: rows)
+            delete r;
         throw SQLExecError(string("Insert failed: ") + e.what());
     }
 }
 
+/**
+ * Split one line of a delimited file into its fields. Fields may be enclosed in double quotes
+ * (with "" for an embedded quote) to protect delimiters.
+ * @param line       the line to split
+ * @param delimiter  field separator
+ * @param fields     returned by reference: the fields
+ */
+static void split_fields(const string &line, char delimiter, vector<string> &fields) {
+    fields.clear();
+    string field;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+                field += line[++i];
+            else if (c == '"')
+                quoted = false;
+            else
+                field += c;
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == delimiter) {
+            fields.push_back(field);
+            field.clear();
+        } else if (c != '\r') {
+            field += c;
+        }
+    }
+    fields.push_back(field);
+}
+
+/**
+ * Turn a field from a delimited file into a value of the given column type.
+ * @param field      text of the field
+ * @param data_type  type of the column it goes into
+ * @return           the value
+ * @throws SQLExecError if the field can't be converted
+ */
+static Value value_from_field(const string &field, ColumnAttribute::DataType data_type) {
+    Value value;
+    if (data_type == ColumnAttribute::TEXT)
+        return Value(field);
+    size_t end = 0;
+    try {
+        value.n = stoi(field, &end);
+    } catch (const logic_error &e) {
+        end = 0;
+    }
+    if (end == 0 || end != field.size())
+        throw SQLExecError("'" + field + "' is not an integer");
+    value.data_type = data_type;
+    return value;
+}
+
+// Rows handed to DbRelation::insert_batch at a time during an import
+static const size_t IMPORT_BATCH_SZ = 1000;
+
+/**
+ * Execute IMPORT FROM CSV FILE '<path>' INTO <table_name> (or TBL for '|'-separated files).
+ * A CSV file whose name ends in .tsv is taken to be tab-separated. A first line that just
+ * repeats the column names is skipped. Rows are streamed from the file into the table in
+ * batches, so each block is written only once, and any indices are rebuilt afterwards
+ * rather than being maintained row by row.
+ */
+QueryResult *SQLExec::import(const ImportStatement *statement) {
+    Identifier table_name = statement->tableName;
+    string path = statement->filePath;
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    const ColumnNames &column_names = table.get_column_names();
+    ColumnAttributes column_attributes = table.get_column_attributes();
+
+    char delimiter = ',';
+    if (statement->type == kImportTbl)
+        delimiter = '|';
+    else if (path.size() > 4 && path.compare(path.size() - 4, 4, ".tsv") == 0)
+        delimiter = '\t';
+
+    ifstream in(path);
+    if (!in)
+        throw SQLExecError("cannot open '" + path + "'");
+
+    size_t n = 0, line_number = 0;
+    ValueDicts rows;
+    rows.reserve(IMPORT_BATCH_SZ);
+    vector<string> fields;
+    string line;
+    try {
+        while (getline(in, line)) {
+            line_number++;
+            if (line.empty() || line == "\r")
+                continue;
+            split_fields(line, delimiter, fields);
+            if (statement->type == kImportTbl && fields.size() == column_names.size() + 1 && fields.back().empty())
+                fields.pop_back();  // .tbl lines end with a trailing '|'
+            if (line_number == 1 && fields == column_names)
+                continue;  // header
+            if (fields.size() != column_names.size())
+                throw SQLExecError("line " + to_string(line_number) + ": expected " +
+                                   to_string(column_names.size()) + " fields, found " + to_string(fields.size()));
+            ValueDict *row = new ValueDict();
+            rows.push_back(row);
+            for (uint i = 0; i < column_names.size(); i++) {
+                try {
+                    (*row)[column_names[i]] = value_from_field(fields[i], column_attributes[i].get_data_type());
+                } catch (SQLExecError &e) {
+                    throw SQLExecError("line " + to_string(line_number) + ": " + e.what());
+                }
+            }
+            if (rows.size() == IMPORT_BATCH_SZ) {
+                delete table.insert_batch(&rows);
+                n += rows.size();
+                for (auto const &r: rows)
+                    delete r;
+                rows.clear();
+            }
+        }
+        if (!rows.empty()) {
+            delete table.insert_batch(&rows);
+            n += rows.size();
+        }
+    } catch (exception &e) {
+        for (auto const &r: rows)
+            delete r;
+        table.sync();
+        rebuild_indices(table_name);
+        throw SQLExecError("Import failed after " + to_string(n) + " rows: " + e.what());
+    }
+    for (auto const &r: rows)
+        delete r;
+    table.sync();
+    rebuild_indices(table_name);
+    return new QueryResult("successfully imported " + to_string(n) + " rows into " + table_name);
+}
+
+/**
+ * Rebuild each of the indices on the given table from scratch.
+ * @param table_name  table whose indices need rebuilding
+ */
+void SQLExec::rebuild_indices(Identifier table_name) {
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name)) {
+        DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+        index.close();
+        index.drop();
+        index.create();
+        index.sync();
+    }
+}
+
 QueryResult *SQLExec::del(const DeleteStatement *statement) {
     try {
         Identifier table_name = statement->tableName;
@@ -208,71 +443,541 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
         EvalPlan *plan = new EvalPlan(table);
 
         if (statement->expr != nullptr) {
-            ValueDict where_clause = where_clause_from_expr(statement->expr, table);
-            plan = new EvalPlan(&where_clause, plan);
+            try {
+                plan = new EvalPlan(predicate_from_expr(statement->expr, table, column_name), plan);
+            } catch (...) {
+                delete plan;
+                throw;
+            }
         }
 
-        EvalPlan *optimized = plan->optimize();
+        EvalPlan *optimized = plan->optimize(SQLExec::indices);
+        delete plan;
 
         EvalPipeline pipeline = optimized->pipeline();
 
         auto index_names = SQLExec::indices->get_index_names(table_name);
-        for (auto const &index_name : index_names) {
-            DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
-            for (auto const &handle : *pipeline.second) {
-                // uncomment this once we have btree implemented
-                // index.del(handle);
+        u_long n = 0;
+        Handle handle;
+        while (pipeline.second->next(handle)) {
+            for (auto const &index_name : index_names) {
+                DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+                index.del(handle);  // while the row is still there to get its key from
             }
-        }
-
-        for (auto const &handle : *pipeline.second) {
             table.del(handle);
+            n++;
         }
+        delete pipeline.second;
+        delete optimized;
+        for (auto const &index_name : index_names)
+            SQLExec::indices->get_index(table_name, index_name).sync();
 
-        return new QueryResult("Deleted " + to_string(pipeline.second->size()) + " rows from " + table_name);
+        return new QueryResult("Deleted " + to_string(n) + " rows from " + table_name);
     } catch (const exception &e) {
         throw SQLExecError(string("DELETE failed: ") + e.what());
     }
 }
 
 
+/**
+ * Gather up the tables in a FROM clause, along with any conditions given in its joins.
+ * @param table_ref   the FROM clause
+ * @param from        returned by reference: the name each table is referred to by (its alias, if any)
+ *                    and its actual name
+ * @param conditions  returned by reference: the ON conditions of the joins
+ */
+void from_tables(const TableRef *table_ref, vector<pair<Identifier, Identifier> > &from,
+                 vector<const Expr *> &conditions) {
+    switch (table_ref->type) {
+        case kTableName:
+            from.push_back(make_pair(Identifier(table_ref->getName()), Identifier(table_ref->name)));
+            break;
+        case kTableJoin:
+            if (table_ref->join->type != kJoinInner && table_ref->join->type != kJoinCross)
+                throw SQLExecError("only inner joins are supported");
+            from_tables(table_ref->join->left, from, conditions);
+            from_tables(table_ref->join->right, from, conditions);
+            if (table_ref->join->condition != nullptr)
+                conditions.push_back(table_ref->join->condition);
+            break;
+        case kTableCrossProduct:
+            for (auto const &table: *table_ref->list)
+                from_tables(table, from, conditions);
+            break;
+        default:
+            throw SQLExecError("subqueries in FROM are not supported");
+    }
+}
+
+/**
+ * Break an expression up into the terms that are ANDed together.
+ * @param expr   the expression
+ * @param terms  returned by reference: the terms are added to this
+ */
+void conjuncts(const Expr *expr, vector<const Expr *> &terms) {
+    if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+        conjuncts(expr->expr, terms);
+        conjuncts(expr->expr2, terms);
+    } else {
+        terms.push_back(expr);
+    }
+}
+
+/**
+ * Figure out which of the tables in a join a column reference is to.
+ * @param expr    the column reference
+ * @param from    aliases and names of the tables
+ * @param tables  the tables
+ * @return        which table (index into from) and the column's name in that table
+ */
+pair<uint, Identifier> resolve_column(const Expr *expr, const vector<pair<Identifier, Identifier> > &from,
+                                      const vector<DbRelation *> &tables) {
+    Identifier column_name = expr->name;
+    int found = -1;
+    for (uint i = 0; i < from.size(); i++) {
+        if (expr->table != nullptr && from[i].first != expr->table)
+            continue;
+        const ColumnNames &column_names = tables[i]->get_column_names();
+        if (find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+            continue;
+        if (found >= 0)
+            throw SQLExecError("column reference " + column_name + " is ambiguous");
+        found = (int) i;
+    }
+    if (found < 0)
+        throw SQLExecError("unknown column " + (expr->table != nullptr ? string(expr->table) + "." : "") + column_name);
+    return make_pair((uint) found, column_name);
+}
+
+/**
+ * Collect the column references anywhere in an expression.
+ * @param expr        the expression
+ * @param references  returned by reference: the column references found in it
+ */
+void column_references(const Expr *expr, vector<const Expr *> &references) {
+    if (expr == nullptr)
+        return;
+    if (expr->type == kExprColumnRef) {
+        references.push_back(expr);
+        return;
+    }
+    column_references(expr->expr, references);
+    column_references(expr->expr2, references);
+    if (expr->exprList != nullptr)
+        for (auto const &item: *expr->exprList)
+            column_references(item, references);
+}
+
+/**
+ * How a column reference or an aggregate function is shown in a query result, e.g., "a.x" or "SUM(x)".
+ */
+Identifier written(const Expr *expr) {
+    if (expr->type == kExprFunctionRef) {
+        Identifier name = expr->name;
+        transform(name.begin(), name.end(), name.begin(), ::toupper);
+        bool star = expr->expr == nullptr || expr->expr->type != kExprColumnRef;
+        return name + "(" + (star ? "*" : written(expr->expr)) + ")";
+    }
+    return (expr->table != nullptr ? string(expr->table) + "." : string()) + expr->name;
+}
+
+/**
+ * @return  true if the select list has aggregate functions or there is a GROUP BY
+ */
+bool is_aggregate(const SelectStatement *statement) {
+    if (statement->groupBy != nullptr)
+        return true;
+    for (auto const &expr: *statement->selectList)
+        if (expr->type == kExprFunctionRef)
+            return true;
+    return false;
+}
+
+/**
+ * Put a hash aggregation over a plan for the GROUP BY and the aggregate functions of a select list.
+ * Columns in the select list outside of an aggregate function have to be grouped by.
+ * @param statement          the SELECT
+ * @param resolve            gives the plan's name for a column reference, and its attribute
+ * @param plan               rows to aggregate
+ * @param cn                 returned by reference: name to show for each column of the select list
+ * @param plan_columns       returned by reference: the aggregation's name for each column of the select list
+ * @param column_attributes  returned by reference: attribute of each column of the select list
+ * @return                   the plan with the aggregation on top
+ */
+EvalPlan *aggregate(const SelectStatement *statement,
+                    const function<pair<Identifier, ColumnAttribute>(const Expr *)> &resolve, EvalPlan *plan,
+                    ColumnNames &cn, ColumnNames &plan_columns, ColumnAttributes &column_attributes) {
+    ColumnNames group_by;
+    if (statement->groupBy != nullptr) {
+        if (statement->groupBy->having != nullptr)
+            throw SQLExecError("HAVING is not supported");
+        for (auto const &expr: *statement->groupBy->columns) {
+            if (expr->type != kExprColumnRef)
+                throw SQLExecError("only columns can be grouped by");
+            Identifier column_name = resolve(expr).first;
+            if (find(group_by.begin(), group_by.end(), column_name) == group_by.end())
+                group_by.push_back(column_name);
+        }
+    }
+    Aggregations aggregations;
+    for (auto const &expr: *statement->selectList) {
+        if (expr->type == kExprColumnRef) {
+            pair<Identifier, ColumnAttribute> column = resolve(expr);
+            if (find(group_by.begin(), group_by.end(), column.first) == group_by.end())
+                throw SQLExecError("column " + written(expr) + " has to be grouped by or aggregated");
+            cn.push_back(expr->alias != nullptr ? expr->alias : written(expr));
+            plan_columns.push_back(column.first);
+            column_attributes.push_back(column.second);
+        } else if (expr->type == kExprFunctionRef) {
+            Identifier name = expr->name;
+            transform(name.begin(), name.end(), name.begin(), ::toupper);
+            Aggregation::Function function;
+            if (name == "COUNT")
+                function = Aggregation::COUNT;
+            else if (name == "SUM")
+                function = Aggregation::SUM;
+            else if (name == "MIN")
+                function = Aggregation::MIN;
+            else if (name == "MAX")
+                function = Aggregation::MAX;
+            else
+                throw SQLExecError("unknown aggregate function " + name);
+            if (expr->distinct)
+                throw SQLExecError(name + "(DISTINCT ...) is not supported");
+            const Expr *argument = expr->expr;
+            Identifier column_name;
+            if (argument == nullptr || (argument->type == kExprStar && function == Aggregation::COUNT)) {
+                // COUNT(*)
+            } else if (argument->type == kExprColumnRef) {
+                pair<Identifier, ColumnAttribute> column = resolve(argument);
+                if (function != Aggregation::COUNT && column.second.get_data_type() != ColumnAttribute::INT)
+                    throw SQLExecError(name + " needs an INT column");
+                column_name = column.first;
+            } else {
+                throw SQLExecError(name + " only takes a column");
+            }
+            Aggregation aggregation(function, column_name);
+            bool found = false;
+            for (auto const &other: aggregations)
+                found = found || other.get_name() == aggregation.get_name();
+            if (!found)
+                aggregations.push_back(aggregation);
+            cn.push_back(expr->alias != nullptr ? expr->alias : written(expr));
+            plan_columns.push_back(aggregation.get_name());
+            column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+        } else {
+            throw SQLExecError("Unsupported expression in select list with aggregate functions or GROUP BY");
+        }
+    }
+    return new EvalPlan(new ColumnNames(group_by), new Aggregations(aggregations), plan);
+}
+
+/**
+ * Put a sort over a plan for ORDER BY. The rows can be ordered by a column of the select list (by
+ * its name there, so aggregates and aliases work), or, unless they're aggregated, by any column of
+ * the tables.
+ * @param statement     the SELECT
+ * @param resolve       gives the plan's name for a column reference, and its attribute
+ * @param plan          rows to sort
+ * @param cn            name shown for each column of the select list
+ * @param plan_columns  the plan's name for each column of the select list
+ * @return              the plan with the sort on top
+ */
+EvalPlan *order_by(const SelectStatement *statement,
+                   const function<pair<Identifier, ColumnAttribute>(const Expr *)> &resolve, EvalPlan *plan,
+                   const ColumnNames &cn, const ColumnNames &plan_columns) {
+    const Expr *expr = statement->order->expr;
+    if (expr->type != kExprColumnRef && expr->type != kExprFunctionRef)
+        throw SQLExecError("can only ORDER BY a column or an aggregate");
+    Identifier shown = written(expr);
+    Identifier column_name;
+    auto it = find(cn.begin(), cn.end(), shown);
+    if (it != cn.end())
+        column_name = plan_columns[it - cn.begin()];
+    else if (expr->type == kExprColumnRef && !is_aggregate(statement))
+        column_name = resolve(expr).first;
+    else
+        throw SQLExecError("ORDER BY " + shown + " has to be in the select list");
+    return new EvalPlan(new ColumnNames(1, column_name), new vector<bool>(1, statement->order->type == kOrderDesc),
+                        EvalOperator::NO_LIMIT, plan);
+}
+
+/**
+ * Put a limit over a plan for LIMIT and OFFSET.
+ * @param statement  the SELECT
+ * @param plan       rows to limit
+ * @return           the plan with the limit on top
+ */
+EvalPlan *limit(const SelectStatement *statement, EvalPlan *plan) {
+    int64_t limit = statement->limit->limit;
+    int64_t offset = statement->limit->offset;
+    if ((limit != kNoLimit && limit < 0) || (offset != kNoOffset && offset < 0))
+        throw SQLExecError("LIMIT and OFFSET can't be negative");
+    return new EvalPlan(limit == kNoLimit ? EvalOperator::NO_LIMIT : (u_long) limit,
+                        offset == kNoOffset ? 0 : (u_long) offset, plan);
+}
+
 QueryResult *SQLExec::select(const SelectStatement *statement) {
-    Identifier table_name = statement->fromTable->getName();
-
-    // check table exists
-    ValueDict where = {{"table_name", Value(table_name)}};
-    Handles* tabMeta = SQLExec::tables->select(&where);
-    bool tableExists = !tabMeta->empty();
-    delete tabMeta;
-    if (!tableExists)
-        throw SQLExecError("attempting to select from non-existent table " + table_name);
+    vector<pair<Identifier, Identifier> > from;
+    vector<const Expr *> join_conditions;
+    from_tables(statement->fromTable, from, join_conditions);
+
+    // check tables exist
+    for (auto const &table: from) {
+        ValueDict where = {{"table_name", Value(table.second)}};
+        Handles *tabMeta = SQLExec::tables->select(&where);
+        bool tableExists = !tabMeta->empty();
+        delete tabMeta;
+        if (!tableExists)
+            throw SQLExecError("attempting to select from non-existent table " + table.second);
+    }
+    if (from.size() > 1)
+        return select_join(statement, from, join_conditions);
+
+    Identifier table_name = from[0].second;
     DbRelation& table = SQLExec::tables->get_table(table_name);
+    bool aggregating = is_aggregate(statement);
     ColumnNames* cn = new ColumnNames();
-    for (const Expr* expr : *statement->selectList) {
-        if (expr->type == kExprStar)
-            for (const Identifier& col : table.get_column_names())
-                cn->push_back(col);
-        else
-            cn->push_back(expr->name);
+    if (!aggregating) {
+        for (const Expr* expr : *statement->selectList) {
+            if (expr->type == kExprStar)
+                for (const Identifier& col : table.get_column_names())
+                    cn->push_back(col);
+            else
+                cn->push_back(expr->name);
+        }
     }
 
     // start base of plan at a TableScan
     EvalPlan* plan = new EvalPlan(table);
 
     // enclose in selection if where clause exists
-    if (statement->whereClause){
-        ValueDict where_clause = where_clause_from_expr(statement->whereClause, table);
-        plan = new EvalPlan(&where_clause, plan);
+    if (statement->whereClause) {
+        try {
+            plan = new EvalPlan(predicate_from_expr(statement->whereClause, table, column_name), plan);
+        } catch (...) {
+            delete plan;
+            delete cn;
+            throw;
+        }
     }
             
-    // wrap in project
-    plan = new EvalPlan(cn, plan);
+    // aggregate and sort, if asked to, and wrap in project
+    auto resolve = [&table](const Expr* expr) {
+        const ColumnNames& column_names = table.get_column_names();
+        auto it = find(column_names.begin(), column_names.end(), Identifier(expr->name));
+        if (it == column_names.end())
+            throw SQLExecError(string("unknown column ") + expr->name);
+        return make_pair(*it, table.get_column_attributes()[it - column_names.begin()]);
+    };
+    ColumnNames plan_columns;
+    ColumnAttributes* column_attributes = nullptr;
+    try {
+        if (aggregating) {
+            column_attributes = new ColumnAttributes();
+            plan = aggregate(statement, resolve, plan, *cn, plan_columns, *column_attributes);
+        } else {
+            column_attributes = table.get_column_attributes(*cn);
+            plan_columns = *cn;
+        }
+        if (statement->order != nullptr)
+            plan = order_by(statement, resolve, plan, *cn, plan_columns);
+        if (statement->limit != nullptr)
+            plan = limit(statement, plan);
+    } catch (...) {
+        delete plan;
+        delete cn;
+        delete column_attributes;
+        throw;
+    }
+    plan = new EvalPlan(new ColumnNames(plan_columns), plan);
 
     // optimize and evaluate
-    plan = plan->optimize();
-    ValueDicts* rows = plan->evaluate();
+    EvalPlan* optimized = plan->optimize(SQLExec::indices);
     delete plan;
-    return new QueryResult(cn, table.get_column_attributes(*cn), rows, "successfully return " + to_string(rows->size()) + " rows");
+    Tuples* rows;
+    try {
+        rows = optimized->evaluate();
+    } catch (...) {
+        delete optimized;
+        delete cn;
+        delete column_attributes;
+        throw;
+    }
+    delete optimized;
+    return new QueryResult(cn, column_attributes, rows, "successfully return " + to_string(rows->size()) + " rows");
+}
+
+/**
+ * Select from more than one table. Each table gets an alias (its name unless the query gave it
+ * one), and the columns above its scan are qualified by that alias. Conditions on the columns of
+ * just one table are pushed down onto that table's scan, and conditions equating columns of two
+ * tables become the keys of the hash joins. Tables are joined left-deep in FROM order, except that
+ * a table with a join condition to the ones already joined goes ahead of one without (which would
+ * need a cross product).
+ * @param statement        the SELECT
+ * @param from             alias and name of each table
+ * @param join_conditions  ON conditions from the FROM clause
+ * @return                 the query result (freed by caller)
+ */
+QueryResult *SQLExec::select_join(const SelectStatement *statement, const vector<pair<Identifier, Identifier> > &from,
+                                  vector<const Expr *> join_conditions) {
+    vector<DbRelation *> tables;
+    for (uint i = 0; i < from.size(); i++) {
+        for (uint j = 0; j < i; j++)
+            if (from[i].first == from[j].first)
+                throw SQLExecError("table " + from[i].first + " appears more than once (give it an alias)");
+        tables.push_back(&SQLExec::tables->get_table(from[i].second));
+    }
+    auto qualified = [&](const pair<uint, Identifier> &column) { return from[column.first].first + "." + column.second; };
+
+    // sort the conditions into filters on one table and equijoins between two
+    vector<Predicate *> filters(from.size(), nullptr);
+    vector<pair<pair<uint, Identifier>, pair<uint, Identifier> > > equijoins;
+    auto column = [&](const Expr *expr) { return resolve_column(expr, from, tables).second; };
+    if (statement->whereClause != nullptr)
+        conjuncts(statement->whereClause, join_conditions);
+    try {
+        for (auto const &condition: join_conditions) {
+            if (condition->type == kExprOperator && condition->opType == Expr::SIMPLE_OP && condition->opChar == '=' &&
+                condition->expr != nullptr && condition->expr->type == kExprColumnRef &&
+                condition->expr2 != nullptr && condition->expr2->type == kExprColumnRef) {
+                pair<uint, Identifier> left = resolve_column(condition->expr, from, tables);
+                pair<uint, Identifier> right = resolve_column(condition->expr2, from, tables);
+                if (left.first == right.first)
+                    throw SQLExecError("comparing two columns of the same table is not supported");
+                equijoins.push_back(make_pair(left, right));
+                continue;
+            }
+            vector<const Expr *> references;
+            column_references(condition, references);
+            if (references.empty())
+                throw SQLExecError("Unsupported WHERE expression structure");
+            uint i = resolve_column(references[0], from, tables).first;
+            for (auto const &reference: references)
+                if (resolve_column(reference, from, tables).first != i)
+                    throw SQLExecError("a condition on more than one table has to be column = column");
+            Predicate *predicate = predicate_from_expr(condition, *tables[i], column);
+            filters[i] = filters[i] == nullptr ? predicate
+                                               : new Predicate(Predicate::AND, vector<Predicate *>{filters[i], predicate});
+        }
+    } catch (...) {
+        for (auto const &filter: filters)
+            delete filter;
+        throw;
+    }
+
+    // figure out the select list before building anything (unless it's aggregated)
+    bool aggregating = is_aggregate(statement);
+    ColumnNames *cn = new ColumnNames();
+    ColumnNames plan_columns;
+    ColumnAttributes *column_attributes = new ColumnAttributes();
+    try {
+        if (!aggregating) {
+            for (const Expr *expr: *statement->selectList) {
+                vector<pair<uint, Identifier> > columns;
+                if (expr->type == kExprStar) {
+                    for (uint i = 0; i < from.size(); i++)
+                        for (auto const &column_name: tables[i]->get_column_names())
+                            columns.push_back(make_pair(i, column_name));
+                } else if (expr->type == kExprColumnRef) {
+                    columns.push_back(resolve_column(expr, from, tables));
+                } else {
+                    throw SQLExecError("Unsupported expression in select list");
+                }
+                for (auto const &column: columns) {
+                    cn->push_back(expr->table != nullptr ? qualified(column) : column.second);
+                    plan_columns.push_back(qualified(column));
+                    ColumnAttributes *ca = tables[column.first]->get_column_attributes(ColumnNames(1, column.second));
+                    column_attributes->push_back((*ca)[0]);
+                    delete ca;
+                }
+            }
+        }
+    } catch (...) {
+        for (auto const &filter: filters)
+            delete filter;
+        delete cn;
+        delete column_attributes;
+        throw;
+    }
+
+    // a scan of each table, with its filters, under its alias (the plan takes over the filter)
+    auto base = [&](uint i) {
+        EvalPlan *plan = new EvalPlan(*tables[i]);
+        if (filters[i] != nullptr)
+            plan = new EvalPlan(filters[i], plan);
+        filters[i] = nullptr;
+        return new EvalPlan(from[i].first, plan);
+    };
+    vector<bool> joined(from.size(), false);
+    EvalPlan *plan = base(0);
+    joined[0] = true;
+    for (uint n = 1; n < from.size(); n++) {
+        uint next = 0;
+        bool connected = false;
+        for (uint i = 0; i < from.size() && !connected; i++)
+            if (!joined[i])
+                for (auto const &equijoin: equijoins)
+                    if ((equijoin.first.first == i && joined[equijoin.second.first]) ||
+                        (equijoin.second.first == i && joined[equijoin.first.first])) {
+                        next = i;
+                        connected = true;
+                        break;
+                    }
+        if (!connected)
+            while (joined[next])
+                next++;
+        ColumnNames *left_keys = new ColumnNames();
+        ColumnNames *right_keys = new ColumnNames();
+        for (auto const &equijoin: equijoins) {
+            if (equijoin.second.first == next && joined[equijoin.first.first]) {
+                left_keys->push_back(qualified(equijoin.first));
+                right_keys->push_back(qualified(equijoin.second));
+            } else if (equijoin.first.first == next && joined[equijoin.second.first]) {
+                left_keys->push_back(qualified(equijoin.second));
+                right_keys->push_back(qualified(equijoin.first));
+            }
+        }
+        plan = new EvalPlan(plan, base(next), left_keys, right_keys);
+        joined[next] = true;
+    }
+    auto resolve = [&](const Expr *expr) {
+        pair<uint, Identifier> column = resolve_column(expr, from, tables);
+        ColumnAttributes *ca = tables[column.first]->get_column_attributes(ColumnNames(1, column.second));
+        ColumnAttribute column_attribute = (*ca)[0];
+        delete ca;
+        return make_pair(qualified(column), column_attribute);
+    };
+    try {
+        if (aggregating)
+            plan = aggregate(statement, resolve, plan, *cn, plan_columns, *column_attributes);
+        if (statement->order != nullptr)
+            plan = order_by(statement, resolve, plan, *cn, plan_columns);
+        if (statement->limit != nullptr)
+            plan = limit(statement, plan);
+    } catch (...) {
+        delete plan;
+        delete cn;
+        delete column_attributes;
+        throw;
+    }
+    plan = new EvalPlan(new ColumnNames(plan_columns), plan);
+
+    // optimize and evaluate
+    EvalPlan *optimized = plan->optimize(SQLExec::indices);
+    delete plan;
+    Tuples *rows;
+    try {
+        rows = optimized->evaluate();
+    } catch (...) {
+        delete optimized;
+        delete cn;
+        delete column_attributes;
+        throw;
+    }
+    delete optimized;
+    return new QueryResult(cn, column_attributes, rows, "successfully return " + to_string(rows->size()) + " rows");
 }
 
 
@@ -318,6 +1023,8 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
     // Add to schema: _tables and _columns
     ValueDict row;
     row["table_name"] = table_name;
+    row["page_size"] = Value((int32_t) SQLExec::page_size);
+    row["storage"] = Value(Tables::storage_name(SQLExec::storage));
     Handle t_handle = SQLExec::tables->insert(&row);  // Insert into _tables
     try {
         Handles c_handles;
@@ -352,6 +1059,8 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
         } catch (...) {}
         throw;
     }
+    SQLExec::tables->sync();
+    SQLExec::tables->get_table(Columns::TABLE_NAME).sync();
     return new QueryResult("created " + table_name);
 }
 
@@ -374,6 +1083,7 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
     row["index_name"] = Value(index_name);
     row["index_type"] = Value(statement->indexType);
     row["is_unique"] = Value(string(statement->indexType) == "BTREE"); // assume HASH is non-unique --
+    row["page_size"] = Value((int32_t) SQLExec::page_size);
     int seq = 0;
     Handles i_handles;
     try {
@@ -385,6 +1095,7 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
 
         DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
         index.create();
+        index.sync();
 
     } catch (...) {
         // attempt to remove from _indices
@@ -394,6 +1105,7 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
         } catch (...) {}
         throw;  // re-throw the original exception (which should give the client some clue as to why it did
     }
+    SQLExec::indices->sync();
     return new QueryResult("created index " + index_name);
 }
 
@@ -508,11 +1220,7 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
     Handles *handles = SQLExec::indices->select(&where);
     u_long n = handles->size();
 
-    ValueDicts *rows = new ValueDicts;
-    for (auto const &handle: *handles) {
-        ValueDict *row = SQLExec::indices->project(handle, column_names);
-        rows->push_back(row);
-    }
+    Tuples *rows = SQLExec::indices->project(handles, column_names);
     delete handles;
     return new QueryResult(column_names, column_attributes, rows,
                            "successfully returned " + to_string(n) + " rows");
@@ -529,10 +1237,10 @@ QueryResult *SQLExec::show_tables() {
     Handles *handles = SQLExec::tables->select();
     u_long n = handles->size() - 3;
 
-    ValueDicts *rows = new ValueDicts;
+    Tuples *rows = new Tuples;
     for (auto const &handle: *handles) {
-        ValueDict *row = SQLExec::tables->project(handle, column_names);
-        Identifier table_name = row->at("table_name").s;
+        Tuple *row = SQLExec::tables->project_tuple(handle, column_names);
+        Identifier table_name = row->get_s(0);
         if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME && table_name != Indices::TABLE_NAME)
             rows->push_back(row);
         else
@@ -558,11 +1266,7 @@ QueryResult *SQLExec::show_columns(const ShowStatement *statement) {
     Handles *handles = columns.select(&where);
     u_long n = handles->size();
 
-    ValueDicts *rows = new ValueDicts;
-    for (auto const &handle: *handles) {
-        ValueDict *row = columns.project(handle, column_names);
-        rows->push_back(row);
-    }
+    Tuples *rows = columns.project(handles, column_names);
     delete handles;
     return new QueryResult(column_names, column_attributes, rows, "successfully returned " + to_string(n) + " rows");
 }
\ No newline at end of file
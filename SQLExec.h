@@ -30,16 +30,20 @@ public:
     QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
                                        message(message) {}
 
-    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, Tuples *rows, std::string message)
             : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
 
+    // compatibility: converts (and frees) the given rows to tuples in the order of column_names
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows,
+                std::string message);
+
     virtual ~QueryResult();
 
     ColumnNames *get_column_names() const { return column_names; }
 
     ColumnAttributes *get_column_attributes() const { return column_attributes; }
 
-    ValueDicts *get_rows() const { return rows; }
+    Tuples *get_rows() const { return rows; }
 
     const std::string &get_message() const { return message; }
 
@@ -48,7 +52,7 @@ public:
 protected:
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
-    ValueDicts *rows;
+    Tuples *rows;
     std::string message;
 };
 
@@ -65,10 +69,27 @@ public:
      */
     static QueryResult *execute(const hsql::SQLStatement *statement);
 
+    /**
+     * Set the page size of the tables and indices created from now on. (The parser has no syntax for
+     * it.) Each one records its page size in the catalog and keeps it.
+     * @param page_size  block size in bytes, DbBlock::BLOCK_SZ unless this is called
+     * @throws SQLExecError if it isn't a valid block size (see DbBlock::valid_block_size)
+     */
+    static void set_page_size(uint page_size);
+
+    /**
+     * Set where the blocks of the tables created from now on are kept. Each table records its storage
+     * in the catalog and keeps it. (Indices are always in Berkeley DB files.)
+     * @param storage  HeapFile::BERKELEY_DB unless this is called
+     */
+    static void set_storage(HeapFile::Storage storage);
+
 protected:
     // the one place in the system that holds the _tables and _indices table
     static Tables *tables;
     static Indices *indices;
+    static uint page_size;
+    static HeapFile::Storage storage;
 
     // recursive decent into the AST
     static QueryResult *create(const hsql::CreateStatement *statement);
@@ -95,8 +116,16 @@ protected:
 
     static QueryResult *del(const hsql::DeleteStatement *statement);
 
+    static QueryResult *import(const hsql::ImportStatement *statement);
+
+    static void rebuild_indices(Identifier table_name);
+
     static QueryResult *select(const hsql::SelectStatement *statement);
 
+    static QueryResult *select_join(const hsql::SelectStatement *statement,
+                                    const std::vector<std::pair<Identifier, Identifier> > &from,
+                                    std::vector<const hsql::Expr *> join_conditions);
+
     /**
      * Pull out column name and attributes from AST's column definition clause
      * @param col                AST column definition
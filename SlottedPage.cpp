@@ -15,10 +15,12 @@ typedef uint16_t u16;
  * @param block_id
  * @param is_new
  */
-SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new) {
+SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new),
+                                                                     block_size(block.get_size()),
+                                                                     wide(block.get_size() > UINT16_MAX + 1U) {
     if (is_new) {
         this->num_records = 0;
-        this->end_free = DbBlock::BLOCK_SZ - 1;
+        this->end_free = this->block_size - 1;
         put_header();
     } else {
         get_header(this->num_records, this->end_free);
@@ -31,12 +33,12 @@ SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(bl
  * @return the new block's id
  */
 RecordID SlottedPage::add(const Dbt *data) {
-    if (!has_room((u16) data->get_size()))
+    if (this->num_records == UINT16_MAX || !make_room(data->get_size()))
         throw DbBlockNoRoomError("not enough room for new record");
-    u16 id = ++this->num_records;
-    u16 size = (u16) data->get_size();
+    RecordID id = (RecordID) ++this->num_records;
+    uint size = data->get_size();
     this->end_free -= size;
-    u16 loc = this->end_free + 1U;
+    uint loc = this->end_free + 1U;
     put_header();
     put_header(id, size, loc);
     memcpy(this->address(loc), data->get_data(), size);
@@ -49,13 +51,29 @@ RecordID SlottedPage::add(const Dbt *data) {
  * @return the bits of the record as stored in the block, or nullptr if it has been deleted (freed by caller)
  */
 Dbt *SlottedPage::get(RecordID record_id) const {
-    u16 size, loc;
+    uint size, loc;
     get_header(size, loc, record_id);
     if (loc == 0)
         return nullptr;  // this is just a tombstone, record has been deleted
     return new Dbt(this->address(loc), size);
 }
 
+/**
+ * Look at a record in place.
+ * @param record_id  record to look at
+ * @param record     set to point at the bits of the record within the block
+ * @return           false if it has been deleted
+ */
+bool SlottedPage::view(RecordID record_id, Dbt &record) const {
+    uint size, loc;
+    get_header(size, loc, record_id);
+    if (loc == 0)
+        return false;  // this is just a tombstone, record has been deleted
+    record.set_data(this->address(loc));
+    record.set_size(size);
+    return true;
+}
+
 /**
  * Replace the record with the given data.
  * @param record_id   record to replace
@@ -63,13 +81,14 @@ Dbt *SlottedPage::get(RecordID record_id) const {
  * @throws DbBlockNoRoomError if it won't fit
  */
 void SlottedPage::put(RecordID record_id, const Dbt &data) {
-    u16 size, loc;
+    uint size, loc;
     get_header(size, loc, record_id);
-    u16 new_size = (u16) data.get_size();
+    uint new_size = data.get_size();
     if (new_size > size) {
-        u16 extra = new_size - size;
-        if (!has_room(extra))
+        uint extra = new_size - size;
+        if (!make_room(extra))
             throw DbBlockNoRoomError("not enough room for enlarged record");
+        get_header(size, loc, record_id);  // compaction may have moved it
         slide(loc, loc - extra);
         memcpy(this->address(loc - extra), data.get_data(), new_size);
     } else {
@@ -84,15 +103,13 @@ void SlottedPage::put(RecordID record_id, const Dbt &data) {
  * Delete a record from the page.
  *
  * Mark the given id as deleted by changing its size to zero and its location to 0.
- * Compact the rest of the data in the block. But keep the record ids the same for everyone.
+ * The space isn't reclaimed until it's needed (see make_room), so deleting many records
+ * from a block costs just one compaction. Record ids stay the same for everyone.
  *
  * @param record_id  record to delete
  */
 void SlottedPage::del(RecordID record_id) {
-    u16 size, loc;
-    get_header(size, loc, record_id);
     put_header(record_id, 0, 0);  // 0 is the tombstone sentinel
-    slide(loc, loc + size);
 }
 
 /**
@@ -101,7 +118,7 @@ void SlottedPage::del(RecordID record_id) {
  */
 RecordIDs *SlottedPage::ids(void) const {
     RecordIDs *vec = new RecordIDs();
-    u16 size, loc;
+    uint size, loc;
     for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
         get_header(size, loc, record_id);
         if (loc != 0)
@@ -115,7 +132,7 @@ RecordIDs *SlottedPage::ids(void) const {
  */
 void SlottedPage::clear() {
     this->num_records = 0;
-    this->end_free = DbBlock::BLOCK_SZ - 1;
+    this->end_free = this->block_size - 1;
     put_header();
 }
 
@@ -124,7 +141,7 @@ void SlottedPage::clear() {
  * @return number of current records
  */
 u16 SlottedPage::size() const {
-    u16 size, loc;
+    uint size, loc;
     u16 count = 0;
     for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
         get_header(size, loc, record_id);
@@ -141,9 +158,9 @@ u16 SlottedPage::size() const {
  * @param loc   set to the byte offset from given header
  * @param id    the id of the header to fetch
  */
-void SlottedPage::get_header(u_int16_t &size, u_int16_t &loc, RecordID id) const {
-    size = get_n((u16) 4 * id);
-    loc = get_n((u16) (4 * id + 2));
+void SlottedPage::get_header(uint &size, uint &loc, RecordID id) const {
+    size = get_n(header_size() * id);
+    loc = get_n(header_size() * id + header_size() / 2);
 }
 
 /**
@@ -152,32 +169,83 @@ void SlottedPage::get_header(u_int16_t &size, u_int16_t &loc, RecordID id) const
  * @param size
  * @param loc
  */
-void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
+void SlottedPage::put_header(RecordID id, uint size, uint loc) {
     if (id == 0) { // called the put_header() version and using the default params
         size = this->num_records;
         loc = this->end_free;
     }
-    put_n((u16) 4 * id, size);
-    put_n((u16) (4 * id + 2), loc);
+    put_n(header_size() * id, size);
+    put_n(header_size() * id + header_size() / 2, loc);
 }
 
 /**
- * Calculate if we have room to store a record with given size. The size should include the 4 bytes
- * for the header, too, if this is an add.
+ * Calculate if we have room to store a record with given size, plus a header for it.
  * @param size   size of the new record (not including the header space needed)
  * @return       true if there is enough room, false otherwise
  */
-bool SlottedPage::has_room(u16 size) const {
-    return size + (u16)4 <= this->unused_bytes();
+bool SlottedPage::has_room(uint size) const {
+    return size + header_size() <= this->unused_bytes();
+}
+
+/**
+ * Make sure there is room to store a record with given size, compacting away the space
+ * left behind by deleted records if that will help.
+ * @param size   size of the new record (not including the header space needed)
+ * @return       true if there is now enough room, false otherwise
+ */
+bool SlottedPage::make_room(uint size) {
+    if (has_room(size))
+        return true;
+    uint free = free_bytes();
+    if (free == this->unused_bytes() || size + header_size() > free)
+        return false;
+    compact();
+    return true;
+}
+
+/**
+ * Get the number of bytes that could be used for new records (and their headers) once the
+ * block is compacted: the unused bytes plus the space left behind by deleted records.
+ * @return number of bytes
+ */
+uint SlottedPage::free_bytes() const {
+    uint live = 0, rec_size, loc;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        get_header(rec_size, loc, record_id);
+        live += rec_size;  // tombstones have size 0
+    }
+    return this->unused_bytes() + (this->block_size - 1 - this->end_free - live);
+}
+
+/**
+ * Squeeze out the space left by deleted records, in one pass and without allocating.
+ * Since live records with higher ids are at lower offsets, moving each one as far right
+ * as it can go, in id order, never overwrites a record that hasn't been moved yet.
+ */
+void SlottedPage::compact() {
+    uint dest = this->block_size;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        uint size, loc;
+        get_header(size, loc, record_id);
+        if (loc == 0)
+            continue;
+        dest -= size;
+        if (dest != loc) {
+            memmove(this->address(dest), this->address(loc), size);
+            put_header(record_id, size, dest);
+        }
+    }
+    this->end_free = dest - 1U;
+    put_header();
 }
 
 /**
  * Get the number of bytes not currently used to store data or for overhead.
  * @return number of bytes
  */
-u16 SlottedPage::unused_bytes() const {
-    u16 headers = (u16) (4 * (this->num_records + 1));
-    u16 unused;
+uint SlottedPage::unused_bytes() const {
+    uint headers = header_size() * (this->num_records + 1);
+    uint unused;
     if (this->end_free <= headers)
         unused = 0;
     else
@@ -197,46 +265,49 @@ u16 SlottedPage::unused_bytes() const {
  * @param start  beginning of slide
  * @param end    end of slide
  */
-void SlottedPage::slide(u_int16_t start, u_int16_t end) {
-    int shift = end - start;
+void SlottedPage::slide(uint start, uint end) {
+    int shift = (int) end - (int) start;
     if (shift == 0)
         return;
 
     // slide data
-    void *to = this->address((u16) (this->end_free + 1 + shift));
-    void *from = this->address((u16) (this->end_free + 1));
+    void *to = this->address(this->end_free + 1 + shift);
+    void *from = this->address(this->end_free + 1);
     int bytes = start - (this->end_free + 1U);
     memmove(to, from, bytes);
 
-    // fix up headers to the right
-    RecordIDs *record_ids = ids();
-    for (auto const &record_id : *record_ids) {
-        u16 size, loc;
+    // fix up headers to the right (in one pass over the headers, skipping tombstones)
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        uint size, loc;
         get_header(size, loc, record_id);
-        if (loc <= start) {
+        if (loc != 0 && loc <= start) {
             loc += shift;
             put_header(record_id, size, loc);
         }
     }
-    delete record_ids;
     this->end_free += shift;
     put_header();
 }
 
 /**
- * Get 2-byte integer at given offset in block.
+ * Get 2-byte (or, in a wide block, 4-byte) integer at given offset in block.
  */
-u16 SlottedPage::get_n(u16 offset) const {
+uint SlottedPage::get_n(uint offset) const {
+    if (this->wide)
+        return *(uint32_t *) this->address(offset);
     return *(u16 *) this->address(offset);
 }
 
 /**
- * Put a 2-byte integer at given offset in block.
+ * Put a 2-byte (or, in a wide block, 4-byte) integer at given offset in block.
  * @param offset number of bytes into the page
  * @param n
  */
-void SlottedPage::put_n(u16 offset, u16 n) {
-    *(u16 *) this->address(offset) = n;
+void SlottedPage::put_n(uint offset, uint n) {
+    if (this->wide)
+        *(uint32_t *) this->address(offset) = n;
+    else
+        *(u16 *) this->address(offset) = (u16) n;
 }
 
 /**
@@ -244,7 +315,7 @@ void SlottedPage::put_n(u16 offset, u16 n) {
  * @param offset
  * @return
  */
-void *SlottedPage::address(u16 offset) const {
+void *SlottedPage::address(uint offset) const {
     return (void *) ((char *) this->block.get_data() + offset);
 }
 
@@ -264,13 +335,23 @@ bool assertion_failure(string message, double x, double y) {
 }
 
 /**
- * Testing function for SlottedPage.
+ * Testing function for SlottedPage, with the usual block size, the biggest one with two-byte
+ * header fields, and one with four-byte fields.
  * @return true if testing succeeded, false otherwise
  */
 bool test_slotted_page() {
+    return test_slotted_page(DbBlock::BLOCK_SZ) && test_slotted_page(64 * 1024) && test_slotted_page(128 * 1024);
+}
+
+/**
+ * Testing function for SlottedPage.
+ * @param block_size  size of the blocks to test with
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_slotted_page(uint block_size) {
     // construct one
-    char blank_space[DbBlock::BLOCK_SZ];
-    Dbt block_dbt(blank_space, sizeof(blank_space));
+    vector<char> blank_space(block_size);
+    Dbt block_dbt(blank_space.data(), block_size);
     SlottedPage slot(block_dbt, 1, true);
 
     // add a record
@@ -288,6 +369,12 @@ bool test_slotted_page() {
     if (expected != actual)
         return assertion_failure("get 1 back " + actual);
 
+    // look at it in place
+    Dbt view_dbt;
+    if (!slot.view(id, view_dbt) || view_dbt.get_size() != sizeof(rec1) ||
+        memcmp(view_dbt.get_data(), rec1, sizeof(rec1)) != 0)
+        return assertion_failure("view 1");
+
     // add another record and fetch it back
     char rec2[] = "goodbye";
     Dbt rec2_dbt(rec2, sizeof(rec2));
@@ -351,9 +438,11 @@ bool test_slotted_page() {
     get_dbt = slot.get(1);
     if (get_dbt != nullptr)
         return assertion_failure("get of deleted record was not null");
+    if (slot.view(1, view_dbt))
+        return assertion_failure("view of deleted record succeeded");
 
     // try adding something too big
-    rec2_dbt = Dbt(nullptr, DbBlock::BLOCK_SZ - 10); // too big, but only because we have a record in there
+    rec2_dbt = Dbt(nullptr, block_size - 10); // too big, but only because we have a record in there
     try {
         slot.add(&rec2_dbt);
         return assertion_failure("failed to throw when add too big");
@@ -364,6 +453,27 @@ bool test_slotted_page() {
         return assertion_failure("wrong type thrown when add too big");
     }
 
+    // deleted space gets reused once it's needed
+    uint room = slot.unused_bytes();
+    rec2_dbt = Dbt(nullptr, room - slot.header_size() + sizeof(rec1));  // only fits if rec1's old space is reclaimed
+    char *big = new char[rec2_dbt.get_size()];
+    memset(big, 'x', rec2_dbt.get_size());
+    rec2_dbt.set_data(big);
+    id = slot.add(&rec2_dbt);
+    get_dbt = slot.get(2);
+    expected = string(rec2, sizeof(rec2));
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (expected != actual)
+        return assertion_failure("get 2 back after compaction " + actual);
+    get_dbt = slot.get(id);
+    if (get_dbt->get_size() != rec2_dbt.get_size() || memcmp(get_dbt->get_data(), big, get_dbt->get_size()) != 0)
+        return assertion_failure("get big record back after compaction");
+    delete get_dbt;
+    delete[] big;
+    if (slot.unused_bytes() != 0)
+        return assertion_failure("compaction left unused bytes", slot.unused_bytes());
+
     // more volume
     string gettysburg = "Four score and seven years ago our fathers brought forth on this continent, a new nation, conceived in Liberty, and dedicated to the proposition that all men are created equal.";
     int32_t n = -1;
@@ -376,14 +486,14 @@ bool test_slotted_page() {
     Dbt dbt(data, total_size);
     vector<SlottedPage> page_list;
     BlockID block_id = 1;
-    Dbt slot_dbt(new char[DbBlock::BLOCK_SZ], DbBlock::BLOCK_SZ);
+    Dbt slot_dbt(new char[block_size], block_size);
     slot = SlottedPage(slot_dbt, block_id++, true);
     for (int i = 0; i < 10000; i++) {
         try {
             slot.add(&dbt);
         } catch (DbBlockNoRoomError &exc) {
             page_list.push_back(slot);
-            slot_dbt = Dbt(new char[DbBlock::BLOCK_SZ], DbBlock::BLOCK_SZ);
+            slot_dbt = Dbt(new char[block_size], block_size);
             slot = SlottedPage(slot_dbt, block_id++, true);
             slot.add(&dbt);
         }
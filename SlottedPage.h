@@ -24,6 +24,15 @@
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+
+        The block can be any size its Dbt says it is (see DbBlock::valid_block_size). Two-byte fields
+        can address up to 64kB; a bigger block uses the same layout with four-byte fields instead, so
+        each header there is 8 bytes. Either way there are at most UINT16_MAX record ids in a block.
+
+        Deleting a record just tombstones its header; the space it used is left where it is until
+        an add or put needs it, at which point the whole block is compacted in one pass. Live records
+        are always laid out with higher record ids at lower offsets, which is what lets compaction
+        (and slide) get away with a single walk over the headers.
  *
  */
 class SlottedPage : public DbBlock {
@@ -37,6 +46,8 @@ public:
 
     virtual Dbt *get(RecordID record_id) const;
 
+    virtual bool view(RecordID record_id, Dbt &record) const;
+
     virtual void put(RecordID record_id, const Dbt &data);
 
     virtual void del(RecordID record_id);
@@ -47,29 +58,50 @@ public:
 
     virtual u_int16_t size() const;
 
-    virtual u_int16_t unused_bytes() const;
+    virtual uint unused_bytes() const;
+
+    virtual uint free_bytes() const;
+
+    virtual void compact();
+
+    /**
+     * @return  bytes of overhead each record adds: its header (4, or 8 in a block over 64kB)
+     */
+    uint header_size() const { return wide ? 8U : 4U; }
+
+    /**
+     * @param block_size  size of a block
+     * @return            size of the biggest record an empty block of that size can hold
+     */
+    static uint max_record_size(uint block_size) { return block_size - 1 - 2 * (block_size > UINT16_MAX + 1U ? 8U : 4U); }
 
 protected:
-    uint16_t num_records;
-    uint16_t end_free;
+    uint block_size;
+    bool wide;  // four-byte header fields
+    uint num_records;
+    uint end_free;
+
+    void get_header(uint &size, uint &loc, RecordID id = 0) const;
 
-    void get_header(uint16_t &size, uint16_t &loc, RecordID id = 0) const;
+    void put_header(RecordID id = 0, uint size = 0, uint loc = 0);
 
-    void put_header(RecordID id = 0, uint16_t size = 0, uint16_t loc = 0);
+    bool has_room(uint size) const;
 
-    bool has_room(uint16_t size) const;
+    bool make_room(uint size);
 
-    virtual void slide(uint16_t start, uint16_t end);
+    virtual void slide(uint start, uint end);
 
-    uint16_t get_n(uint16_t offset) const;
+    uint get_n(uint offset) const;
 
-    void put_n(uint16_t offset, uint16_t n);
+    void put_n(uint offset, uint n);
 
-    void *address(uint16_t offset) const;
+    void *address(uint offset) const;
 
     friend bool test_slotted_page();
+    friend bool test_slotted_page(uint block_size);
 };
 
 bool assertion_failure(std::string message, double x = -1, double y = -1);
 bool test_slotted_page();
+bool test_slotted_page(uint block_size);
 
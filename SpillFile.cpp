@@ -0,0 +1,115 @@
+/**
+ * @file SpillFile.cpp - implementation of SpillFile
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <unistd.h>
+#include "SpillFile.h"
+
+using namespace std;
+typedef uint16_t u16;
+
+uint SpillFile::count = 0;
+
+SpillFile::SpillFile() : file("_spill" + to_string(getpid()) + "_" + to_string(count++)), data_types(), rows(0),
+                         length(0), record(), pieces(), scan(nullptr), block(nullptr), record_ids(nullptr), i(0) {
+    this->file.create();
+}
+
+SpillFile::~SpillFile() {
+    delete this->record_ids;
+    delete this->scan;
+    this->file.drop();
+}
+
+void SpillFile::append(const RowBatch &batch, uint r) {
+    if (this->data_types.empty())
+        for (uint j = 0; j < batch.width(); j++)
+            this->data_types.push_back(batch.get_data_type(j));
+    this->record.clear();
+    for (uint j = 0; j < batch.width(); j++) {
+        if (this->data_types[j] == ColumnAttribute::TEXT) {
+            uint32_t size = batch.get_length(j, r);
+            u16 size16 = size < LONG_TEXT ? (u16) size : (u16) LONG_TEXT;
+            this->record.append((const char *) &size16, sizeof(u16));
+            if (size16 == LONG_TEXT)
+                this->record.append((const char *) &size, sizeof(uint32_t));
+            this->record.append(batch.get_text(j, r), size);
+        } else if (this->data_types[j] == ColumnAttribute::BOOLEAN) {
+            uint8_t b = (uint8_t) batch.get_ns(j)[r];
+            this->record.append((const char *) &b, sizeof(uint8_t));
+        } else {
+            int32_t n = batch.get_ns(j)[r];
+            this->record.append((const char *) &n, sizeof(int32_t));
+        }
+    }
+    // split the row over as many records as it takes, each starting with whether there is more
+    uint chunk = SlottedPage::max_record_size(this->file.get_block_size()) - 1;
+    std::string piece;
+    size_t start = 0;
+    do {
+        size_t size = min((size_t) chunk, this->record.size() - start);
+        piece.assign(1, (char) (start + size < this->record.size()));
+        piece.append(this->record, start, size);
+        Dbt data((void *) piece.data(), (u_int32_t) piece.size());
+        this->file.append(&data);
+        start += size;
+    } while (start < this->record.size());
+    this->rows++;
+    this->length += this->record.size();
+}
+
+RowBatch *SpillFile::next_batch() {
+    if (this->scan == nullptr)
+        this->scan = new HeapFileScan(this->file);
+    RowBatch *batch = new RowBatch((uint) this->data_types.size());
+    while (batch->size() < RowBatch::BATCH_SZ) {
+        while (this->record_ids == nullptr || this->i >= this->record_ids->size()) {
+            this->block = this->scan->next();
+            if (this->block == nullptr) {
+                if (batch->size() > 0)
+                    return batch;
+                delete batch;
+                return nullptr;
+            }
+            delete this->record_ids;
+            this->record_ids = this->block->ids();
+            this->i = 0;
+        }
+        Dbt data;
+        this->block->view((*this->record_ids)[this->i++], data);
+        const char *bytes = (const char *) data.get_data();
+        if (*bytes != 0 || !this->pieces.empty()) {
+            // one piece of a row split over several records
+            this->pieces.append(bytes + 1, data.get_size() - 1);
+            if (*bytes != 0)
+                continue;
+            bytes = this->pieces.data();
+        } else {
+            bytes++;
+        }
+        uint offset = 0;
+        for (uint j = 0; j < this->data_types.size(); j++) {
+            if (this->data_types[j] == ColumnAttribute::TEXT) {
+                uint32_t size = *(u16 *) (bytes + offset);
+                offset += sizeof(u16);
+                if (size == LONG_TEXT) {
+                    size = *(uint32_t *) (bytes + offset);
+                    offset += sizeof(uint32_t);
+                }
+                batch->append_s(j, bytes + offset, size);
+                offset += size;
+            } else if (this->data_types[j] == ColumnAttribute::BOOLEAN) {
+                batch->append_n(j, ColumnAttribute::BOOLEAN, *(uint8_t *) (bytes + offset));
+                offset += sizeof(uint8_t);
+            } else {
+                batch->append_n(j, this->data_types[j], *(int32_t *) (bytes + offset));
+                offset += sizeof(int32_t);
+            }
+        }
+        batch->end_row();
+        this->pieces.clear();
+    }
+    return batch;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file SpillFile.h - temporary file for operators whose rows don't all fit in memory
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "storage_engine.h"
+#include "HeapFile.h"
+
+
+/**
+ * @class SpillFile - rows written out of RowBatches into a temporary HeapFile and read back the same way
+ *
+ * Rows are marshaled like HeapTable records (INT as 4 bytes, BOOLEAN as 1, TEXT as a 2-byte length
+ * and the characters), using the column types of the first batch appended. A TEXT value of
+ * LONG_TEXT bytes or more gets LONG_TEXT for its 2-byte length, followed by its real length in 4
+ * bytes. A row too big for one block is split over as many records as it takes, each with a byte
+ * in front saying whether the row goes on in the next record. Appends go into the HeapFile's last
+ * block in the buffer pool, so the pieces of a row are read back one after another by the bulk
+ * HeapFileScan. The file is dropped when the SpillFile is destroyed.
+ */
+class SpillFile {
+public:
+    SpillFile();
+
+    virtual ~SpillFile();
+
+    SpillFile(const SpillFile &other) = delete;
+
+    SpillFile(SpillFile &&temp) = delete;
+
+    SpillFile &operator=(const SpillFile &other) = delete;
+
+    SpillFile &operator=(SpillFile &&temp) = delete;
+
+    /**
+     * Write out a row.
+     * @param batch  where the row is
+     * @param r      row number within the batch
+     */
+    virtual void append(const RowBatch &batch, uint r);
+
+    /**
+     * Read the next rows back (starting from the beginning the first time it is called).
+     * @returns  up to BATCH_SZ rows (freed by caller), or nullptr when there are no more
+     */
+    virtual RowBatch *next_batch();
+
+    /**
+     * @returns  number of rows written
+     */
+    u_long size() const { return rows; }
+
+    /**
+     * @returns  number of bytes of row data written
+     */
+    u_long bytes() const { return length; }
+
+    /**
+     * 2-byte TEXT length that means the real length follows in 4 bytes
+     */
+    static const u_int16_t LONG_TEXT = UINT16_MAX;
+
+protected:
+    static uint count;  // for naming the files
+
+    HeapFile file;
+    std::vector<ColumnAttribute::DataType> data_types;
+    u_long rows;
+    u_long length;
+    std::string record;  // marshaling buffer
+    std::string pieces;  // a row put back together from its records
+    HeapFileScan *scan;
+    SlottedPage *block;
+    RecordIDs *record_ids;
+    RecordIDs::size_type i;
+};
+
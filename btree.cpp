@@ -3,18 +3,15 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
+#include <algorithm>
+#include <cstring>
+#include <queue>
 #include "btree.h"
 
-BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
-                                                                                                              name,
-                                                                                                              key_columns,
-                                                                                                              unique),
-                                                                                                      closed(true),
-                                                                                                      stat(nullptr),
-                                                                                                      root(nullptr),
-                                                                                                      file(relation.get_table_name() +
-                                                                                                           "-" + name),
-                                                                                                      key_profile() {
+BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique, uint block_size)
+        : DbIndex(relation, name, key_columns, unique), closed(true), stat(nullptr), root(nullptr),
+          file(relation.get_table_name() + "-" + name, HeapFile::BERKELEY_DB, block_size), key_profile(),
+          fill_factor(0.9) {
     if (!unique)
         throw DbRelationError("BTree index must have unique key");
     build_key_profile();
@@ -25,16 +22,12 @@ BTreeIndex::~BTreeIndex() {
     delete root;
 }
 
-// Create the index.
+// Create the index, building it bottom-up from the rows already in the relation.
 void BTreeIndex::create() {
     file.create();
     stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
-    root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
     closed = false;
-    Handles *table_rows = relation.select();
-    for (auto const &row: *table_rows)
-        insert(row);
-    delete table_rows;
+    bulk_load();
 }
 
 // Drop the index.
@@ -51,7 +44,7 @@ void BTreeIndex::open() {
             root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
         else
             root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+        closed = false;
     }
 }
 
@@ -74,22 +67,8 @@ Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
         throw DbRelationError("Can't perform lookup on closed index.");
 
     KeyValue *key = tkey(key_dict);  // Transform the given key dictionary into a tuple-like structure
-    BTreeNode *node = root;
-    uint height = stat->get_height();
+    BTreeLeaf *leaf = find_leaf(key);
 
-    // Navigate down the tree until we reach a leaf
-    while (height > 1) {
-        auto *interior = dynamic_cast<BTreeInterior *>(node);
-        if (interior == nullptr)
-            throw DbRelationError("Expected an interior node.");
-        node = interior->find(key, height);
-        --height;
-    }
-
-    auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-    if (leaf == nullptr)
-        throw DbRelationError("Expected a leaf node.");
-    
     // Perform the lookup in the leaf
     Handles *handles = new Handles();
     try {
@@ -98,21 +77,85 @@ Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
     } catch (const std::out_of_range& e) {
         // Key not found, returning empty handles
     }
-    
+
+    delete leaf;
     delete key;
     return handles;
 }
 
+// Find all the rows whose keys are between min_key and max_key (inclusive). Either may be nullptr
+// for no bound on that end.
 Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
-    // FIXME
+    Handles *handles = new Handles();
+    DbCursor *cursor = range_cursor(min_key, max_key);
+    Handle handle;
+    while (cursor->next(handle))
+        handles->push_back(handle);
+    delete cursor;
+    return handles;
+}
+
+// Streaming version of range(). Descends the tree once, then walks the leaf chain.
+DbCursor *BTreeIndex::range_cursor(ValueDict *min_key, ValueDict *max_key) const {
+    if (closed)
+        throw DbRelationError("Can't perform range query on closed index.");
+    KeyValue *min = min_key == nullptr ? nullptr : tkey(min_key);
+    KeyValue *max = max_key == nullptr ? nullptr : tkey(max_key);
+    BTreeLeaf *start = find_leaf(min);
+    // reading doesn't change the index, but the file's reads aren't const
+    DbCursor *cursor = new BTreeRangeCursor(const_cast<HeapFile &>(this->file), key_profile, start, min, max);
+    delete min;
+    delete max;
+    return cursor;
+}
+
+// Walk down from the root to the leaf where key belongs, or to the leftmost leaf if key is nullptr.
+// Returns the leaf (freed by caller).
+BTreeLeaf *BTreeIndex::find_leaf(const KeyValue *key) const {
+    uint height = stat->get_height();
+    if (height == 1)
+        return new BTreeLeaf(const_cast<HeapFile &>(this->file), root->get_id(), key_profile, false);
+    BTreeNode *node = root;
+    for (; height > 1; height--) {
+        BTreeNode *down = static_cast<BTreeInterior *>(node)->find(key, height);
+        if (node != root)
+            delete node;
+        node = down;
+    }
+    return static_cast<BTreeLeaf *>(node);
 }
 
 // Insert a row with the given handle. Row must exist in relation already.
 void BTreeIndex::insert(Handle handle) {
     open();
-    ValueDict *key = relation.project(handle);
-    KeyValue *tkey = this->tkey(key);
+    Tuple *row = relation.project_tuple(handle, &key_columns);
+    KeyValue *tkey = new KeyValue();
+    for (uint i = 0; i < row->size(); i++)
+        tkey->push_back(row->get(i));
+    delete row;
+    insert(tkey, handle);
+    delete tkey;
+}
+
+// Insert a batch of rows with the given handles. Rows must exist in relation already.
+// The key columns for the whole batch are projected in one go.
+void BTreeIndex::insert_batch(Handles *handles) {
+    open();
+    Tuples *rows = relation.project(handles, &key_columns);
+    KeyValue tkey;
+    for (uint i = 0; i < rows->size(); i++) {
+        Tuple *row = (*rows)[i];
+        tkey.clear();
+        for (uint j = 0; j < row->size(); j++)
+            tkey.push_back(row->get(j));
+        insert(&tkey, (*handles)[i]);
+        delete row;
+    }
+    delete rows;
+}
+
+// Insert the given key for a row, growing a new root if the old one splits.
+void BTreeIndex::insert(const KeyValue *tkey, Handle handle) {
     Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
     if (!BTreeNode::insertion_is_none(insertion)) {
         auto *new_root = new BTreeInterior(file, 0, key_profile, true);
@@ -126,8 +169,6 @@ void BTreeIndex::insert(Handle handle) {
         root = new_root;
         std::cout << "new root: " << *new_root << std::endl;
     }
-    delete key;
-    delete tkey;
 }
 
 // Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
@@ -144,9 +185,34 @@ Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key,
     }
 }
 
+// Remove the entry for a row, which must still be in the relation so its key can be found. Nothing
+// happens if the row isn't in the index. Leaves are allowed to get underfull (even empty); there is no
+// rebalancing.
 void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
-    // FIXME
+    open();
+    Tuple *row = relation.project_tuple(handle, &key_columns);
+    KeyValue tkey;
+    for (uint i = 0; i < row->size(); i++)
+        tkey.push_back(row->get(i));
+    delete row;
+    if (stat->get_height() == 1) {
+        static_cast<BTreeLeaf *>(root)->del(&tkey, handle);  // keep the root's key map up to date
+        return;
+    }
+    BTreeLeaf *leaf = find_leaf(&tkey);
+    try {
+        leaf->del(&tkey, handle);
+    } catch (...) {
+        delete leaf;
+        throw;
+    }
+    delete leaf;
+}
+
+// Write out the nodes that have only been changed in the buffer pool so far.
+void BTreeIndex::sync() {
+    if (!closed)
+        file.sync();
 }
 
 KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
@@ -156,6 +222,105 @@ KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
     return key_value;
 }
 
+// Pull out every key once, sort them, and build the tree bottom-up from the sorted keys. If there are
+// more than SORT_RUN_SZ keys, sorted runs are spilled to temporary files and merged as they are fed in.
+void BTreeIndex::bulk_load() {
+    static const size_t FETCH_SZ = 1000;  // rows to project at a time
+    KeyEntries entries;
+    std::vector<HeapFile *> runs;
+    std::vector<BTreeSortRun *> readers;
+    try {
+        DbCursor *rows = relation.cursor();
+        Handles handles;
+        Handle handle;
+        bool more;
+        do {
+            more = rows->next(handle);
+            if (more)
+                handles.push_back(handle);
+            if (handles.size() == FETCH_SZ || (!more && !handles.empty())) {
+                Tuples *keys = relation.project(&handles, &key_columns);
+                for (uint i = 0; i < keys->size(); i++) {
+                    Tuple *key = (*keys)[i];
+                    entries.push_back(KeyEntry(KeyValue(), handles[i]));
+                    for (uint j = 0; j < key->size(); j++)
+                        entries.back().first.push_back(key->get(j));
+                    delete key;
+                }
+                delete keys;
+                handles.clear();
+                if (entries.size() >= SORT_RUN_SZ)
+                    runs.push_back(spill(entries, runs.size()));
+            }
+        } while (more);
+        delete rows;
+
+        BTreeBuilder builder(file, key_profile, fill_factor);
+        if (runs.empty()) {
+            std::sort(entries.begin(), entries.end());
+            for (auto const &entry: entries)
+                builder.add(entry.first, entry.second);
+        } else {
+            // k-way merge of the sorted runs
+            if (!entries.empty())
+                runs.push_back(spill(entries, runs.size()));
+            for (auto const &run: runs)
+                readers.push_back(new BTreeSortRun(run, key_profile));
+            runs.clear();
+            typedef std::pair<KeyEntry, uint> Head;
+            std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+            KeyEntry entry;
+            for (uint i = 0; i < readers.size(); i++)
+                if (readers[i]->next(entry))
+                    heads.push(Head(entry, i));
+            while (!heads.empty()) {
+                Head head = heads.top();
+                heads.pop();
+                builder.add(head.first.first, head.first.second);
+                if (readers[head.second]->next(entry))
+                    heads.push(Head(entry, head.second));
+            }
+            for (auto const &reader: readers)
+                delete reader;
+            readers.clear();
+        }
+        uint height;
+        BlockID root_id = builder.finish(height);
+        stat->set_root_id(root_id);
+        stat->set_height(height);
+        stat->save();
+        if (height == 1)
+            root = new BTreeLeaf(file, root_id, key_profile, false);
+        else
+            root = new BTreeInterior(file, root_id, key_profile, false);
+    } catch (...) {
+        for (auto const &reader: readers)
+            delete reader;
+        for (auto const &run: runs) {
+            run->drop();
+            delete run;
+        }
+        throw;
+    }
+}
+
+// Sort the given entries and write them out to a new temporary file. Empties entries.
+HeapFile *BTreeIndex::spill(KeyEntries &entries, uint run) {
+    std::sort(entries.begin(), entries.end());
+    HeapFile *run_file = new HeapFile(relation.get_table_name() + "-" + name + "-sort" + std::to_string(run),
+                                      HeapFile::BERKELEY_DB, this->file.get_block_size());
+    run_file->create();
+    for (auto const &entry: entries) {
+        Dbt *data = BTreeSortRun::marshal(entry, key_profile, run_file->get_block_size());
+        run_file->append(data);
+        delete[] (char *) data->get_data();
+        delete data;
+    }
+    run_file->sync();
+    entries.clear();
+    return run_file;
+}
+
 // Figure out the data types of each key component and encode them in key_profile, a list of int/str classes.
 void BTreeIndex::build_key_profile() {
     std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
@@ -169,6 +334,202 @@ void BTreeIndex::build_key_profile() {
         key_profile.push_back(types_by_colname[column_name]);
 }
 
+/**
+ * Constructor
+ * @param file         the index's file
+ * @param key_profile  types of the key columns
+ * @param start        leaf to start in (freed by the cursor)
+ * @param min_key      lowest key to return (copied), or nullptr to start at the beginning of start
+ * @param max_key      highest key to return (copied), or nullptr to go to the end of the index
+ */
+BTreeRangeCursor::BTreeRangeCursor(HeapFile &file, const KeyProfile &key_profile, BTreeLeaf *start,
+                                   const KeyValue *min_key, const KeyValue *max_key) : file(file),
+                                                                                      key_profile(key_profile),
+                                                                                      leaf(start),
+                                                                                      max_key(nullptr) {
+    if (max_key != nullptr)
+        this->max_key = new KeyValue(*max_key);
+    const std::map<KeyValue, Handle> &key_map = this->leaf->get_key_map();
+    this->it = min_key == nullptr ? key_map.begin() : key_map.lower_bound(*min_key);
+}
+
+BTreeRangeCursor::~BTreeRangeCursor() {
+    delete this->leaf;
+    delete this->max_key;
+}
+
+// Get the next handle in the range, moving along the leaf chain as needed.
+bool BTreeRangeCursor::next(Handle &handle) {
+    if (this->leaf == nullptr)
+        return false;
+    while (this->it == this->leaf->get_key_map().end()) {
+        BlockID next_leaf = this->leaf->get_next_leaf();
+        delete this->leaf;
+        this->leaf = nullptr;
+        if (next_leaf == 0)
+            return false;
+        this->leaf = new BTreeLeaf(this->file, next_leaf, this->key_profile, false);
+        this->it = this->leaf->get_key_map().begin();
+    }
+    if (this->max_key != nullptr && *this->max_key < this->it->first) {
+        delete this->leaf;
+        this->leaf = nullptr;
+        return false;
+    }
+    handle = this->it->second;
+    ++this->it;
+    return true;
+}
+
+BTreeBuilder::BTreeBuilder(HeapFile &file, const KeyProfile &key_profile, double fill_factor) : file(file),
+                                                                                                 key_profile(key_profile),
+                                                                                                 reserve(0),
+                                                                                                 leaf(nullptr),
+                                                                                                 empty(true),
+                                                                                                 last_key(),
+                                                                                                 levels() {
+    if (fill_factor > 0.0 && fill_factor < 1.0)
+        this->reserve = (uint) ((1.0 - fill_factor) * file.get_block_size());
+    this->leaf = new BTreeLeaf(file, 0, key_profile, true);
+}
+
+BTreeBuilder::~BTreeBuilder() {
+    delete this->leaf;
+    for (auto const &node: this->levels)
+        delete node;
+}
+
+// Add the next key, which must sort after all the ones before it, along with its row's handle.
+void BTreeBuilder::add(const KeyValue &key, Handle handle) {
+    if (!this->empty && !(this->last_key < key))
+        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    if (!this->leaf->append(&key, handle, this->reserve)) {
+        // this leaf is done, so chain on a new one and tell the level above about it
+        BTreeLeaf *next = new BTreeLeaf(this->file, 0, this->key_profile, true);
+        this->leaf->set_next_leaf(next->get_id());
+        this->leaf->save();
+        BlockID left = this->leaf->get_id();
+        delete this->leaf;
+        this->leaf = next;
+        if (!this->leaf->append(&key, handle, this->reserve))
+            throw DbRelationError("index key too big to fit in a block");
+        push_up(0, left, key, next->get_id());
+    }
+    this->last_key = key;
+    this->empty = false;
+}
+
+// Add the boundary and the node to its right into the rightmost node at the given interior level,
+// starting the level (with left as its first pointer) the first time it's needed.
+void BTreeBuilder::push_up(uint level, BlockID left, const KeyValue &boundary, BlockID right) {
+    if (level == this->levels.size())
+        this->levels.push_back(new_interior(left));
+    BTreeInterior *node = this->levels[level];
+    if (!node->append(&boundary, right, this->reserve)) {
+        // start a new node with right as its first pointer and move the boundary up a level
+        BTreeInterior *next = new_interior(right);
+        node->save();
+        this->levels[level] = next;
+        push_up(level + 1, node->get_id(), boundary, next->get_id());
+        delete node;
+    }
+}
+
+// Start an interior node with the given first pointer.
+BTreeInterior *BTreeBuilder::new_interior(BlockID first) {
+    BTreeInterior *node = new BTreeInterior(this->file, 0, this->key_profile, true);
+    node->set_first(first);
+    node->save();
+    return node;
+}
+
+// Write out the rightmost node on each level. Returns the block id of the root and sets height.
+BlockID BTreeBuilder::finish(uint &height) {
+    this->leaf->save();
+    BlockID root_id = this->leaf->get_id();
+    for (auto const &node: this->levels) {
+        node->save();
+        root_id = node->get_id();
+    }
+    height = (uint) this->levels.size() + 1;
+    return root_id;
+}
+
+BTreeSortRun::BTreeSortRun(HeapFile *file, const KeyProfile &key_profile) : file(file),
+                                                                            key_profile(key_profile),
+                                                                            scan(new HeapFileScan(*file, BUFFER_SZ)),
+                                                                            block(nullptr),
+                                                                            record_ids(nullptr),
+                                                                            i(0) {
+}
+
+BTreeSortRun::~BTreeSortRun() {
+    delete this->record_ids;
+    delete this->scan;
+    this->file->drop();
+    delete this->file;
+}
+
+// Get the next entry of the run. Returns false when there are no more.
+bool BTreeSortRun::next(KeyEntry &entry) {
+    while (this->record_ids == nullptr || this->i >= this->record_ids->size()) {
+        this->block = this->scan->next();
+        if (this->block == nullptr)
+            return false;
+        delete this->record_ids;
+        this->record_ids = this->block->ids();
+        this->i = 0;
+    }
+    Dbt data;
+    this->block->view((*this->record_ids)[this->i++], data);
+    char *bytes = (char *) data.get_data();
+    entry.second = Handle(*(BlockID *) bytes, *(RecordID *) (bytes + sizeof(BlockID)));
+    uint offset = sizeof(BlockID) + sizeof(RecordID);
+    entry.first.clear();
+    Value value;
+    for (auto const &data_type: this->key_profile) {
+        value.data_type = data_type;
+        if (data_type == ColumnAttribute::DataType::TEXT) {
+            u_int16_t size = *(u_int16_t *) (bytes + offset);
+            offset += sizeof(u_int16_t);
+            value.s.assign(bytes + offset, size);
+            offset += size;
+        } else {
+            value.n = *(int32_t *) (bytes + offset);
+            offset += sizeof(int32_t);
+        }
+        entry.first.push_back(value);
+    }
+    return true;
+}
+
+// Convert a key entry into bytes for a run file (with blocks of block_size): the handle followed by each key value.
+Dbt *BTreeSortRun::marshal(const KeyEntry &entry, const KeyProfile &key_profile, uint block_size) {
+    uint size = sizeof(BlockID) + sizeof(RecordID);
+    for (uint i = 0; i < key_profile.size(); i++)
+        size += key_profile[i] == ColumnAttribute::DataType::TEXT ? sizeof(u_int16_t) + entry.first[i].s.length()
+                                                                 : sizeof(int32_t);
+    if (size > block_size - 8)
+        throw DbRelationError("index key too big to marshal");
+    char *bytes = new char[size];
+    *(BlockID *) bytes = entry.second.first;
+    *(RecordID *) (bytes + sizeof(BlockID)) = entry.second.second;
+    uint offset = sizeof(BlockID) + sizeof(RecordID);
+    for (uint i = 0; i < key_profile.size(); i++) {
+        const Value &value = entry.first[i];
+        if (key_profile[i] == ColumnAttribute::DataType::TEXT) {
+            *(u_int16_t *) (bytes + offset) = (u_int16_t) value.s.length();
+            offset += sizeof(u_int16_t);
+            memcpy(bytes + offset, value.s.c_str(), value.s.length());
+            offset += value.s.length();
+        } else {
+            *(int32_t *) (bytes + offset) = value.n;
+            offset += sizeof(int32_t);
+        }
+    }
+    return new Dbt(bytes, size);
+}
+
 bool test_btree() {
     ColumnNames column_names;
     column_names.push_back("a");
@@ -240,7 +601,42 @@ bool test_btree() {
             delete result;
         }
     std::cout << "lookup test passed!" << std::endl;
-    return true;
+
+    // test range
+    ValueDict minkey, maxkey;
+    minkey["a"] = 100;
+    maxkey["a"] = 310;
+    handles = index.range(&minkey, &maxkey);
+    Tuples *results = table.project(handles);
+    if (results->size() != 211) {
+        std::cout << "range failed: " << results->size() << " rows" << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 211; i++) {
+        if (results->at(i)->get_n(0) != 100 + i) {
+            Tuple *wrong = results->at(i);
+            std::cout << "range failed: " << i << ", a: " << wrong->get_n(0) << ", b: " << wrong->get_n(1)
+                      << std::endl;
+            return false;
+        }
+    }
+    delete handles;
+    for (auto tuple: *results)
+        delete tuple;
+    delete results;
+
+    // test range from beginning and to end
+    handles = index.range(nullptr, nullptr);
+    u_long count_i = handles->size();
+    delete handles;
+    handles = table.select();
+    u_long count_t = handles->size();
+    delete handles;
+    if (count_i != count_t) {
+        std::cout << "full range failed: " << count_i << std::endl;
+        return false;
+    }
+    std::cout << "range test passed!" << std::endl;
 
     // test delete
     ValueDict row;
@@ -267,35 +663,9 @@ bool test_btree() {
     }
     delete handles;
 
-    // test range
-    ValueDict minkey, maxkey;
-    minkey["a"] = 100;
-    maxkey["a"] = 310;
-    handles = index.range(&minkey, &maxkey);
-    ValueDicts *results = table.project(handles);
-    for (int i = 0; i < 210; i++) {
-        if (results->at(i)->at("a") != Value(100 + i)) {
-            ValueDict *wrong = results->at(i);
-            std::cout << "range failed: " << i << ", a: " << wrong->at("a").n << ", b: " << wrong->at("b").n
-                      << std::endl;
-            return false;
-        }
-    }
-    delete handles;
-    for (auto vd: *results)
-        delete vd;
-    delete results;
-
-    // test range from beginning and to end
-    handles = index.range(nullptr, nullptr);
-    u_long count_i = handles->size();
-    delete handles;
+    // test delete everything
     handles = table.select();
-    u_long count_t = handles->size();
-    if (count_i != count_t) {
-        std::cout << "full range failed: " << count_i << std::endl;
-        return false;
-    }
+    count_t = handles->size();
     for (u_long i = 0; i < count_t; i++)
         index.del((*handles)[i]);
     delete handles;
@@ -306,6 +676,7 @@ bool test_btree() {
         std::cout << "delete everything failed: " << count_i << std::endl;
         return false;
     }
+    std::cout << "delete test passed!" << std::endl;
     index.drop();
     table.drop();
     return true;
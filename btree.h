@@ -8,9 +8,18 @@
 
 #include "BTreeNode.h"
 
+typedef std::pair<KeyValue, Handle> KeyEntry;
+typedef std::vector<KeyEntry> KeyEntries;
+
 class BTreeIndex : public DbIndex {
 public:
-    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+    /**
+     * How many keys create() sorts in memory at once; more than this are sorted externally.
+     */
+    static const size_t SORT_RUN_SZ = 250000;
+
+    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+               uint block_size = DbBlock::BLOCK_SZ);
 
     virtual ~BTreeIndex();
 
@@ -26,12 +35,24 @@ public:
 
     virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
 
+    virtual DbCursor *range_cursor(ValueDict *min_key, ValueDict *max_key) const;
+
     virtual void insert(Handle handle);
 
+    virtual void insert_batch(Handles *handles);
+
     virtual void del(Handle handle);
 
+    virtual void sync();
+
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
 
+    /**
+     * Set how full create() packs each node, between 0 and 1 (default 0.9). Leaving some room
+     * means later inserts don't immediately split every node.
+     */
+    void set_fill_factor(double fill_factor) { this->fill_factor = fill_factor; }
+
 protected:
     static const BlockID STAT = 1;
     bool closed;
@@ -39,14 +60,124 @@ protected:
     BTreeNode *root;
     HeapFile file;
     KeyProfile key_profile;
+    double fill_factor;
 
     void build_key_profile();
 
+    void bulk_load();
+
+    HeapFile *spill(KeyEntries &entries, uint run);
+
     Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
 
+    BTreeLeaf *find_leaf(const KeyValue *key) const;
+
+    void insert(const KeyValue *key, Handle handle);
+
     Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
 };
 
+/**
+ * @class BTreeRangeCursor - streaming range scan of a BTreeIndex (implementation of DbCursor)
+ *
+ * Starts at the leaf where the min key belongs and follows the leaves' next_leaf chain until it
+ * passes the max key, so only one leaf is in memory at a time.
+ */
+class BTreeRangeCursor : public DbCursor {
+public:
+    BTreeRangeCursor(HeapFile &file, const KeyProfile &key_profile, BTreeLeaf *start, const KeyValue *min_key,
+                     const KeyValue *max_key);
+
+    virtual ~BTreeRangeCursor();
+
+    BTreeRangeCursor(const BTreeRangeCursor &other) = delete;
+
+    BTreeRangeCursor(BTreeRangeCursor &&temp) = delete;
+
+    BTreeRangeCursor &operator=(const BTreeRangeCursor &other) = delete;
+
+    BTreeRangeCursor &operator=(BTreeRangeCursor &&temp) = delete;
+
+    virtual bool next(Handle &handle);
+
+protected:
+    HeapFile &file;
+    const KeyProfile &key_profile;
+    BTreeLeaf *leaf;
+    KeyValue *max_key;
+    std::map<KeyValue, Handle>::const_iterator it;
+};
+
+/**
+ * @class BTreeBuilder - builds a BTree bottom-up from keys handed to it in sorted order
+ *
+ * Packs each leaf until it is fill_factor full, then starts the next one, pushing the new leaf's
+ * first key up into the rightmost interior node of the level above (which is packed the same way,
+ * and so on up). Every node is written just once when it is finished.
+ */
+class BTreeBuilder {
+public:
+    BTreeBuilder(HeapFile &file, const KeyProfile &key_profile, double fill_factor);
+
+    virtual ~BTreeBuilder();
+
+    BTreeBuilder(const BTreeBuilder &other) = delete;
+
+    BTreeBuilder(BTreeBuilder &&temp) = delete;
+
+    BTreeBuilder &operator=(const BTreeBuilder &other) = delete;
+
+    BTreeBuilder &operator=(BTreeBuilder &&temp) = delete;
+
+    void add(const KeyValue &key, Handle handle);
+
+    BlockID finish(uint &height);
+
+protected:
+    HeapFile &file;
+    const KeyProfile &key_profile;
+    uint reserve;
+    BTreeLeaf *leaf;
+    bool empty;
+    KeyValue last_key;
+    std::vector<BTreeInterior *> levels;  // rightmost node at each interior level, bottom up
+
+    void push_up(uint level, BlockID left, const KeyValue &boundary, BlockID right);
+
+    BTreeInterior *new_interior(BlockID first);
+};
+
+/**
+ * @class BTreeSortRun - reads back a sorted run of key entries spilled to a temporary file
+ */
+class BTreeSortRun {
+public:
+    BTreeSortRun(HeapFile *file, const KeyProfile &key_profile);
+
+    virtual ~BTreeSortRun();
+
+    BTreeSortRun(const BTreeSortRun &other) = delete;
+
+    BTreeSortRun(BTreeSortRun &&temp) = delete;
+
+    BTreeSortRun &operator=(const BTreeSortRun &other) = delete;
+
+    BTreeSortRun &operator=(BTreeSortRun &&temp) = delete;
+
+    bool next(KeyEntry &entry);
+
+    static Dbt *marshal(const KeyEntry &entry, const KeyProfile &key_profile, uint block_size);
+
+protected:
+    static const uint BUFFER_SZ = 8 * DbBlock::BLOCK_SZ;
+    HeapFile *file;
+    const KeyProfile &key_profile;
+    HeapFileScan *scan;
+    SlottedPage *block;
+    RecordIDs *record_ids;
+    RecordIDs::size_type i;
+};
+
 bool test_btree();
 
 
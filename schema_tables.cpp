@@ -54,8 +54,11 @@ std::map<Identifier, DbRelation *> Tables::table_cache;
 // get the column name for _tables column
 ColumnNames &Tables::COLUMN_NAMES() {
     static ColumnNames cn;
-    if (cn.empty())
+    if (cn.empty()) {
         cn.push_back("table_name");
+        cn.push_back("page_size");
+        cn.push_back("storage");
+    }
     return cn;
 }
 
@@ -63,13 +66,14 @@ ColumnNames &Tables::COLUMN_NAMES() {
 ColumnAttributes &Tables::COLUMN_ATTRIBUTES() {
     static ColumnAttributes cas;
     if (cas.empty()) {
-        ColumnAttribute ca(ColumnAttribute::TEXT);
-        cas.push_back(ca);
+        cas.push_back(ColumnAttribute(ColumnAttribute::TEXT));  // table_name
+        cas.push_back(ColumnAttribute(ColumnAttribute::INT));  // page_size
+        cas.push_back(ColumnAttribute(ColumnAttribute::TEXT));  // storage
     }
     return cas;
 }
 
-// ctor - we have a fixed table structure of just one column: table_name
+// ctor - we have a fixed table structure: table_name, page_size, and storage
 Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
     Tables::table_cache[TABLE_NAME] = this;
     if (Tables::columns_table == nullptr)
@@ -81,6 +85,8 @@ Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
 void Tables::create() {
     HeapTable::create();
     ValueDict row;
+    row["page_size"] = Value((int32_t) DbBlock::BLOCK_SZ);
+    row["storage"] = Value(storage_name(HeapFile::BERKELEY_DB));
     row["table_name"] = Value("_tables");
     insert(&row);
     row["table_name"] = Value("_columns");
@@ -92,7 +98,9 @@ void Tables::create() {
 // Manually check that table_name is unique.
 Handle Tables::insert(const ValueDict *row) {
     // Try SELECT * FROM _tables WHERE table_name = row["table_name"] and it should return nothing
-    Handles *handles = select(row);
+    ValueDict where;
+    where["table_name"] = row->at("table_name");
+    Handles *handles = select(&where);
     bool unique = handles->empty();
     delete handles;
     if (!unique)
@@ -159,11 +167,40 @@ DbRelation &Tables::get_table(Identifier table_name) {
     ColumnNames column_names;
     ColumnAttributes column_attributes;
     get_columns(table_name, column_names, column_attributes);
-    DbRelation *table = new HeapTable(table_name, column_names, column_attributes);
+    HeapFile::Storage storage;
+    uint page_size;
+    get_storage(table_name, storage, page_size);
+    DbRelation *table = new HeapTable(table_name, column_names, column_attributes, storage, page_size);
     Tables::table_cache[table_name] = table;
     return *table;
 }
 
+// Look up the storage and page size the given table was created with.
+void Tables::get_storage(Identifier table_name, HeapFile::Storage &storage, uint &page_size) {
+    // SELECT page_size, storage FROM _tables WHERE table_name = <table_name>
+    DbRelation &tables = *Tables::table_cache.at(TABLE_NAME);
+    ValueDict where;
+    where["table_name"] = table_name;
+    Handles *handles = tables.select(&where);
+    page_size = 0;
+    storage = HeapFile::BERKELEY_DB;
+    for (auto const &handle: *handles) {
+        ValueDict *row = tables.project(handle);
+        page_size = (uint) (*row)["page_size"].n;
+        if ((*row)["storage"].s == storage_name(HeapFile::PAGE_FILE))
+            storage = HeapFile::PAGE_FILE;  // anything else (or empty, in rows from before it was recorded) is Berkeley DB
+        delete row;
+    }
+    delete handles;
+    if (page_size == 0)
+        page_size = DbBlock::BLOCK_SZ;  // zero in rows from before page sizes were recorded
+}
+
+// Name of a kind of storage, as recorded in _tables.
+std::string Tables::storage_name(HeapFile::Storage storage) {
+    return storage == HeapFile::PAGE_FILE ? "pages" : "db";
+}
+
 
 /*
  * ****************************
@@ -207,6 +244,12 @@ void Columns::create() {
     row["table_name"] = Value("_tables");
     row["column_name"] = Value("table_name");
     insert(&row);
+    row["column_name"] = Value("page_size");
+    row["data_type"] = Value("INT");
+    insert(&row);
+    row["column_name"] = Value("storage");
+    row["data_type"] = Value("TEXT");
+    insert(&row);
     row["table_name"] = Value("_columns");
     row["column_name"] = Value("table_name");
     insert(&row);
@@ -230,6 +273,9 @@ void Columns::create() {
     row["column_name"] = Value("is_unique");
     row["data_type"] = Value("BOOLEAN");
     insert(&row);
+    row["column_name"] = Value("page_size");
+    row["data_type"] = Value("INT");
+    insert(&row);
 }
 
 // Manually check that (table_name, column_name) is unique.
@@ -275,6 +321,7 @@ ColumnNames &Indices::COLUMN_NAMES() {
         cn.push_back("column_name");
         cn.push_back("index_type");
         cn.push_back("is_unique");
+        cn.push_back("page_size");
     }
     return cn;
 }
@@ -293,6 +340,8 @@ ColumnAttributes &Indices::COLUMN_ATTRIBUTES() {
         cas.push_back(ca);  // index_type
         ca.set_data_type(ColumnAttribute::BOOLEAN);
         cas.push_back(ca);  // is_unique
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // page_size
     }
     return cas;
 }
@@ -342,7 +391,7 @@ void Indices::del(Handle handle) {
 
 // Return a list of column names and column attributes for given table.
 void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
-                          bool &is_unique) {
+                          bool &is_unique, uint &page_size) {
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
@@ -361,8 +410,11 @@ void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNa
             size = which;
         is_unique = (*row)["is_unique"].n != 0;
         is_hash = (*row)["index_type"].s == "HASH";
+        page_size = (uint) (*row)["page_size"].n;
         delete row;
     }
+    if (page_size == 0)
+        page_size = DbBlock::BLOCK_SZ;  // rows from before page sizes were recorded
     for (uint i = 0; i < size; i++)
         column_names.push_back(colnames[i]);
     delete handles;
@@ -399,13 +451,14 @@ DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     // otherwise assume it is a DummyIndex (for now)
     ColumnNames column_names;
     bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    uint page_size = 0;
+    get_columns(table_name, index_name, column_names, is_hash, is_unique, page_size);
     DbRelation &table = Tables::get_table(table_name);
     DbIndex *index;
     if (is_hash) {
         index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);
+        index = new BTreeIndex(table, index_name, column_names, is_unique, page_size);
     }
     Indices::index_cache[cache_key] = index;
     return *index;
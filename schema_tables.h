@@ -60,6 +60,20 @@ public:
      */
     static DbRelation &get_table(Identifier table_name);
 
+    /**
+     * Get the storage and page size a given table was created with.
+     * @param table_name  table to look up
+     * @param storage     returned by reference: where its blocks are kept (HeapFile::BERKELEY_DB if none was recorded)
+     * @param page_size   returned by reference: its page size (DbBlock::BLOCK_SZ if none was recorded)
+     */
+    static void get_storage(Identifier table_name, HeapFile::Storage &storage, uint &page_size);
+
+    /**
+     * @param storage  a kind of storage
+     * @returns        its name as recorded in _tables: "db" or "pages" (after the files' extensions)
+     */
+    static std::string storage_name(HeapFile::Storage storage);
+
 protected:
     // hard-coded columns for _tables table
     static ColumnNames &COLUMN_NAMES();
@@ -125,9 +139,11 @@ public:
      * @param is_hash         returned by reference: set to False if the
      *                        requested index is a btree index
      * @param is_unique       search key for this index is a key for the relation
+     * @param page_size       returned by reference: page size the index was created
+     *                        with (DbBlock::BLOCK_SZ if none was recorded)
      */
     virtual void get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
-                             bool &is_unique);
+                             bool &is_unique, uint &page_size);
 
     /**
      * Get the instantiated DbIndex for the given index.
@@ -11,6 +11,8 @@
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
 #include "btree.h"
+#include "BufferPool.h"
+#include "EvalOperator.h"
 
 using namespace std;
 using namespace hsql;
@@ -24,14 +26,36 @@ void initialize_environment(char *envHome);
 /**
  * Main entry point of the sql5300 program
  * @args dbenvpath  the path to the BerkeleyDB database environment
+ * @args frames     optional number of blocks the buffer pool holds (default BufferPool::DEFAULT_FRAMES)
+ * @args page_size  optional page size in bytes for the tables and indices created (default DbBlock::BLOCK_SZ)
+ * @args storage    optional storage for the tables created: db (Berkeley DB, the default) or pages (plain page files)
  */
 int main(int argc, char *argv[]) {
 
     // Open/create the db environment
-    if (argc != 2) {
-        cerr << "Usage: cpsc5300: dbenvpath" << endl;
+    if (argc < 2 || argc > 5) {
+        cerr << "Usage: cpsc5300: dbenvpath [frames [page_size [db|pages]]]" << endl;
         return EXIT_FAILURE;
     }
+    if (argc >= 3)
+        BufferPool::set_default_frames((uint) atoi(argv[2]));
+    if (argc >= 4) {
+        try {
+            SQLExec::set_page_size((uint) atoi(argv[3]));
+        } catch (SQLExecError &e) {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc == 5) {
+        string storage = argv[4];
+        if (storage == Tables::storage_name(HeapFile::PAGE_FILE)) {
+            SQLExec::set_storage(HeapFile::PAGE_FILE);
+        } else if (storage != Tables::storage_name(HeapFile::BERKELEY_DB)) {
+            cerr << "storage has to be db or pages" << endl;
+            return EXIT_FAILURE;
+        }
+    }
     initialize_environment(argv[1]);
 
     // Enter the SQL shell loop
@@ -46,6 +70,8 @@ int main(int argc, char *argv[]) {
         if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+            cout << "test_eval_operators: " << (test_eval_operators() ? "ok" : "failed") << endl;
+            cout << "test_eval_plan: " << (test_eval_plan() ? "ok" : "failed") << endl;
             continue;
         }
 
@@ -4,6 +4,7 @@
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
 #include <algorithm>
+#include <cstring>
 #include "storage_engine.h"
 
 bool Value::operator==(const Value &other) const {
@@ -48,6 +49,59 @@ std::ostream &operator<<(std::ostream &out, const Value &value) {
     return out;
 }
 
+// Hand out the next of the materialized handles
+bool HandlesCursor::next(Handle &handle) {
+    if (this->i >= this->handles->size())
+        return false;
+    handle = (*this->handles)[this->i++];
+    return true;
+}
+
+// Default cursor just materializes a select() -- storage engines that can stream should override
+DbCursor *DbRelation::cursor() {
+    return new HandlesCursor(select());
+}
+
+// Default cursor just materializes a select(where) -- storage engines that can stream should override
+DbCursor *DbRelation::cursor(const ValueDict *where) {
+    return new HandlesCursor(select(where));
+}
+
+// Default cursor drains current_selection and materializes a select(handles, where)
+DbCursor *DbRelation::cursor(DbCursor *current_selection, const ValueDict *where) {
+    Handles handles;
+    Handle handle;
+    while (current_selection->next(handle))
+        handles.push_back(handle);
+    delete current_selection;
+    return new HandlesCursor(select(&handles, where));
+}
+
+// Default cursor checks the predicate against each row's projection of the columns it looks at
+DbCursor *DbRelation::cursor(const Predicate *where) {
+    return cursor(cursor(), where);
+}
+
+// Default cursor drains current_selection, checking each row's projection of the columns the predicate looks at
+DbCursor *DbRelation::cursor(DbCursor *current_selection, const Predicate *where) {
+    ColumnNames column_names;
+    if (where != nullptr)
+        where->get_column_names(column_names);
+    if (column_names.empty())
+        return current_selection;
+    CompiledPredicate predicate(where, column_names);
+    Handles *handles = new Handles();
+    Handle handle;
+    while (current_selection->next(handle)) {
+        Tuple *row = project_tuple(handle, &column_names);
+        if (predicate.matches(*row))
+            handles->push_back(handle);
+        delete row;
+    }
+    delete current_selection;
+    return new HandlesCursor(handles);
+}
+
 // Get only selected column attributes
 ColumnAttributes *DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
@@ -71,30 +125,455 @@ ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     return this->project(handle, &t);
 }
 
+// Default tuple projection goes through the ValueDict version -- storage engines should override
+Tuple *DbRelation::project_tuple(Handle handle) {
+    return project_tuple(handle, &this->column_names);
+}
+
+// Default tuple projection goes through the ValueDict version -- storage engines should override
+Tuple *DbRelation::project_tuple(Handle handle, const ColumnNames *column_names) {
+    ValueDict *row = project(handle, column_names);
+    Tuple *tuple = Tuple::from_dict(*row, column_names->empty() ? this->column_names : *column_names);
+    delete row;
+    return tuple;
+}
+
+// Default batch projection goes a row at a time through project_tuple -- storage engines should override
+uint DbRelation::project_batch(DbCursor *cursor, const ColumnNames *column_names, RowBatch *batch, uint max_rows) {
+    uint n = 0;
+    Handle handle;
+    while (n < max_rows && cursor->next(handle)) {
+        Tuple *row = project_tuple(handle, column_names);
+        batch->append(*row);
+        delete row;
+        n++;
+    }
+    return n;
+}
+
 // Do a projection for each of a list of handles
-ValueDicts *DbRelation::project(Handles *handles) {
-    ValueDicts *ret = new ValueDicts();
+Tuples *DbRelation::project(Handles *handles) {
+    Tuples *ret = new Tuples();
+    ret->reserve(handles->size());
     for (auto const &handle: *handles)
-        ret->push_back(project(handle));
+        ret->push_back(project_tuple(handle));
     return ret;
 }
 
 // Do a projection for each of a list of handles
-ValueDicts *DbRelation::project(Handles *handles, const ColumnNames *column_names) {
-    ValueDicts *ret = new ValueDicts();
+Tuples *DbRelation::project(Handles *handles, const ColumnNames *column_names) {
+    Tuples *ret = new Tuples();
+    ret->reserve(handles->size());
     for (auto const &handle: *handles)
-        ret->push_back(project(handle, column_names));
+        ret->push_back(project_tuple(handle, column_names));
     return ret;
 }
 
 // Do a projection for each of a list of handles
-ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where) {
+Tuples *DbRelation::project(Handles *handles, const ValueDict *where) {
     ColumnNames t;
     for (auto const &column: *where)
         t.push_back(column.first);
-    ValueDicts *ret = new ValueDicts();
-    for (auto const &handle: *handles)
-        ret->push_back(project(handle, &t));
+    return project(handles, &t);
+}
+
+Predicate::Predicate(Type type, const Identifier &column_name, const Value &value) : type(type),
+                                                                                   column_name(column_name),
+                                                                                   values(1, value), operands() {
+}
+
+Predicate::Predicate(const Identifier &column_name, const Value &low, const Value &high) : type(BETWEEN),
+                                                                                           column_name(column_name),
+                                                                                           values({low, high}),
+                                                                                           operands() {
+}
+
+Predicate::Predicate(const Identifier &column_name, const std::vector<Value> &values) : type(IN),
+                                                                                        column_name(column_name),
+                                                                                        values(values), operands() {
+}
+
+Predicate::Predicate(Type type, const std::vector<Predicate *> &operands) : type(type), column_name(), values(),
+                                                                            operands(operands) {
+}
+
+Predicate::Predicate(const ValueDict &conjunction) : type(AND), column_name(), values(), operands() {
+    for (auto const &condition: conjunction)
+        this->operands.push_back(new Predicate(EQ, condition.first, condition.second));
+}
+
+Predicate::Predicate(const Predicate &other) : type(other.type), column_name(other.column_name),
+                                               values(other.values), operands() {
+    for (auto const &operand: other.operands)
+        this->operands.push_back(new Predicate(*operand));
+}
+
+Predicate::~Predicate() {
+    for (auto const &operand: this->operands)
+        delete operand;
+}
+
+void Predicate::get_conjuncts(std::vector<const Predicate *> &conjuncts) const {
+    if (this->type != AND) {
+        conjuncts.push_back(this);
+        return;
+    }
+    for (auto const &operand: this->operands)
+        operand->get_conjuncts(conjuncts);
+}
+
+void Predicate::get_column_names(ColumnNames &column_names) const {
+    if (is_leaf() && std::find(column_names.begin(), column_names.end(), this->column_name) == column_names.end())
+        column_names.push_back(this->column_name);
+    for (auto const &operand: this->operands)
+        operand->get_column_names(column_names);
+}
+
+CompiledPredicate::CompiledPredicate(const Predicate *where, const ColumnNames &column_names) : nodes() {
+    if (where != nullptr)
+        compile(where, column_names);
+    if (this->nodes.size() == 1 && this->nodes[0].type == Predicate::AND)
+        this->nodes.clear();  // AND of nothing
+}
+
+// Add the node for a predicate (and those for its operands after it), returning its node number
+uint CompiledPredicate::compile(const Predicate *where, const ColumnNames &column_names) {
+    uint i = (uint) this->nodes.size();
+    this->nodes.push_back(Node());
+    Node &node = this->nodes[i];
+    node.type = where->get_type();
+    node.column = (uint) column_names.size();
+    node.data_type = ColumnAttribute::INT;
+    if (where->is_leaf()) {
+        auto it = std::find(column_names.begin(), column_names.end(), where->get_column_name());
+        if (it == column_names.end())
+            throw DbRelationError("unknown column " + where->get_column_name());
+        node.column = (uint) (it - column_names.begin());
+        if (node.type == Predicate::IN) {
+            for (auto const &value: where->get_values())
+                if (value.data_type == ColumnAttribute::TEXT)
+                    node.ss.push_back(value.s);
+                else if (value.data_type == ColumnAttribute::INT)
+                    node.ns.insert(value.n);
+            std::sort(node.ss.begin(), node.ss.end());
+        } else {
+            node.values = where->get_values();
+            node.data_type = node.values[0].data_type;
+            for (auto const &value: node.values)
+                if (value.data_type != node.data_type)
+                    node.type = Predicate::IN;  // like BETWEEN 1 AND 'z', never true, so make it IN ()
+        }
+        return i;
+    }
+
+    std::vector<uint> operands;
+    for (auto const &operand: where->get_operands())
+        operands.push_back(compile(operand, column_names));
+    if (where->get_type() == Predicate::AND)
+        std::stable_sort(operands.begin(), operands.end(), [this](uint a, uint b) {
+            return this->nodes[a].column < this->nodes[b].column;
+        });
+    Node &compiled = this->nodes[i];  // adding the operands may have moved it
+    compiled.operands = operands;
+    for (auto const &operand: operands)
+        compiled.column = std::min(compiled.column, this->nodes[operand].column);
+    return i;
+}
+
+void Tuple::append_n(ColumnAttribute::DataType data_type, int32_t n) {
+    Slot slot = {data_type, n, 0};
+    this->slots.push_back(slot);
+}
+
+void Tuple::append_s(const char *s, uint length) {
+    Slot slot = {ColumnAttribute::TEXT, (int32_t) this->text.size(), length};
+    this->text.append(s, length);
+    this->slots.push_back(slot);
+}
+
+void Tuple::set_n(uint i, ColumnAttribute::DataType data_type, int32_t n) {
+    Slot slot = {data_type, n, 0};
+    this->slots[i] = slot;
+}
+
+void Tuple::set_s(uint i, const char *s, uint length) {
+    Slot slot = {ColumnAttribute::TEXT, (int32_t) this->text.size(), length};
+    this->text.append(s, length);
+    this->slots[i] = slot;
+}
+
+void Tuple::append(const Value &value) {
+    if (value.data_type == ColumnAttribute::TEXT)
+        append_s(value.s.data(), (uint) value.s.size());
+    else
+        append_n(value.data_type, value.n);
+}
+
+void Tuple::append(const Tuple &other, uint i) {
+    if (other.get_data_type(i) == ColumnAttribute::TEXT)
+        append_s(other.get_text(i), other.get_length(i));
+    else
+        append_n(other.get_data_type(i), other.get_n(i));
+}
+
+Value Tuple::get(uint i) const {
+    Value value;
+    value.data_type = this->slots[i].data_type;
+    if (value.data_type == ColumnAttribute::TEXT)
+        value.s = get_s(i);
+    else
+        value.n = this->slots[i].n;
+    return value;
+}
+
+// Same semantics as Value::operator== but without building a Value
+bool Tuple::equals(uint i, const Value &value) const {
+    const Slot &slot = this->slots[i];
+    if (slot.data_type != value.data_type)
+        return false;
+    if (slot.data_type != ColumnAttribute::TEXT)
+        return slot.n == value.n;
+    return slot.length == value.s.size() && value.s.compare(0, slot.length, get_text(i), slot.length) == 0;
+}
+
+bool Tuple::operator==(const Tuple &other) const {
+    if (size() != other.size())
+        return false;
+    for (uint i = 0; i < size(); i++) {
+        if (get_data_type(i) != other.get_data_type(i))
+            return false;
+        if (get_data_type(i) == ColumnAttribute::TEXT) {
+            if (get_length(i) != other.get_length(i) || memcmp(get_text(i), other.get_text(i), get_length(i)) != 0)
+                return false;
+        } else if (get_n(i) != other.get_n(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ValueDict *Tuple::to_dict(const ColumnNames &column_names) const {
+    ValueDict *row = new ValueDict();
+    for (uint i = 0; i < size() && i < column_names.size(); i++)
+        (*row)[column_names[i]] = get(i);
+    return row;
+}
+
+Tuple *Tuple::from_dict(const ValueDict &row, const ColumnNames &column_names) {
+    Tuple *tuple = new Tuple();
+    tuple->reserve((uint) column_names.size());
+    for (auto const &column_name: column_names) {
+        ValueDict::const_iterator column = row.find(column_name);
+        if (column == row.end()) {
+            delete tuple;
+            throw DbRelationError("unknown column " + column_name);
+        }
+        tuple->append(column->second);
+    }
+    return tuple;
+}
+
+void RowBatch::append_n(uint j, ColumnAttribute::DataType data_type, int32_t n) {
+    Column &column = this->columns[j];
+    column.data_type = data_type;
+    column.n.push_back(n);
+}
+
+void RowBatch::append_s(uint j, const char *s, uint length) {
+    Column &column = this->columns[j];
+    column.data_type = ColumnAttribute::TEXT;
+    column.n.push_back((int32_t) this->text.size());
+    column.length.resize(this->rows + 1);
+    column.length[this->rows] = length;
+    this->text.append(s, length);
+}
+
+void RowBatch::append(const Tuple &row) {
+    append(0, row);
+    end_row();
+}
+
+void RowBatch::append(uint j, const Tuple &row) {
+    for (uint k = 0; k < row.size(); k++)
+        if (row.get_data_type(k) == ColumnAttribute::TEXT)
+            append_s(j + k, row.get_text(k), row.get_length(k));
+        else
+            append_n(j + k, row.get_data_type(k), row.get_n(k));
+}
+
+void RowBatch::append(uint j, const RowBatch &other, uint r) {
+    for (uint k = 0; k < other.width(); k++)
+        if (other.get_data_type(k) == ColumnAttribute::TEXT)
+            append_s(j + k, other.get_text(k, r), other.get_length(k, r));
+        else
+            append_n(j + k, other.get_data_type(k), other.columns[k].n[r]);
+}
+
+// Same semantics as Value::operator==, a column at a time. The comparisons don't branch on the
+// outcome, so the INT loop is a straight run the compiler can vectorize.
+void RowBatch::select_equal(uint j, const Value &value) {
+    const Column &column = this->columns[j];
+    uint out = 0;
+    if (column.data_type != value.data_type) {
+        this->selection.clear();
+        return;
+    }
+    uint *selection = this->selection.data();
+    uint count = (uint) this->selection.size();
+    if (column.data_type != ColumnAttribute::TEXT) {
+        const int32_t *n = column.n.data();
+        int32_t v = value.n;
+        for (uint k = 0; k < count; k++) {
+            uint r = selection[k];
+            selection[out] = r;
+            out += n[r] == v;
+        }
+    } else {
+        const char *s = value.s.data();
+        uint length = (uint) value.s.size();
+        for (uint k = 0; k < count; k++) {
+            uint r = selection[k];
+            selection[out] = r;
+            out += column.length[r] == length && memcmp(this->text.data() + column.n[r], s, length) == 0;
+        }
+    }
+    this->selection.resize(out);
+}
+
+void RowBatch::select_range(uint start, uint count) {
+    start = std::min(start, (uint) this->selection.size());
+    count = std::min(count, (uint) this->selection.size() - start);
+    this->selection.erase(this->selection.begin() + start + count, this->selection.end());
+    this->selection.erase(this->selection.begin(), this->selection.begin() + start);
+}
+
+/**
+ * @class BatchRow - one row of a RowBatch, as CompiledPredicate::matches wants to see it
+ */
+class BatchRow {
+public:
+    BatchRow(const RowBatch &batch, uint r) : batch(batch), r(r) {}
+
+    ColumnAttribute::DataType get_data_type(uint j) const { return batch.get_data_type(j); }
+
+    int32_t get_n(uint j) const { return batch.get_ns(j)[r]; }
+
+    const char *get_text(uint j) const { return batch.get_text(j, r); }
+
+    uint get_length(uint j) const { return batch.get_length(j, r); }
+
+protected:
+    const RowBatch &batch;
+    uint r;
+};
+
+void RowBatch::select(const CompiledPredicate &predicate) {
+    if (predicate.empty())
+        return;
+    uint *selection = this->selection.data();
+    uint count = (uint) this->selection.size();
+    uint out = 0;
+    for (uint k = 0; k < count; k++) {
+        uint r = selection[k];
+        selection[out] = r;
+        out += predicate.matches(BatchRow(*this, r));
+    }
+    this->selection.resize(out);
+}
+
+RowBatch *RowBatch::gather(const std::vector<uint> &positions) const {
+    RowBatch *ret = new RowBatch((uint) positions.size());
+    for (uint j = 0; j < positions.size(); j++) {
+        const Column &from = this->columns[positions[j]];
+        Column &to = ret->columns[j];
+        to.data_type = from.data_type;
+        to.n.reserve(this->selection.size());
+        if (from.data_type != ColumnAttribute::TEXT) {
+            for (auto const &r: this->selection)
+                to.n.push_back(from.n[r]);
+        } else {
+            to.length.reserve(this->selection.size());
+            for (auto const &r: this->selection) {
+                to.n.push_back((int32_t) ret->text.size());
+                to.length.push_back(from.length[r]);
+                ret->text.append(this->text.data() + from.n[r], from.length[r]);
+            }
+        }
+    }
+    ret->rows = (uint) this->selection.size();
+    ret->selection.resize(ret->rows);
+    for (uint r = 0; r < ret->rows; r++)
+        ret->selection[r] = r;
+    return ret;
+}
+
+Value RowBatch::get(uint j, uint r) const {
+    Value value;
+    value.data_type = get_data_type(j);
+    if (value.data_type == ColumnAttribute::TEXT)
+        value.s.assign(get_text(j, r), get_length(j, r));
+    else
+        value.n = this->columns[j].n[r];
+    return value;
+}
+
+void RowBatch::get_key(uint r, const std::vector<uint> &columns, std::string &key) const {
+    key.clear();
+    for (auto const &j: columns) {
+        const Column &column = this->columns[j];
+        key.push_back((char) column.data_type);
+        if (column.data_type == ColumnAttribute::TEXT) {
+            uint length = column.length[r];
+            key.append((const char *) &length, sizeof(uint));
+            key.append(this->text.data() + column.n[r], length);
+        } else {
+            key.append((const char *) &column.n[r], sizeof(int32_t));
+        }
+    }
+}
+
+void RowBatch::get_sort_key(uint r, const std::vector<uint> &columns, const std::vector<bool> &descending,
+                            std::string &key) const {
+    key.clear();
+    for (uint k = 0; k < columns.size(); k++) {
+        const Column &column = this->columns[columns[k]];
+        size_t start = key.size();
+        if (column.data_type == ColumnAttribute::TEXT) {
+            // zero bytes are escaped as 0x00 0xff so that the 0x00 0x00 terminator sorts before any character
+            const char *s = this->text.data() + column.n[r];
+            for (uint i = 0; i < column.length[r]; i++) {
+                key.push_back(s[i]);
+                if (s[i] == '\0')
+                    key.push_back((char) 0xff);
+            }
+            key.append(2, '\0');
+        } else if (column.data_type == ColumnAttribute::BOOLEAN) {
+            key.push_back((char) (column.n[r] != 0));
+        } else {
+            uint32_t u = (uint32_t) column.n[r] ^ 0x80000000U;  // flip the sign bit so negatives come first
+            for (int shift = 24; shift >= 0; shift -= 8)
+                key.push_back((char) (u >> shift));
+        }
+        if (descending[k])
+            for (size_t i = start; i < key.size(); i++)
+                key[i] = (char) ~key[i];
+    }
+}
+
+size_t RowBatch::bytes() const {
+    size_t ret = sizeof(RowBatch) + this->text.capacity() + this->selection.capacity() * sizeof(uint);
+    for (auto const &column: this->columns)
+        ret += sizeof(Column) + column.n.capacity() * sizeof(int32_t) + column.length.capacity() * sizeof(uint);
     return ret;
 }
 
+Tuple *RowBatch::get_row(uint r) const {
+    Tuple *tuple = new Tuple();
+    tuple->reserve(width());
+    for (uint j = 0; j < width(); j++)
+        if (get_data_type(j) == ColumnAttribute::TEXT)
+            tuple->append_s(get_text(j, r), get_length(j, r));
+        else
+            tuple->append_n(get_data_type(j), this->columns[j].n[r]);
+    return tuple;
+}
@@ -9,8 +9,11 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <cstring>
 #include <exception>
 #include <map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include "db_cxx.h"
@@ -35,6 +38,7 @@ typedef std::length_error DbBlockNoRoomError;
  * Methods for putting/getting records in blocks:
  * 	add(data)
  * 	get(record_id)
+ * 	view(record_id, record)
  * 	put(record_id, data)
  * 	del(record_id)
  * 	ids()
@@ -46,10 +50,23 @@ typedef std::length_error DbBlockNoRoomError;
 class DbBlock {
 public:
     /**
-     * our blocks are 4kB
+     * our blocks are 4kB unless the file says otherwise
      */
     static const uint BLOCK_SZ = 4096;
 
+    /**
+     * largest block a file can ask for
+     */
+    static const uint MAX_BLOCK_SZ = 1024 * 1024;
+
+    /**
+     * @param block_size  a proposed block size
+     * @returns           true if it is a power of two from BLOCK_SZ to MAX_BLOCK_SZ
+     */
+    static bool valid_block_size(uint block_size) {
+        return block_size >= BLOCK_SZ && block_size <= MAX_BLOCK_SZ && (block_size & (block_size - 1)) == 0;
+    }
+
     /**
      * ctor/dtor (subclasses should handle the big-5)
      */
@@ -72,6 +89,15 @@ public:
      */
     virtual Dbt *get(RecordID record_id) const = 0;
 
+    /**
+     * Look at a record in place, without allocating or copying anything.
+     * The view is only good for as long as the block's memory is.
+     * @param record_id  which record to look at
+     * @param record     set to point at the record's bytes within the block
+     * @returns          false if the record has been deleted (record is unchanged)
+     */
+    virtual bool view(RecordID record_id, Dbt &record) const = 0;
+
     /**
      * Change the data stored for a record in this block.
      * @param record_id  which record to update
@@ -108,7 +134,7 @@ public:
      * Get the number of bytes not currently used to store data or for overhead.
      * @returns  number of unused bytes
      */
-    virtual u_int16_t unused_bytes() const = 0;
+    virtual uint unused_bytes() const = 0;
 
     /**
      * Access the whole block's memory as a BerkeleyDB Dbt pointer.
@@ -122,6 +148,11 @@ public:
      */
     virtual void *get_data() { return block.get_data(); }
 
+    /**
+     * @returns  size of the block in bytes (the size of its Dbt)
+     */
+    virtual uint get_block_size() const { return block.get_size(); }
+
     /**
      * Get this block's BlockID within its DbFile.
      * @returns this block's id
@@ -263,6 +294,549 @@ typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict *> ValueDicts;
 
 
+/**
+ * @class Predicate - where clause as a tree of conditions on the columns of a row
+ *
+ * Leaves compare a column to literal values: EQ, NE, LT, LE, GT, and GE to one value, BETWEEN to a
+ * low and a high value (inclusive), and IN to a list of them. Inner nodes are AND and OR (of any
+ * number of operands) and NOT (of one). An AND of nothing is always true.
+ */
+class Predicate {
+public:
+    enum Type {
+        EQ, NE, LT, LE, GT, GE, BETWEEN, IN, AND, OR, NOT
+    };
+
+    Predicate(Type type, const Identifier &column_name, const Value &value);  // use for EQ, NE, LT, LE, GT, GE
+    Predicate(const Identifier &column_name, const Value &low, const Value &high);  // use for BETWEEN
+    Predicate(const Identifier &column_name, const std::vector<Value> &values);  // use for IN
+    Predicate(Type type, const std::vector<Predicate *> &operands);  // use for AND, OR, NOT (operands freed by us)
+    explicit Predicate(const ValueDict &conjunction);  // AND of an EQ for each entry
+    Predicate(const Predicate &other);  // use for copying
+
+    virtual ~Predicate();
+
+    Predicate(Predicate &&temp) = delete;
+
+    Predicate &operator=(const Predicate &other) = delete;
+
+    Predicate &operator=(Predicate &&temp) = delete;
+
+    Type get_type() const { return type; }
+
+    /**
+     * @returns  true for the comparisons, BETWEEN, and IN (which are on a column)
+     */
+    bool is_leaf() const { return type < AND; }
+
+    /**
+     * @returns  the column compared (for a leaf)
+     */
+    const Identifier &get_column_name() const { return column_name; }
+
+    /**
+     * @returns  the value compared to, the low and high values for BETWEEN, or the list for IN (for a leaf)
+     */
+    const std::vector<Value> &get_values() const { return values; }
+
+    /**
+     * @returns  the operands (for AND, OR, and NOT)
+     */
+    const std::vector<Predicate *> &get_operands() const { return operands; }
+
+    /**
+     * Get the conditions that all have to hold, looking through nested ANDs.
+     * @param conjuncts  returned by reference: the conditions (pointing into this predicate)
+     */
+    void get_conjuncts(std::vector<const Predicate *> &conjuncts) const;
+
+    /**
+     * Get the columns the predicate looks at.
+     * @param column_names  returned by reference: each column not already in the list is added to it
+     */
+    void get_column_names(ColumnNames &column_names) const;
+
+protected:
+    Type type;
+    Identifier column_name;
+    std::vector<Value> values;
+    std::vector<Predicate *> operands;
+};
+
+
+/**
+ * @class Tuple - compact, schema-ordered row of values
+ *
+ * Column i of the row is slot i. Each slot is fixed width: INT and BOOLEAN values are stored right
+ * in the slot and TEXT values are stored back to back in a single variable-length area with the slot
+ * holding the offset and length. Building one costs two allocations no matter how many columns there
+ * are, versus a key string and a Value per column for a ValueDict.
+ * The column names are not kept in the tuple; they are whatever the producer (e.g., project) was asked for.
+ */
+class Tuple {
+public:
+    Tuple() : slots(), text() {}
+
+    virtual ~Tuple() {}
+
+    /**
+     * Reserve room for a row of the given width.
+     * @param width  number of columns expected
+     */
+    void reserve(uint width) { slots.reserve(width); }
+
+    /**
+     * Set the width of the row so columns can be filled in out of order with set_n/set_s.
+     * @param width  number of columns
+     */
+    void resize(uint width) { slots.resize(width); }
+
+    /**
+     * Set an INT or BOOLEAN column value (column must already exist).
+     */
+    void set_n(uint i, ColumnAttribute::DataType data_type, int32_t n);
+
+    /**
+     * Set a TEXT column value (column must already exist).
+     * @param s       pointer to the characters (copied)
+     * @param length  number of characters
+     */
+    void set_s(uint i, const char *s, uint length);
+
+    /**
+     * Add an INT or BOOLEAN column value.
+     */
+    void append_n(ColumnAttribute::DataType data_type, int32_t n);
+
+    /**
+     * Add a TEXT column value.
+     * @param s       pointer to the characters (copied)
+     * @param length  number of characters
+     */
+    void append_s(const char *s, uint length);
+
+    /**
+     * Add a column value of any type.
+     */
+    void append(const Value &value);
+
+    /**
+     * Add a copy of column i of another row.
+     */
+    void append(const Tuple &other, uint i);
+
+    /**
+     * @returns  number of columns in the row
+     */
+    uint size() const { return (uint) slots.size(); }
+
+    ColumnAttribute::DataType get_data_type(uint i) const { return slots[i].data_type; }
+
+    /**
+     * Value of an INT or BOOLEAN column.
+     */
+    int32_t get_n(uint i) const { return slots[i].n; }
+
+    /**
+     * Location of the characters of a TEXT column (not null-terminated).
+     */
+    const char *get_text(uint i) const { return text.data() + slots[i].n; }
+
+    /**
+     * Length of a TEXT column.
+     */
+    uint get_length(uint i) const { return slots[i].length; }
+
+    /**
+     * Value of a TEXT column as a string.
+     */
+    std::string get_s(uint i) const { return text.substr(slots[i].n, slots[i].length); }
+
+    /**
+     * Value of column i of any type.
+     */
+    Value get(uint i) const;
+
+    /**
+     * Compare column i to a value.
+     */
+    bool equals(uint i, const Value &value) const;
+
+    bool operator==(const Tuple &other) const;
+
+    bool operator!=(const Tuple &other) const { return !(*this == other); }
+
+    /**
+     * Compatibility adapter: convert to a ValueDict.
+     * @param column_names  name of each column in order
+     * @returns             dictionary of values keyed by column_names (freed by caller)
+     */
+    ValueDict *to_dict(const ColumnNames &column_names) const;
+
+    /**
+     * Compatibility adapter: convert from a ValueDict.
+     * @param row           dictionary of values
+     * @param column_names  which values to take and in what order
+     * @returns             the tuple (freed by caller)
+     */
+    static Tuple *from_dict(const ValueDict &row, const ColumnNames &column_names);
+
+protected:
+    struct Slot {
+        ColumnAttribute::DataType data_type;
+        int32_t n;  // value for INT and BOOLEAN, offset into text for TEXT
+        uint length;  // length for TEXT
+    };
+    std::vector<Slot> slots;
+    std::string text;
+};
+
+typedef std::vector<Tuple *> Tuples;
+
+
+class CompiledPredicate;
+
+/**
+ * @class RowBatch - a batch of rows stored column by column
+ *
+ * Each column is a vector with one entry per row: INT and BOOLEAN values are right in the vector and
+ * TEXT values are offsets into a character area shared by the batch, with their lengths alongside.
+ * Operators can then work through a whole column at a time in a tight loop. The selection vector lists
+ * (in order) the rows that are still in play, so a filter just shrinks it without moving any values.
+ */
+class RowBatch {
+public:
+    static const uint BATCH_SZ = 1024;  // rows per batch produced by the plan operators
+
+    RowBatch(uint width) : columns(width), rows(0), selection(), text() {}
+
+    virtual ~RowBatch() {}
+
+    /**
+     * @returns  number of columns
+     */
+    uint width() const { return (uint) columns.size(); }
+
+    /**
+     * @returns  number of rows stored (selected or not)
+     */
+    uint size() const { return rows; }
+
+    /**
+     * Add an INT or BOOLEAN value to column j of the row being built.
+     */
+    void append_n(uint j, ColumnAttribute::DataType data_type, int32_t n);
+
+    /**
+     * Add a TEXT value to column j of the row being built.
+     * @param s       pointer to the characters (copied)
+     * @param length  number of characters
+     */
+    void append_s(uint j, const char *s, uint length);
+
+    /**
+     * Finish the row being built (every column must have had a value added) and select it.
+     */
+    void end_row() { selection.push_back(rows++); }
+
+    /**
+     * Add a whole row (and select it).
+     * @param row  values for each column in order
+     */
+    void append(const Tuple &row);
+
+    /**
+     * Add all the columns of a tuple to the row being built.
+     * @param j    where the tuple's first column goes
+     * @param row  values to copy
+     */
+    void append(uint j, const Tuple &row);
+
+    /**
+     * Add all the columns of a row of another batch to the row being built.
+     * @param j      where the other batch's first column goes
+     * @param other  batch to copy from
+     * @param r      row number in the other batch
+     */
+    void append(uint j, const RowBatch &other, uint r);
+
+    ColumnAttribute::DataType get_data_type(uint j) const { return columns[j].data_type; }
+
+    /**
+     * INT or BOOLEAN values of column j, one per row.
+     */
+    const int32_t *get_ns(uint j) const { return columns[j].n.data(); }
+
+    /**
+     * Location of the characters of a TEXT value (not null-terminated).
+     */
+    const char *get_text(uint j, uint r) const { return text.data() + columns[j].n[r]; }
+
+    /**
+     * Length of a TEXT value.
+     */
+    uint get_length(uint j, uint r) const { return columns[j].length[r]; }
+
+    /**
+     * Value of column j of row r of any type.
+     */
+    Value get(uint j, uint r) const;
+
+    /**
+     * @returns  the rows still in play
+     */
+    const std::vector<uint> &get_selection() const { return selection; }
+
+    /**
+     * Shrink the selection to the rows whose column j equals the given value.
+     */
+    void select_equal(uint j, const Value &value);
+
+    /**
+     * Shrink the selection to a run of the rows already selected.
+     * @param start  how many of the selected rows to skip
+     * @param count  how many of the selected rows after those to keep
+     */
+    void select_range(uint start, uint count);
+
+    /**
+     * Shrink the selection to the rows that satisfy a predicate.
+     * @param predicate  compiled against the columns of the batch
+     */
+    void select(const CompiledPredicate &predicate);
+
+    /**
+     * Copy some of the columns of the selected rows into a new batch.
+     * @param positions  which column to take for each column of the result
+     * @returns          the new batch, with all its rows selected (freed by caller)
+     */
+    RowBatch *gather(const std::vector<uint> &positions) const;
+
+    /**
+     * Encode the values of some columns of a row so that rows with equal values get equal keys.
+     * @param r        row number
+     * @param columns  which columns
+     * @param key      returned by reference: the encoded values (typed, so 1 and "1" differ)
+     */
+    void get_key(uint r, const std::vector<uint> &columns, std::string &key) const;
+
+    /**
+     * Encode the values of some columns of a row so that comparing the keys bytewise (as unsigned
+     * characters, like std::string does) puts the rows in order by those columns.
+     * @param r           row number
+     * @param columns     which columns, most significant first
+     * @param descending  for each of the columns, whether it goes from high to low
+     * @param key         returned by reference: the encoded values
+     */
+    void get_sort_key(uint r, const std::vector<uint> &columns, const std::vector<bool> &descending,
+                      std::string &key) const;
+
+    /**
+     * @returns  rough number of bytes of memory taken by the batch
+     */
+    size_t bytes() const;
+
+    /**
+     * Get one row as a tuple.
+     * @param r  row number (not position in the selection)
+     * @returns  the tuple (freed by caller)
+     */
+    Tuple *get_row(uint r) const;
+
+protected:
+    struct Column {
+        Column() : data_type(ColumnAttribute::INT), n(), length() {}
+
+        ColumnAttribute::DataType data_type;
+        std::vector<int32_t> n;  // values for INT and BOOLEAN, offsets into text for TEXT
+        std::vector<uint> length;  // lengths for TEXT
+    };
+    std::vector<Column> columns;
+    uint rows;
+    std::vector<uint> selection;
+    std::string text;
+};
+
+
+/**
+ * @class CompiledPredicate - a Predicate worked out against the column layout of some kind of row
+ *
+ * Column names are turned into positions once, up front. IN lists become a hash set of the INT
+ * values and a sorted array of the TEXT ones, so checking a row doesn't go through the whole list.
+ * The operands of an AND are checked in order of the columns they look at, stopping at the first
+ * one that fails. Comparing a column to a value of another type is never true.
+ * A row can be anything with get_data_type(j), get_n(j), get_text(j), and get_length(j) for the
+ * column at position j, like a Tuple.
+ */
+class CompiledPredicate {
+public:
+    /**
+     * @param where         the predicate, or nullptr for none
+     * @param column_names  the columns of the rows, in position order
+     * @throws DbRelationError if the predicate looks at a column that isn't there
+     */
+    CompiledPredicate(const Predicate *where, const ColumnNames &column_names);
+
+    virtual ~CompiledPredicate() {}
+
+    /**
+     * @returns  true if there are no conditions
+     */
+    bool empty() const { return nodes.empty(); }
+
+    /**
+     * Check a row.
+     * @param row  the row
+     * @returns    true if it satisfies the predicate
+     */
+    template<class Row>
+    bool matches(const Row &row) const { return empty() || matches(0, row); }
+
+protected:
+    struct Node {
+        Predicate::Type type;
+        uint column;  // position of the column for a leaf, otherwise the first column looked at
+        ColumnAttribute::DataType data_type;  // of the values of a comparison or BETWEEN (INT for IN)
+        std::vector<Value> values;  // as in the Predicate, except for IN
+        std::unordered_set<int32_t> ns;  // INT values for IN
+        std::vector<std::string> ss;  // TEXT values for IN, sorted
+        std::vector<uint> operands;  // node numbers
+    };
+    std::vector<Node> nodes;  // the root is node 0
+
+    uint compile(const Predicate *where, const ColumnNames &column_names);
+
+    template<class Row>
+    bool matches(uint i, const Row &row) const;
+
+    static bool test(const Node &node, int32_t n);
+
+    static bool test(const Node &node, const char *s, uint length);
+};
+
+template<class Row>
+bool CompiledPredicate::matches(uint i, const Row &row) const {
+    const Node &node = this->nodes[i];
+    switch (node.type) {
+        case Predicate::AND:
+            for (auto const &operand: node.operands)
+                if (!matches(operand, row))
+                    return false;
+            return true;
+        case Predicate::OR:
+            for (auto const &operand: node.operands)
+                if (matches(operand, row))
+                    return true;
+            return false;
+        case Predicate::NOT:
+            return !matches(node.operands[0], row);
+        default: {
+            ColumnAttribute::DataType data_type = row.get_data_type(node.column);
+            if (data_type == ColumnAttribute::TEXT)
+                return test(node, row.get_text(node.column), row.get_length(node.column));
+            return data_type == node.data_type && test(node, row.get_n(node.column));
+        }
+    }
+}
+
+// Comparisons to an INT or BOOLEAN column of the same type as the values
+inline bool CompiledPredicate::test(const Node &node, int32_t n) {
+    switch (node.type) {
+        case Predicate::IN:
+            return node.ns.count(n) > 0;
+        case Predicate::EQ:
+            return n == node.values[0].n;
+        case Predicate::NE:
+            return n != node.values[0].n;
+        case Predicate::LT:
+            return n < node.values[0].n;
+        case Predicate::LE:
+            return n <= node.values[0].n;
+        case Predicate::GT:
+            return n > node.values[0].n;
+        case Predicate::GE:
+            return n >= node.values[0].n;
+        default:
+            return node.values[0].n <= n && n <= node.values[1].n;
+    }
+}
+
+// Comparisons to a TEXT column, ordered like std::string
+inline bool CompiledPredicate::test(const Node &node, const char *s, uint length) {
+    auto compare = [s, length](const std::string &value) {
+        int cmp = memcmp(s, value.data(), std::min((size_t) length, value.size()));
+        return cmp != 0 ? cmp : (length < value.size() ? -1 : (length > value.size() ? 1 : 0));
+    };
+    if (node.type == Predicate::IN) {
+        auto it = std::lower_bound(node.ss.begin(), node.ss.end(), s, [&compare](const std::string &value,
+                                                                               const char *) {
+            return compare(value) > 0;
+        });
+        return it != node.ss.end() && compare(*it) == 0;
+    }
+    if (node.data_type != ColumnAttribute::TEXT)
+        return false;
+    switch (node.type) {
+        case Predicate::EQ:
+            return length == node.values[0].s.size() && memcmp(s, node.values[0].s.data(), length) == 0;
+        case Predicate::NE:
+            return compare(node.values[0].s) != 0;
+        case Predicate::LT:
+            return compare(node.values[0].s) < 0;
+        case Predicate::LE:
+            return compare(node.values[0].s) <= 0;
+        case Predicate::GT:
+            return compare(node.values[0].s) > 0;
+        case Predicate::GE:
+            return compare(node.values[0].s) >= 0;
+        default:
+            return compare(node.values[0].s) >= 0 && compare(node.values[1].s) <= 0;
+    }
+}
+
+
+/**
+ * @class DbCursor - abstract base class for a pull-based scan over row handles
+ * Rows are produced one at a time as they are asked for, so nothing is materialized up front
+ * and the first row is available as soon as it is found.
+ * 	next(handle)
+ */
+class DbCursor {
+public:
+    virtual ~DbCursor() {}
+
+    /**
+     * Advance to the next qualifying row.
+     * @param handle  set to the handle of the next row (unchanged if there isn't one)
+     * @returns       true if a row was produced, false if the cursor is exhausted
+     */
+    virtual bool next(Handle &handle) = 0;
+};
+
+
+/**
+ * @class HandlesCursor - DbCursor over an already materialized list of handles
+ * (for relations that only know how to do select()).
+ */
+class HandlesCursor : public DbCursor {
+public:
+    // takes ownership of handles
+    HandlesCursor(Handles *handles) : handles(handles), i(0) {}
+
+    virtual ~HandlesCursor() { delete handles; }
+
+    HandlesCursor(const HandlesCursor &other) = delete;
+
+    HandlesCursor &operator=(const HandlesCursor &other) = delete;
+
+    virtual bool next(Handle &handle);
+
+protected:
+    Handles *handles;
+    Handles::size_type i;
+};
+
+
 /**
  * @class DbRelationError - generic exception class for DbRelation
  */
@@ -288,8 +862,13 @@ public:
  *	del(handle)
  *	select()
  *	select(where)
+ *	cursor()
+ *	cursor(where)
  *	project(handle)
  *	project(handle, column_names)
+ *	project_tuple(handle)
+ *	project_tuple(handle, column_names)
+ *	project_batch(cursor, column_names, batch, max_rows)
  */
 class DbRelation {
 public:
@@ -328,6 +907,17 @@ public:
      */
     virtual void close() = 0;
 
+    /**
+     * Make sure any changes the table is holding in memory have been written out.
+     */
+    virtual void sync() {}
+
+    /**
+     * Rough size of the relation, for the optimizer to go by.
+     * @returns  number of blocks the relation takes up (0 if not known)
+     */
+    virtual uint32_t get_block_count() { return 0; }
+
     /**
      * Execute: INSERT INTO <table_name> ( <row_keys> ) VALUES ( <row_values> )
      * @param row  a dictionary keyed by column names
@@ -335,6 +925,19 @@ public:
      */
     virtual Handle insert(const ValueDict *row) = 0;
 
+    /**
+     * Execute: INSERT INTO <table_name> ( <row_keys> ) VALUES ( <row_values> ), ( <row_values> ), ...
+     * @param rows  dictionaries keyed by column names
+     * @returns     handles to the new rows in the same order (freed by caller)
+     */
+    virtual Handles *insert_batch(const ValueDicts *rows) {
+        Handles *handles = new Handles();
+        handles->reserve(rows->size());
+        for (auto const &row: *rows)
+            handles->push_back(insert(row));
+        return handles;
+    }
+
     /**
      * Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
      * where handle is sufficient to identify one specific record (e.g., returned
@@ -374,6 +977,42 @@ public:
      */
     virtual Handles *select(Handles *current_selection, const ValueDict *where) = 0;
 
+    /**
+     * Streaming version of select(): SELECT <handle> FROM <table_name> WHERE 1
+     * @returns  a cursor over all the rows (freed by caller)
+     */
+    virtual DbCursor *cursor();
+
+    /**
+     * Streaming version of select(where): SELECT <handle> FROM <table_name> WHERE <where>
+     * @param where  where-clause predicates
+     * @returns      a cursor over the qualifying rows (freed by caller)
+     */
+    virtual DbCursor *cursor(const ValueDict *where);
+
+    /**
+     * Streaming version of select(current_selection, where).
+     * @param current_selection  restrict selection to rows from this cursor (freed along with the returned cursor)
+     * @param where              where-clause predicates
+     * @returns                  a cursor over the qualifying rows (freed by caller)
+     */
+    virtual DbCursor *cursor(DbCursor *current_selection, const ValueDict *where);
+
+    /**
+     * Streaming select with any where clause: SELECT <handle> FROM <table_name> WHERE <where>
+     * @param where  where-clause predicate
+     * @returns      a cursor over the qualifying rows (freed by caller)
+     */
+    virtual DbCursor *cursor(const Predicate *where);
+
+    /**
+     * Streaming version of select(current_selection, where) with any where clause.
+     * @param current_selection  restrict selection to rows from this cursor (freed along with the returned cursor)
+     * @param where              where-clause predicate
+     * @returns                  a cursor over the qualifying rows (freed by caller)
+     */
+    virtual DbCursor *cursor(DbCursor *current_selection, const Predicate *where);
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -399,12 +1038,38 @@ public:
      */
     virtual ValueDict *project(Handle handle, const ValueDict *column_names);
 
-    // additional versions of project for multiple rows
-    virtual ValueDicts *project(Handles *handles);
+    /**
+     * Return all the values for handle as a compact tuple (SELECT *).
+     * @param handle  row to get values from
+     * @returns       tuple of values in the order of get_column_names() (freed by caller)
+     */
+    virtual Tuple *project_tuple(Handle handle);
 
-    virtual ValueDicts *project(Handles *handles, const ColumnNames *column_names);
+    /**
+     * Return the values for handle given by column_names as a compact tuple
+     * (SELECT <column_names>).
+     * @param handle        row to get values from
+     * @param column_names  list of column names to project
+     * @returns             tuple of values in the order of column_names (freed by caller)
+     */
+    virtual Tuple *project_tuple(Handle handle, const ColumnNames *column_names);
 
-    virtual ValueDicts *project(Handles *handles, const ValueDict *column_names);
+    /**
+     * Add the given columns of the next rows from a cursor over this relation to a batch.
+     * @param cursor        where to get the rows
+     * @param column_names  columns to project (batch has one column for each)
+     * @param batch         where to put the values
+     * @param max_rows      most rows to add
+     * @returns             number of rows added (zero once the cursor is exhausted)
+     */
+    virtual uint project_batch(DbCursor *cursor, const ColumnNames *column_names, RowBatch *batch, uint max_rows);
+
+    // additional versions of project for multiple rows (tuples are in the order of the column names)
+    virtual Tuples *project(Handles *handles);
+
+    virtual Tuples *project(Handles *handles, const ColumnNames *column_names);
+
+    virtual Tuples *project(Handles *handles, const ValueDict *column_names);
 
     /**
      * Accessor for column_names.
@@ -498,6 +1163,16 @@ public:
         throw DbRelationError("range index query not supported");
     }
 
+    /**
+     * Streaming version of range().
+     * @param min_key  dictionary of min (inclusive) search key, or nullptr for no lower bound
+     * @param max_key  dictionary of max (inclusive) search key, or nullptr for no upper bound
+     * @returns        cursor over the DbFile handles for records in range (freed by caller)
+     */
+    virtual DbCursor *range_cursor(ValueDict *min_key, ValueDict *max_key) const {
+        return new HandlesCursor(range(min_key, max_key));
+    }
+
     /**
      * Insert the index entry for the given record.
      * @param record  handle (into relation) to the record to insert
@@ -505,6 +1180,16 @@ public:
      */
     virtual void insert(Handle record) = 0;
 
+    /**
+     * Insert the index entries for each of the given records.
+     * @param records  handles (into relation) to the records to insert
+     *                 (must be in the relation at time of insertion)
+     */
+    virtual void insert_batch(Handles *records) {
+        for (auto const &record: *records)
+            insert(record);
+    }
+
     /**
      * Delete the index entry for the given record.
      * @param record  handle (into relation) to the record to remove
@@ -512,6 +1197,35 @@ public:
      */
     virtual void del(Handle record) = 0;
 
+    /**
+     * Make sure any changes the index is holding in memory have been written out.
+     */
+    virtual void sync() {}
+
+    /**
+     * Accessor for key_columns.
+     * @returns  the columns making up the search key, in order
+     */
+    virtual const ColumnNames &get_key_columns() const {
+        return key_columns;
+    }
+
+    /**
+     * Accessor for the relation this index is on.
+     * @returns  the indexed relation
+     */
+    virtual DbRelation &get_relation() const {
+        return relation;
+    }
+
+    /**
+     * Accessor for unique.
+     * @returns  true if no two records have the same search key
+     */
+    virtual bool is_unique() const {
+        return unique;
+    }
+
 protected:
     DbRelation &relation;
     Identifier name;